@@ -1,15 +1,25 @@
 #include <boost/asio.hpp>
 #include <boost/asio/detail/socket_option.hpp>
+#include <algorithm>
 #include <iostream>
+#include <poll.h>
 #include <string>
 #include <terraqtt/client.hpp>
 #include <terraqtt/static_container.hpp>
+#include <terraqtt/static_topic_filters.hpp>
 #include <terraqtt/string_view.hpp>
-#include <thread>
 
 using namespace boost::asio;
 using namespace terraqtt;
 
+constexpr char test_filter[]        = "test";
+constexpr char pc_version_filter[]  = "pc/led/version";
+constexpr char bed_version_filter[] = "bed/led/version";
+constexpr char firmware_filter[]    = "led/firmware/hmac";
+
+/// The subscriptions are known at compile time so they are matched without any runtime tables.
+using Filters = Static_topic_filters<test_filter, pc_version_filter, bed_version_filter, firmware_filter>;
+
 /**
  * Uses the basic input and output streams from the standard library. The string is a static container which
  * allows at most 64 characters (including zero terminating).
@@ -22,6 +32,13 @@ public:
 	using Parent::Parent;
 
 protected:
+	struct Topic_printer {
+		void operator()(std::integral_constant<std::size_t, 0>) { std::cout << "test: "; }
+		void operator()(std::integral_constant<std::size_t, 1>) { std::cout << "pc version: "; }
+		void operator()(std::integral_constant<std::size_t, 2>) { std::cout << "bed version: "; }
+		void operator()(std::integral_constant<std::size_t, 3>) { std::cout << "firmware: "; }
+	};
+
 	void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
 	                std::istream& payload, std::size_t payload_size) override
 	{
@@ -30,12 +47,8 @@ protected:
 		std::cout << "received (topic='";
 		std::cout.write(header.topic.begin(), header.topic.size());
 		std::cout << "'; " << payload_size << " bytes): ";
+		Filters::dispatch(header.topic, Topic_printer{});
 		std::cout << payload.rdbuf() << std::endl;
-
-		// the protocol requires an acknoledgment for QoS=1
-		if (header.qos == QoS::at_least_once) {
-			protocol::write_packet(*output(), ec, protocol::Puback_header{ header.packet_identifier });
-		}
 	}
 };
 
@@ -53,19 +66,38 @@ try {
 	}
 
 	Client client{ stream, stream };
+	// PUBACK, PUBREC and PUBCOMP are sent by the client
+	client.auto_acknowledge(true);
 	client.connect(String_view{ "my-client" }, true, Seconds{ 5 });
-	client.subscribe({ Subscribe_topic<String_view>{ "test", QoS::at_most_once } }, 1);
-	client.subscribe({ Subscribe_topic<String_view>{ "pc/led/version", QoS::at_most_once } }, 2);
-	client.subscribe({ Subscribe_topic<String_view>{ "bed/led/version", QoS::at_most_once } }, 3);
-	client.subscribe({ Subscribe_topic<String_view>{ "led/firmware/hmac", QoS::at_most_once } }, 4);
+	client.subscribe({ Subscribe_topic<String_view>{ test_filter, QoS::at_most_once } }, 1);
+	client.subscribe({ Subscribe_topic<String_view>{ pc_version_filter, QoS::at_most_once } }, 2);
+	client.subscribe({ Subscribe_topic<String_view>{ bed_version_filter, QoS::at_most_once } }, 3);
+	client.subscribe({ Subscribe_topic<String_view>{ firmware_filter, QoS::at_most_once } }, 4);
 
 	while (stream) {
 		std::error_code ec;
+		stream.flush();
+
+		// sleep until data arrives or the client needs attention; buffered data needs no waiting
+		int timeout         = -1;
+		const auto deadline = client.next_deadline();
+		if (stream.rdbuf()->in_avail() > 0) {
+			timeout = 0;
+		} else if (deadline != std::chrono::steady_clock::time_point::max()) {
+			const auto left = deadline - std::chrono::steady_clock::now();
+			// round up, so the deadline has passed on wake up
+			timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(
+			  std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1, 0));
+		}
+		pollfd descriptor{ stream.socket().native_handle(), POLLIN, 0 };
+		if (::poll(&descriptor, 1, timeout) < 0) {
+			break;
+		}
 
 		// non-blocking approach
 		const std::size_t available = stream.socket().lowest_layer().available() + stream.rdbuf()->in_avail();
 		if (available > 0) {
-			client.process_one(ec, available);
+			client.process_all(ec, available);
 		}
 
 		// blocking approach
@@ -77,8 +109,6 @@ try {
 		}
 
 		client.update_state();
-		stream.flush();
-		std::this_thread::sleep_for(std::chrono::milliseconds{ 100 });
 	}
 	std::cerr << "Stream broken\n";
 } catch (const std::system_error& e) {
@@ -0,0 +1,528 @@
+#ifndef TERRAQTT_ADVANCED_CLIENT_HPP_
+#define TERRAQTT_ADVANCED_CLIENT_HPP_
+
+#include "client.hpp"
+#include "packet_identifier_set.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace terraqtt {
+
+/**
+ * A client that follows the delivery semantics of QoS::at_least_once and QoS::exactly_once for outgoing
+ * messages. Packet identifiers are allocated from a Packet_identifier_set and every unacknowledged message
+ * is kept in an in-flight table indexed by its identifier, so acknowledgements are handled in constant time.
+ * The table has one small entry per identifier and is allocated once on construction. Topics and payloads
+ * are stored in a pool that only grows to the most messages in flight at the same time and whose strings keep
+ * their capacity, so no memory is allocated in the steady state if the `String` type reuses its storage like
+ * `std::string` does.
+ *
+ * Messages that are not acknowledged within the retransmit timeout are sent again with the DUP flag by
+ * update_state(). After reconnecting to a persistent session retransmit_all() sends everything in flight.
+ *
+ * The hooks on_puback(), on_pubrec() and on_pubcomp() drive the state machine and cannot be overridden,
+ * on_released() and on_delivered() are called instead. Messages of an earlier process can be taken over with
+ * resume().
+ *
+ * @tparam Input The input stream type.
+ * @tparam Output The output stream type.
+ * @tparam String The container for strings and the stored topics and payloads.
+ * @tparam Return_code_container The container for SUBACK return codes.
+ * @tparam Clock The clock used for keep alive and retransmission.
+ */
+template<typename Input, typename Output, typename String, typename Return_code_container, typename Clock>
+class Advanced_client : public Basic_client<Input, Output, String, Return_code_container, Clock> {
+	typedef Basic_client<Input, Output, String, Return_code_container, Clock> Parent;
+
+public:
+	/// The default amount of packet identifiers that can be in use at the same time.
+	constexpr static std::size_t default_max_in_flight = 64;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param[in] input The input stream.
+	 * @param[in] output The output stream.
+	 * @param max_in_flight How many packet identifiers can be in use at the same time; at most
+	 * Packet_identifier_set::max_capacity.
+	 */
+	Advanced_client(Input& input, Output& output, std::size_t max_in_flight = default_max_in_flight)
+	    : Parent{ input, output }, _identifiers{ max_in_flight }, _slots(_identifiers.capacity() + 1)
+	{}
+#if defined(__cpp_exceptions)
+	template<typename Topic, typename Payload>
+	std::uint16_t publish(const Topic& topic, const Payload& payload, QoS qos = QoS::at_most_once,
+	                      bool retain = false)
+	{
+		std::error_code ec;
+		const auto id = publish(ec, topic, payload, qos, retain);
+		return ec ? throw std::system_error{ ec } : id;
+	}
+#endif
+	/**
+	 * Publishes the payload and keeps track of it until it is acknowledged.
+	 *
+	 * @param ec[out] the error code, if any; Error::would_block if the flow control window is full,
+	 * Error::packet_identifiers_exhausted if too many messages are in flight and
+	 * `std::errc::not_enough_memory` if the topic or payload does not fit into `String`
+	 * @param topic the topic
+	 * @param payload the payload; must meet the requirements of a `Container`
+	 * @param qos the QoS
+	 * @param retain whether the payload should be stored on the broker
+	 * @returns The allocated packet identifier or `0` for QoS::at_most_once and on error.
+	 */
+	template<typename Topic, typename Payload>
+	std::uint16_t publish(std::error_code& ec, const Topic& topic, const Payload& payload,
+	                      QoS qos = QoS::at_most_once, bool retain = false)
+	{
+		if (qos == QoS::at_most_once) {
+			Parent::publish(ec, topic, payload, 0, qos, retain);
+			return 0;
+		}
+
+		protocol::Publish_header<const Topic&> header{ topic };
+		header.qos = qos;
+		if (!this->admit(ec, protocol::packet_size(ec, header, payload), true)) {
+			return 0;
+		}
+
+		const auto id = _identifiers.acquire();
+		if (!id) {
+			ec = Error::packet_identifiers_exhausted;
+			return 0;
+		}
+
+		auto& slot = _slots[id];
+		if (!_store(slot, topic, payload)) {
+			_identifiers.release(id);
+			ec = std::make_error_code(std::errc::not_enough_memory);
+			return 0;
+		}
+		const auto& message = _messages[slot.message];
+		if (on_publishing(ec, id, message.topic, message.payload, qos, retain), ec) {
+			_release_message(slot);
+			_identifiers.release(id);
+			return 0;
+		}
+		slot.state  = qos == QoS::at_least_once ? State::awaiting_puback : State::awaiting_pubrec;
+		slot.qos    = qos;
+		slot.retain = retain;
+		_append(id);
+		++_in_flight;
+
+		if (_transmit(ec, id, false), ec) {
+			_free(id);
+			return 0;
+		}
+		return id;
+	}
+#if defined(__cpp_exceptions)
+	template<typename Topic, typename Payload>
+	void resume(std::uint16_t packet_id, const Topic& topic, const Payload& payload, QoS qos, bool retain,
+	            bool released)
+	{
+		std::error_code ec;
+		if (resume(ec, packet_id, topic, payload, qos, retain, released), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Takes over a message of a previous session, for example one restored from a Message_log, and sends
+	 * it again with the DUP flag. If the broker already received it, only the PUBREL is sent.
+	 *
+	 * @param ec[out] the error code, if any; `std::errc::invalid_argument` if the identifier is in use or out
+	 * of range or the QoS is QoS::at_most_once and `std::errc::not_enough_memory` if the topic or payload
+	 * does not fit into `String`
+	 * @param packet_id the identifier the message was published with
+	 * @param topic the topic
+	 * @param payload the payload; must meet the requirements of a `Container`
+	 * @param qos the QoS
+	 * @param retain whether the payload should be stored on the broker
+	 * @param released whether a PUBREC was already received for this QoS::exactly_once message
+	 */
+	template<typename Topic, typename Payload>
+	void resume(std::error_code& ec, std::uint16_t packet_id, const Topic& topic, const Payload& payload,
+	            QoS qos, bool retain, bool released)
+	{
+		if (qos == QoS::at_most_once || !_identifiers.acquire(packet_id)) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			return;
+		}
+
+		// a released message is not published again, so it needs no storage
+		auto& slot = _slots[packet_id];
+		if (qos == QoS::exactly_once && released) {
+			slot.state = State::awaiting_pubcomp;
+		} else if (!_store(slot, topic, payload)) {
+			_identifiers.release(packet_id);
+			ec = std::make_error_code(std::errc::not_enough_memory);
+			return;
+		} else {
+			slot.state = qos == QoS::at_least_once ? State::awaiting_puback : State::awaiting_pubrec;
+		}
+		slot.qos    = qos;
+		slot.retain = retain;
+		_append(packet_id);
+		++_in_flight;
+		_transmit(ec, packet_id, true);
+	}
+	/**
+	 * Reserves a packet identifier for other packets like SUBSCRIBE, so it does not collide with the
+	 * identifiers of messages in flight.
+	 *
+	 * @param ec[out] Error::packet_identifiers_exhausted if all identifiers are in use
+	 * @returns The identifier or `0` on error.
+	 */
+	std::uint16_t acquire_packet_identifier(std::error_code& ec) noexcept
+	{
+		const auto id = _identifiers.acquire();
+		if (id) {
+			_slots[id].state = State::reserved;
+		} else {
+			ec = Error::packet_identifiers_exhausted;
+		}
+		return id;
+	}
+	/**
+	 * Reserves a specific packet identifier like acquire_packet_identifier(std::error_code&), for example one
+	 * that is still used by a message of a previous session.
+	 *
+	 * @returns `false` if the identifier is already in use or out of range.
+	 */
+	bool acquire_packet_identifier(std::uint16_t id) noexcept
+	{
+		if (!_identifiers.acquire(id)) {
+			return false;
+		}
+		_slots[id].state = State::reserved;
+		return true;
+	}
+	/// Releases an identifier of acquire_packet_identifier().
+	void release_packet_identifier(std::uint16_t id) noexcept
+	{
+		if (id < _slots.size() && _slots[id].state == State::reserved) {
+			_slots[id].state = State::free;
+			_identifiers.release(id);
+		}
+	}
+#if defined(__cpp_exceptions)
+	void update_state()
+	{
+		std::error_code ec;
+		if (update_state(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Updates the keep alive state and retransmits every message whose retransmit timeout expired.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void update_state(std::error_code& ec)
+	{
+		if (Parent::update_state(ec), ec || _retransmit_timeout == Clock::duration::zero()) {
+			return;
+		}
+
+		// the list is ordered by the time of the last transmission
+		const auto now = Clock::now();
+		for (auto left = _in_flight; left && _head && _slots[_head].sent + _retransmit_timeout <= now; --left) {
+			TERRAQTT_LOG(DEBUG, "Retransmitting packet {}", _head);
+			if (_transmit(ec, _head, true), ec) {
+				return;
+			}
+		}
+		// the timer fired but nothing was due yet
+		_schedule_retransmission();
+	}
+	/// The earliest of Basic_client::next_deadline() and the retransmission of the oldest message in flight.
+	typename Clock::time_point next_deadline() const override
+	{
+		const auto deadline = Parent::next_deadline();
+		if (_head && _retransmit_timeout != Clock::duration::zero()) {
+			return std::min<typename Clock::time_point>(deadline, _slots[_head].sent + _retransmit_timeout);
+		}
+		return deadline;
+	}
+	/// Registers the keep alive and the retransmit deadlines with the wheel.
+	void attach(Timer_wheel<Clock>* wheel, void* context) override
+	{
+		Parent::attach(wheel, context);
+		_retransmit_timer.cancel();
+		_retransmit_timer.context(context);
+		_wheel = wheel;
+		_schedule_retransmission();
+	}
+#if defined(__cpp_exceptions)
+	void retransmit_all()
+	{
+		std::error_code ec;
+		if (retransmit_all(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Sends every message in flight again, for example after reconnecting to a session that was not
+	 * cleaned.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void retransmit_all(std::error_code& ec)
+	{
+		for (auto left = _in_flight; left && _head; --left) {
+			if (_transmit(ec, _head, true), ec) {
+				return;
+			}
+		}
+	}
+	/// The amount of messages waiting for an acknowledgement.
+	std::size_t in_flight() const noexcept override { return _in_flight; }
+	/// Whether a message with the identifier waits for an acknowledgement.
+	bool is_in_flight(std::uint16_t id) const noexcept
+	{
+		return id < _slots.size() && _slots[id].state != State::free && _slots[id].state != State::reserved;
+	}
+	typename Clock::duration retransmit_timeout() const noexcept { return _retransmit_timeout; }
+	/**
+	 * Sets after what time unacknowledged messages are sent again.
+	 *
+	 * @param timeout the timeout; `0` disables retransmission by update_state()
+	 */
+	void retransmit_timeout(typename Clock::duration timeout) noexcept
+	{
+		_retransmit_timeout = timeout;
+		_schedule_retransmission();
+	}
+
+protected:
+	/**
+	 * Called by publish() when a message got its packet identifier, before anything is written. Setting the
+	 * error code cancels the publish: nothing is sent and the identifier is released.
+	 *
+	 * @param[out] ec error code if any
+	 * @param packet_id the identifier of the message
+	 * @param topic the topic
+	 * @param payload the payload
+	 * @param qos the QoS
+	 * @param retain the retain flag
+	 */
+	virtual void on_publishing(std::error_code& ec, std::uint16_t packet_id, const String& topic,
+	                           const String& payload, QoS qos, bool retain)
+	{}
+	/**
+	 * Called when a message was delivered, i.e. a PUBACK or PUBCOMP was received.
+	 *
+	 * @param[out] ec error code if any
+	 * @param packet_id the identifier of the message; it is already released
+	 */
+	virtual void on_delivered(std::error_code& ec, std::uint16_t packet_id) {}
+	/**
+	 * Called when the first PUBREC of a QoS::exactly_once message was received. From now on only the PUBREL
+	 * is sent for it and the payload is dropped.
+	 *
+	 * @param[out] ec error code if any
+	 * @param packet_id the identifier of the message
+	 */
+	virtual void on_released(std::error_code& ec, std::uint16_t packet_id) {}
+	void on_puback(std::error_code& ec, const protocol::Puback_header& header) final
+	{
+		const auto id = header.packet_identifier;
+		if (_expects(id, State::awaiting_puback)) {
+			_free(id);
+			on_delivered(ec, id);
+		} else {
+			TERRAQTT_LOG(WARN, "Unexpected PUBACK for packet {}", id);
+		}
+	}
+	void on_pubrec(std::error_code& ec, const protocol::Pubrec_header& header) final
+	{
+		const auto id = header.packet_identifier;
+		if (_expects(id, State::awaiting_pubrec)) {
+			auto& slot = _slots[id];
+			slot.state = State::awaiting_pubcomp;
+			_release_message(slot);
+			if (on_released(ec, id), ec) {
+				return;
+			}
+			_transmit(ec, id, false);
+		} else if (_expects(id, State::awaiting_pubcomp)) {
+			_transmit(ec, id, false);
+		} else {
+			TERRAQTT_LOG(WARN, "Unexpected PUBREC for packet {}", id);
+		}
+	}
+	void on_pubcomp(std::error_code& ec, const protocol::Pubcomp_header& header) final
+	{
+		const auto id = header.packet_identifier;
+		if (_expects(id, State::awaiting_pubcomp)) {
+			_free(id);
+			on_delivered(ec, id);
+		} else {
+			TERRAQTT_LOG(WARN, "Unexpected PUBCOMP for packet {}", id);
+		}
+	}
+
+private:
+	enum class State : std::uint8_t {
+		free,
+		/// Acquired by acquire_packet_identifier().
+		reserved,
+		awaiting_puback,
+		awaiting_pubrec,
+		awaiting_pubcomp,
+	};
+
+	/// Marks a slot without a stored message.
+	constexpr static std::uint16_t no_message = 0xffff;
+
+	/// An entry of the in-flight table. The identifier is the index, `0` ends the retransmit list.
+	struct Slot {
+		State state            = State::free;
+		QoS qos                = QoS::at_most_once;
+		bool retain            = false;
+		std::uint16_t previous = 0;
+		std::uint16_t next     = 0;
+		/// The index into the message pool.
+		std::uint16_t message = no_message;
+		typename Clock::time_point sent;
+	};
+
+	/// A stored topic and payload. The strings keep their capacity when the entry is reused.
+	struct Message {
+		String topic;
+		String payload;
+	};
+
+	Packet_identifier_set _identifiers;
+	std::vector<Slot> _slots;
+	std::vector<Message> _messages;
+	/// The indices of the unused entries of `_messages`.
+	std::vector<std::uint16_t> _unused_messages;
+	std::size_t _in_flight = 0;
+	/// The slot that was transmitted the longest time ago.
+	std::uint16_t _head = 0;
+	std::uint16_t _tail = 0;
+	typename Clock::duration _retransmit_timeout = std::chrono::seconds{ 20 };
+	Timer_wheel<Clock>* _wheel                   = nullptr;
+	/// Scheduled for the retransmission of the head of the list.
+	typename Timer_wheel<Clock>::Timer _retransmit_timer;
+
+	template<typename Container>
+	static bool _store(String& storage, const Container& container)
+	{
+		if (container.size() > storage.max_size()) {
+			return false;
+		}
+		storage.resize(container.size());
+		std::copy(container.begin(), container.end(), storage.begin());
+		return true;
+	}
+	/// Stores the message in an unused entry of the pool, which grows only if there is none.
+	template<typename Topic, typename Payload>
+	bool _store(Slot& slot, const Topic& topic, const Payload& payload)
+	{
+		if (_unused_messages.empty()) {
+			_messages.emplace_back();
+			// releasing never allocates
+			_unused_messages.reserve(_messages.size());
+			slot.message = static_cast<std::uint16_t>(_messages.size() - 1);
+		} else {
+			slot.message = _unused_messages.back();
+			_unused_messages.pop_back();
+		}
+
+		auto& message = _messages[slot.message];
+		if (!_store(message.topic, topic) || !_store(message.payload, payload)) {
+			_release_message(slot);
+			return false;
+		}
+		return true;
+	}
+	void _release_message(Slot& slot) noexcept
+	{
+		if (slot.message != no_message) {
+			_unused_messages.push_back(slot.message);
+			slot.message = no_message;
+		}
+	}
+	bool _expects(std::uint16_t id, State state) const noexcept
+	{
+		return id < _slots.size() && _slots[id].state == state;
+	}
+	/// Writes the packet of the current state and moves the slot to the end of the retransmit list.
+	void _transmit(std::error_code& ec, std::uint16_t id, bool duplicate)
+	{
+		auto& slot = _slots[id];
+		if (slot.state == State::awaiting_pubcomp) {
+			protocol::write_packet(*this->output(), ec, protocol::pubrel_header{ id });
+		} else {
+			const auto& message = _messages[slot.message];
+			protocol::Publish_header<const String&> header{ message.topic };
+			header.duplicate         = duplicate;
+			header.retain            = slot.retain;
+			header.qos               = slot.qos;
+			header.packet_identifier = id;
+			protocol::write_packet(*this->output(), ec, header, message.payload);
+		}
+
+		slot.sent = Clock::now();
+		this->keep_alive.sent();
+		_unlink(id);
+		_append(id);
+		_schedule_retransmission();
+	}
+	void _append(std::uint16_t id) noexcept
+	{
+		auto& slot    = _slots[id];
+		slot.previous = _tail;
+		slot.next     = 0;
+		if (_tail) {
+			_slots[_tail].next = id;
+		} else {
+			_head = id;
+		}
+		_tail = id;
+	}
+	void _unlink(std::uint16_t id) noexcept
+	{
+		auto& slot = _slots[id];
+		if (slot.previous) {
+			_slots[slot.previous].next = slot.next;
+		} else {
+			_head = slot.next;
+		}
+		if (slot.next) {
+			_slots[slot.next].previous = slot.previous;
+		} else {
+			_tail = slot.previous;
+		}
+	}
+	void _free(std::uint16_t id) noexcept
+	{
+		_unlink(id);
+		_slots[id].state = State::free;
+		_release_message(_slots[id]);
+		_identifiers.release(id);
+		--_in_flight;
+		_schedule_retransmission();
+	}
+	void _schedule_retransmission() noexcept
+	{
+		if (!_wheel) {
+			return;
+		} else if (_head && _retransmit_timeout != Clock::duration::zero()) {
+			_wheel->schedule(_retransmit_timer, _slots[_head].sent + _retransmit_timeout);
+		} else {
+			_retransmit_timer.cancel();
+		}
+	}
+};
+
+} // namespace terraqtt
+
+#endif
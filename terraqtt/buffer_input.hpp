@@ -0,0 +1,117 @@
+#ifndef TERRAQTT_BUFFER_INPUT_HPP_
+#define TERRAQTT_BUFFER_INPUT_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <ios>
+#include <streambuf>
+
+namespace terraqtt {
+
+/**
+ * An input over a contiguous byte range owned by the caller. It offers the subset of the `std::istream`
+ * interface used by the protocol readers, but every operation is resolved inline against the range without
+ * virtual calls or sentries. This makes it a drop-in `Input` for the `protocol::read_packet()` family and
+ * for Basic_client when the data already sits in memory, like the receive buffer of a reactor.
+ *
+ * @code{.cpp}
+ * input.assign(buffer, received);
+ * client.process_one(ec, input.available());
+ * // input.consumed() bytes of the buffer can be dropped now
+ * @endcode
+ *
+ * The range is never modified. Reading past its end behaves like reading from an exhausted stream.
+ */
+class Buffer_input : private std::streambuf {
+public:
+	using std::streambuf::char_type;
+	using std::streambuf::int_type;
+	using std::streambuf::traits_type;
+
+	Buffer_input() = default;
+	/**
+	 * Constructor.
+	 *
+	 * @param data The first byte of the range.
+	 * @param size The size of the range in bytes.
+	 */
+	Buffer_input(const void* data, std::size_t size) noexcept { assign(data, size); }
+	/**
+	 * Replaces the readable range and clears the error state. Unread bytes of the previous range are dropped.
+	 *
+	 * @param data The first byte of the range.
+	 * @param size The size of the range in bytes.
+	 */
+	void assign(const void* data, std::size_t size) noexcept
+	{
+		// the streambuf interface requires mutable pointers but nothing is ever written
+		const auto first = static_cast<char*>(const_cast<void*>(data));
+		setg(first, first, first + size);
+		clear();
+	}
+	/// How many bytes of the range have been consumed.
+	std::size_t consumed() const noexcept { return static_cast<std::size_t>(gptr() - eback()); }
+	/// How many bytes of the range have not been consumed yet.
+	std::size_t available() const noexcept { return static_cast<std::size_t>(egptr() - gptr()); }
+	/// Returns the next unread byte.
+	const char_type* data() const noexcept { return gptr(); }
+	/// Resets the error state.
+	void clear() noexcept
+	{
+		_eof  = false;
+		_fail = false;
+	}
+	bool good() const noexcept { return !_eof && !_fail; }
+	bool eof() const noexcept { return _eof; }
+	bool fail() const noexcept { return _fail; }
+	explicit operator bool() const noexcept { return !_fail; }
+	bool operator!() const noexcept { return _fail; }
+	int_type peek() noexcept
+	{
+		if (gptr() == egptr()) {
+			_eof = true;
+			return traits_type::eof();
+		}
+		return traits_type::to_int_type(*gptr());
+	}
+	int_type get() noexcept
+	{
+		if (gptr() == egptr()) {
+			_eof  = true;
+			_fail = true;
+			return traits_type::eof();
+		}
+		const auto c = traits_type::to_int_type(*gptr());
+		setg(eback(), gptr() + 1, egptr());
+		return c;
+	}
+	/**
+	 * Copies `count` bytes into `buffer`. If less are available, all remaining bytes are copied and the
+	 * error state is set.
+	 */
+	Buffer_input& read(char_type* buffer, std::streamsize count) noexcept
+	{
+		auto n = static_cast<std::size_t>(count);
+		if (n > available()) {
+			n     = available();
+			_eof  = true;
+			_fail = true;
+		}
+		std::memcpy(buffer, gptr(), n);
+		setg(eback(), gptr() + n, egptr());
+		return *this;
+	}
+	/**
+	 * Returns a stream buffer whose get area is the unread part of the range. Reading from it advances this
+	 * input as well.
+	 */
+	std::streambuf* rdbuf() noexcept { return this; }
+
+private:
+	bool _eof  = false;
+	bool _fail = false;
+};
+
+} // namespace terraqtt
+
+#endif
@@ -1,25 +1,57 @@
 #ifndef TERRAQTT_CLIENT_HPP_
 #define TERRAQTT_CLIENT_HPP_
 
+#include "buffer_input.hpp"
 #include "detail/constrained_streambuf.hpp"
+#include "detail/container.hpp"
+#include "detail/output.hpp"
+#include "detail/streambuf_access.hpp"
 #include "keep_aliver.hpp"
 #include "log.hpp"
+#include "packet_identifier_set.hpp"
 #include "protocol/connection.hpp"
 #include "protocol/ping.hpp"
 #include "protocol/publishing.hpp"
 #include "protocol/reader.hpp"
 #include "protocol/subscription.hpp"
+#include "timer_wheel.hpp"
 #include "variant.hpp"
 
 #include <algorithm>
 #include <initializer_list>
+#include <istream>
 #include <limits>
+#include <memory>
 #include <ratio>
 
 namespace terraqtt {
 
 /// @example lightweight.cpp
 
+/// Statistics of a processing call.
+struct Process_stats {
+	/// How many packets were completely processed.
+	std::size_t packets;
+	/// How many bytes were processed.
+	std::size_t bytes;
+};
+
+/// Limits of the outbound flow control window.
+struct Flow_limits {
+	/// How many messages may wait for an acknowledgement. Only enforced by clients tracking them.
+	std::size_t max_in_flight = std::numeric_limits<std::size_t>::max();
+	/// How many bytes the output may hold back, including the packet to publish.
+	std::size_t max_buffered = std::numeric_limits<std::size_t>::max();
+};
+
+/// The occupancy of the outbound flow control window.
+struct Flow_window {
+	std::size_t in_flight;
+	std::size_t max_in_flight;
+	std::size_t buffered;
+	std::size_t max_buffered;
+};
+
 /**
  * @code{.cpp}
  * using namespace terraqtt;
@@ -47,6 +79,7 @@ class Basic_client {
 public:
 	typedef String String_type;
 	typedef Return_code_container Return_code_container_type;
+	typedef Clock Clock_type;
 
 	/**
 	 * Constructor.
@@ -87,7 +120,7 @@ public:
 		protocol::Connect_header<const Identifier&, const String&, const String&> header{ identifier };
 		header.clean_session = clean_session;
 		header.keep_alive    = keep_alive.count();
-		this->keep_alive     = { keep_alive };
+		this->keep_alive.timeout(keep_alive);
 
 		protocol::write_packet(*_output, ec, header);
 	}
@@ -139,7 +172,38 @@ public:
 		header.retain            = retain;
 		header.packet_identifier = packet_id;
 
-		protocol::write_packet(*_output, ec, header, payload);
+		if (admit(ec, protocol::packet_size(ec, header, payload), false)) {
+			protocol::write_packet(*_output, ec, header, payload);
+			keep_alive.sent();
+		}
+	}
+#if defined(__cpp_exceptions)
+	template<typename Container, typename Payload>
+	void publish(const protocol::Publish_template<Container>& publish, const Payload& payload,
+	             std::uint16_t packet_id = 0)
+	{
+		std::error_code ec;
+		if (this->publish(ec, publish, payload, packet_id), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Publishes the payload with a pre-encoded topic.
+	 *
+	 * @param ec[out] the error code, if any
+	 * @param publish the template holding the topic, QoS and retain flag
+	 * @param payload the payload
+	 * @param packet_id the packet identifier; must be non `0` if the QoS is not QoS::at_most_once
+	 */
+	template<typename Container, typename Payload>
+	void publish(std::error_code& ec, const protocol::Publish_template<Container>& publish,
+	             const Payload& payload, std::uint16_t packet_id = 0)
+	{
+		if (admit(ec, protocol::packet_size(ec, publish, payload), false)) {
+			protocol::write_packet(*_output, ec, publish, payload, packet_id);
+			keep_alive.sent();
+		}
 	}
 #if defined(__cpp_exceptions)
 	template<typename Topic>
@@ -165,6 +229,7 @@ public:
 		header.packet_identifier = packet_id;
 
 		protocol::write_packet(*_output, ec, header);
+		keep_alive.sent();
 	}
 
 #if defined(__cpp_exceptions)
@@ -191,6 +256,7 @@ public:
 		header.packet_identifier = packet_id;
 
 		protocol::write_packet(*_output, ec, header);
+		keep_alive.sent();
 	}
 #if defined(__cpp_exceptions)
 	void ping()
@@ -202,15 +268,17 @@ public:
 	}
 #endif
 	/**
-	 * Sends a ping request to broker.
+	 * Sends a ping request to broker and starts the ping timeout, unless one is already running.
 	 *
 	 * @param ec[out] the error code, if any
 	 */
 	void ping(std::error_code& ec)
 	{
 		TERRAQTT_LOG(TRACE, "Sending ping request");
-		protocol::write_packet(*_output, ec, protocol::Pingreq_header{});
-		keep_alive.reset();
+		if (protocol::write_packet(*_output, ec, protocol::Pingreq_header{}), !ec) {
+			keep_alive.sent();
+			keep_alive.start_ping_timeout();
+		}
 	}
 #if defined(__cpp_exceptions)
 	void update_state()
@@ -222,21 +290,76 @@ public:
 	}
 #endif
 	/**
-	 * Updates the keep alive state.
+	 * Updates the keep alive state and lets the output act on its deadlines, for example Coalescing_output
+	 * flushes when its delay expired. A PINGREQ is only sent if nothing else was sent during the keep alive
+	 * interval.
 	 *
-	 * @param ec[out] the error code, if any
+	 * @param ec[out] the error code, if any; `std::errc::io_error` if the output failed
 	 */
 	void update_state(std::error_code& ec)
 	{
-		if (keep_alive.needs_ping()) {
-			if (ping(ec), !ec) {
-				TERRAQTT_LOG(DEBUG, "Starting ping timeout");
-				keep_alive.start_ping_timeout();
-			}
-		} else if (keep_alive.timed_out()) {
+		if (_output && (detail::update_output(*_output), !*_output)) {
+			ec = std::make_error_code(std::errc::io_error);
+			return;
+		}
+
+		if (keep_alive.timed_out()) {
 			TERRAQTT_LOG(ERROR, "No packet received during ping timeout");
 			ec = Error::connection_timed_out;
+		} else if (keep_alive.needs_ping()) {
+			TERRAQTT_LOG(DEBUG, "Starting ping timeout");
+			ping(ec);
 		}
+		// the timer fired but nothing was due yet
+		keep_alive.schedule();
+		_notify_writable(ec);
+	}
+	/**
+	 * Returns when update_state() has to be called next, so an event loop can sleep exactly until then or
+	 * until data arrives. This is the earliest of the next ping, the ping timeout and the flush deadline of
+	 * the output if it provides `next_deadline()` with the same clock like Coalescing_output.
+	 *
+	 * @returns The deadline or `Clock::time_point::max()` if nothing is due.
+	 */
+	virtual typename Clock::time_point next_deadline() const
+	{
+		return std::min(keep_alive.next_deadline(),
+		                _output ? detail::output_deadline<typename Clock::time_point>(*_output)
+		                        : Clock::time_point::max());
+	}
+	/**
+	 * Registers the deadlines of this client with a timer wheel. update_state() then only needs to be called
+	 * when one of its timers fires instead of polling every client.
+	 *
+	 * @param[in] wheel The wheel or `nullptr` to detach. Must outlive the client or be detached.
+	 * @param context Passed through Timer_wheel::Timer::context(), usually the client.
+	 */
+	virtual void attach(Timer_wheel<Clock>* wheel, void* context) { keep_alive.attach(wheel, context); }
+#if defined(__cpp_exceptions)
+	void flush()
+	{
+		std::error_code ec;
+		if (flush(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Writes pending acknowledgements and passes all written packets on by calling `flush()` of the output if
+	 * it has one, like Coalescing_output or `std::ostream`.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void flush(std::error_code& ec)
+	{
+		if (_write_acknowledgements(ec), ec) {
+			return;
+		} else if (_output) {
+			if (detail::flush_output(*_output), !*_output) {
+				ec = std::make_error_code(std::errc::io_error);
+			}
+		}
+		_notify_writable(ec);
 	}
 #if defined(__cpp_exceptions)
 	std::size_t process_one(std::size_t available = std::numeric_limits<std::size_t>::max())
@@ -257,43 +380,138 @@ public:
 	std::size_t process_one(std::error_code& ec,
 	                        std::size_t available = std::numeric_limits<std::size_t>::max())
 	{
-		_read_context.available = available;
-
-		_skip_ignored();
-		if (!_read_context.available) {
-			return 0;
-		} // read new packet
-		else if (_read_type == protocol::Control_packet_type::reserved) {
-			_read_type = protocol::peek_type(*_input, ec, _read_context);
-			if (ec) {
-				return 0;
+		const auto processed = _process_one(ec, available).bytes;
+		if (processed) {
+			keep_alive.received();
+		}
+		if (!ec) {
+			_write_acknowledgements(ec);
+		}
+		_notify_writable(ec);
+		return processed;
+	}
+#if defined(__cpp_exceptions)
+	Process_stats process_until(std::size_t available, std::size_t max_packets)
+	{
+		std::error_code ec;
+		const auto stats = process_until(ec, available, max_packets);
+		return ec ? throw std::system_error{ ec } : stats;
+	}
+#endif
+	/**
+	 * Processes packets until `available` bytes are processed or `max_packets` packets are complete. Unlike
+	 * process_one() this never blocks if `available` is accurate.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param available How many bytes can be read without blocking.
+	 * @param max_packets The maximum amount of packets to complete.
+	 * @returns The amount of completed packets and processed bytes. The bytes include partially read packets.
+	 */
+	Process_stats process_until(std::error_code& ec, std::size_t available, std::size_t max_packets)
+	{
+		Process_stats stats{};
+		while (stats.bytes < available && stats.packets < max_packets) {
+			const auto one = _process_one(ec, available - stats.bytes);
+			stats.packets += one.packets;
+			stats.bytes += one.bytes;
+			if (ec || !one.bytes) {
+				break;
 			}
 		}
-
-		// process type
-		switch (_read_type) {
-		case protocol::Control_packet_type::reserved: break;
-		case protocol::Control_packet_type::connack: _handle_connack(ec); break;
-		case protocol::Control_packet_type::publish: _handle_publish(ec); break;
-		case protocol::Control_packet_type::puback: _handle_puback(ec); break;
-		case protocol::Control_packet_type::pubrec: _handle_pubrec(ec); break;
-		case protocol::Control_packet_type::pubrel: _handle_pubrel(ec); break;
-		case protocol::Control_packet_type::pubcomp: _handle_pubcomp(ec); break;
-		case protocol::Control_packet_type::suback: _handle_suback(ec); break;
-		case protocol::Control_packet_type::unsuback: _handle_unsuback(ec); break;
-		case protocol::Control_packet_type::pingresp: _handle_pingresp(ec); break;
-		default: ec = Error::bad_packet_type; break;
+		if (stats.bytes) {
+			keep_alive.received();
 		}
-		if (ec) {
-			TERRAQTT_LOG(ERROR, "Error during packet handling: {}", ec.message());
+		if (!ec) {
+			_write_acknowledgements(ec);
 		}
-
-		_skip_ignored();
-		const std::size_t processed = available - _read_context.available + _overread;
-		_overread                   = 0;
-		TERRAQTT_LOG(TRACE, "Processed {} bytes", processed);
-		return processed;
+		_notify_writable(ec);
+		TERRAQTT_LOG(TRACE, "Processed {} packets with {} bytes", stats.packets, stats.bytes);
+		return stats;
+	}
+#if defined(__cpp_exceptions)
+	Process_stats process_all(std::size_t available)
+	{
+		std::error_code ec;
+		const auto stats = process_all(ec, available);
+		return ec ? throw std::system_error{ ec } : stats;
 	}
+#endif
+	/**
+	 * Processes all packets contained in the next `available` bytes.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param available How many bytes can be read without blocking.
+	 * @returns The amount of completed packets and processed bytes.
+	 * @see process_until()
+	 */
+	Process_stats process_all(std::error_code& ec, std::size_t available)
+	{
+		return process_until(ec, available, std::numeric_limits<std::size_t>::max());
+	}
+#if defined(__cpp_exceptions)
+	void auto_acknowledge(bool enable)
+	{
+		std::error_code ec;
+		if (auto_acknowledge(ec, enable), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Enables or disables the automatic acknowledgement of incoming messages. If enabled, a PUBACK is sent
+	 * for every QoS::at_least_once message and QoS::exactly_once messages are answered with PUBREC and their
+	 * PUBREL with PUBCOMP. Redeliveries of QoS::exactly_once messages that were not released yet are not
+	 * passed to on_publish().
+	 *
+	 * The acknowledgements are collected and written with a single call at the end of process_one(),
+	 * process_until() and process_all() or by flush(). Disabling writes the collected ones first. Enabling
+	 * allocates the set of received packet identifiers of about 8 KiB.
+	 *
+	 * @param[out] ec The error code, if the collected acknowledgements could not be written.
+	 * @param enable whether messages should be acknowledged automatically
+	 */
+	void auto_acknowledge(std::error_code& ec, bool enable)
+	{
+		if (!enable) {
+			_write_acknowledgements(ec);
+			_acknowledgements.reset();
+		} else if (!_acknowledgements) {
+			_acknowledgements.reset(new Acknowledgements{});
+		}
+	}
+	bool auto_acknowledge() const noexcept { return static_cast<bool>(_acknowledgements); }
+	/**
+	 * Limits the outbound flow control window. Publishing a message that does not fit into the window fails
+	 * with Error::would_block without writing anything and on_writable() is called once the window has room
+	 * again. Acknowledgements, pings and retransmissions are not limited.
+	 *
+	 * @param limits the new limits
+	 */
+	void flow_limits(const Flow_limits& limits) noexcept { _flow_limits = limits; }
+	const Flow_limits& flow_limits() const noexcept { return _flow_limits; }
+	/**
+	 * Returns the current occupancy of the flow control window. The buffered bytes are taken from
+	 * `buffered()` of the output or the put area of a stream buffer.
+	 */
+	Flow_window window() const
+	{
+		Flow_window window{};
+		window.in_flight     = in_flight();
+		window.max_in_flight = _flow_limits.max_in_flight;
+		window.buffered      = _output ? detail::buffered_output(*_output) : 0;
+		window.max_buffered  = _flow_limits.max_buffered;
+		return window;
+	}
+	typename Clock::duration ping_timeout() const noexcept { return keep_alive.ping_timeout(); }
+	/**
+	 * Sets how long to wait for a packet from the broker after a PINGREQ before update_state() fails with
+	 * Error::connection_timed_out. The default is 15 seconds.
+	 */
+	void ping_timeout(typename Clock::duration timeout) noexcept { keep_alive.ping_timeout(timeout); }
+	/// The smoothed round-trip time of PINGREQ and PINGRESP or `0` if no ping completed yet.
+	typename Clock::duration round_trip_time() const noexcept { return keep_alive.smoothed_rtt(); }
+	/// The amount of messages waiting for an acknowledgement. This client does not track them.
+	virtual std::size_t in_flight() const noexcept { return 0; }
 	Input* input() noexcept { return _input; }
 	Output* output() noexcept { return _output; }
 
@@ -303,7 +521,8 @@ protected:
 
 	virtual void on_connack(std::error_code& ec, const protocol::Connack_header& header) {}
 	/**
-	 * Called when the broker published something to a subscribed topic. Quality of serivce is not handled.
+	 * Called when the broker published something to a subscribed topic. Quality of serivce is not handled
+	 * unless auto_acknowledge() is enabled.
 	 *
 	 * @param[out] ec error code if any
 	 * @param header information about the received header
@@ -314,6 +533,23 @@ protected:
 	virtual void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
 	                        std::istream& payload, std::size_t payload_size)
 	{}
+	/**
+	 * Called instead of the stream overload when the complete payload is already buffered by the input. This
+	 * allows parsing the payload in place. The default implementation forwards the payload as a stream to the
+	 * stream overload.
+	 *
+	 * @param[out] ec error code if any
+	 * @param header information about the received header
+	 * @param[in] payload the payload; only valid during this call
+	 * @param payload_size size of the payload in bytes
+	 */
+	virtual void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+	                        const char* payload, std::size_t payload_size)
+	{
+		Buffer_input input{ payload, payload_size };
+		std::istream stream{ input.rdbuf() };
+		on_publish(ec, header, stream, payload_size);
+	}
 	virtual void on_puback(std::error_code& ec, const protocol::Puback_header& header) {}
 	virtual void on_pubrec(std::error_code& ec, const protocol::Pubrec_header& header) {}
 	virtual void on_pubrel(std::error_code& ec, const protocol::pubrel_header& header) {}
@@ -323,6 +559,38 @@ protected:
 	{}
 	virtual void on_unsuback(std::error_code& ec, const protocol::Unsuback_header& header) {}
 	virtual void on_pingresp(std::error_code& ec, const protocol::Pingresp_header& header) {}
+	/**
+	 * Called when the flow control window has room again after a publish failed with Error::would_block.
+	 *
+	 * @param[out] ec error code if any
+	 */
+	virtual void on_writable(std::error_code& ec) {}
+	/**
+	 * Checks whether a packet fits into the flow control window. If not, Error::would_block is set and
+	 * on_writable() will be called once the window has room.
+	 *
+	 * @param[out] ec Error::would_block if the window is full; nothing is checked if already set
+	 * @param packet_size the size of the packet
+	 * @param tracked whether the packet will wait for an acknowledgement
+	 * @returns Whether the packet may be written.
+	 */
+	bool admit(std::error_code& ec, std::size_t packet_size, bool tracked)
+	{
+		if (ec) {
+			return false;
+		}
+
+		// an empty output always takes the packet, so packets larger than the window are not stuck
+		const auto window = this->window();
+		const auto room   = window.max_buffered - std::min(window.buffered, window.max_buffered);
+		if ((tracked && window.in_flight >= window.max_in_flight) || (window.buffered && packet_size > room)) {
+			TERRAQTT_LOG(DEBUG, "Flow control window is full");
+			ec       = Error::would_block;
+			_blocked = true;
+			return false;
+		}
+		return true;
+	}
 
 private:
 	/// How many bytes should be ignored for the next read call.
@@ -339,12 +607,148 @@ private:
 	Input* _input;
 	Output* _output;
 
+	/// The state of auto_acknowledge().
+	struct Acknowledgements {
+		/// The QoS::exactly_once messages that were received but not released yet.
+		Packet_identifier_set received;
+		/// Encoded acknowledgements that are not written yet.
+		protocol::Byte pending[64 * 4];
+		std::size_t size = 0;
+	};
+	std::unique_ptr<Acknowledgements> _acknowledgements;
+	Flow_limits _flow_limits;
+	/// Whether a publish was rejected and on_writable() is pending.
+	bool _blocked = false;
+
+	void _notify_writable(std::error_code& ec)
+	{
+		if (_blocked && !ec) {
+			const auto window = this->window();
+			if (window.in_flight < window.max_in_flight && window.buffered < window.max_buffered) {
+				_blocked = false;
+				on_writable(ec);
+			}
+		}
+	}
+
+	/// Queues an acknowledgement and writes the queue if it is full.
+	void _acknowledge(std::error_code& ec, protocol::Control_packet_type type, std::uint16_t packet_identifier)
+	{
+		auto& acknowledgements = *_acknowledgements;
+		if (acknowledgements.size == sizeof(acknowledgements.pending) && (_write_acknowledgements(ec), ec)) {
+			return;
+		}
+		const auto end = protocol::write_elements(acknowledgements.pending + acknowledgements.size, ec,
+		                                          static_cast<protocol::Byte>(static_cast<int>(type) << 4),
+		                                          static_cast<protocol::Variable_integer>(2), packet_identifier);
+		acknowledgements.size = static_cast<std::size_t>(end - acknowledgements.pending);
+	}
+	void _acknowledge_publish(std::error_code& ec, const protocol::Publish_header<String>& header)
+	{
+		if (header.qos == QoS::at_least_once) {
+			_acknowledge(ec, protocol::Control_packet_type::puback, header.packet_identifier);
+		} else if (header.qos == QoS::exactly_once) {
+			// redeliveries are answered again but only passed on once
+			_acknowledgements->received.acquire(header.packet_identifier);
+			_acknowledge(ec, protocol::Control_packet_type::pubrec, header.packet_identifier);
+		}
+	}
+	void _write_acknowledgements(std::error_code& ec)
+	{
+		if (_acknowledgements && _acknowledgements->size && _output) {
+			TERRAQTT_LOG(TRACE, "Writing {} bytes of acknowledgements", _acknowledgements->size);
+			_output->write(reinterpret_cast<const typename Output::char_type*>(_acknowledgements->pending),
+			               _acknowledgements->size);
+			_acknowledgements->size = 0;
+			keep_alive.sent();
+			if (!*_output) {
+				ec = std::make_error_code(std::errc::io_error);
+			}
+		}
+	}
+
+	/// Processes up to `available` bytes but at most one packet.
+	Process_stats _process_one(std::error_code& ec, std::size_t available)
+	{
+		Process_stats stats{};
+		_read_context.available = available;
+
+		_skip_ignored();
+		if (!_read_context.available) {
+			stats.bytes = available;
+			return stats;
+		} // read new packet
+		else if (_read_type == protocol::Control_packet_type::reserved) {
+			_read_type = protocol::peek_type(*_input, ec, _read_context);
+			if (ec) {
+				stats.bytes = available - _read_context.available;
+				return stats;
+			}
+		}
+
+		// process type
+		const auto type = _read_type;
+		switch (type) {
+		case protocol::Control_packet_type::reserved: break;
+		case protocol::Control_packet_type::connack: _handle_connack(ec); break;
+		case protocol::Control_packet_type::publish: _handle_publish(ec); break;
+		case protocol::Control_packet_type::puback: _handle_puback(ec); break;
+		case protocol::Control_packet_type::pubrec: _handle_pubrec(ec); break;
+		case protocol::Control_packet_type::pubrel: _handle_pubrel(ec); break;
+		case protocol::Control_packet_type::pubcomp: _handle_pubcomp(ec); break;
+		case protocol::Control_packet_type::suback: _handle_suback(ec); break;
+		case protocol::Control_packet_type::unsuback: _handle_unsuback(ec); break;
+		case protocol::Control_packet_type::pingresp: _handle_pingresp(ec); break;
+		default: ec = Error::bad_packet_type; break;
+		}
+		if (ec) {
+			TERRAQTT_LOG(ERROR, "Error during packet handling: {}", ec.message());
+		} else if (type != protocol::Control_packet_type::reserved &&
+		           _read_type == protocol::Control_packet_type::reserved) {
+			stats.packets = 1;
+		}
+
+		_skip_ignored();
+		stats.bytes = available - _read_context.available + _overread;
+		_overread   = 0;
+		TERRAQTT_LOG(TRACE, "Processed {} bytes", stats.bytes);
+		return stats;
+	}
 	/// Clears the reading state for the next fresh read.
 	void _clear_read() noexcept
 	{
 		_read_type = protocol::Control_packet_type::reserved;
 		_read_context.clear();
 	}
+	/// Prepares the header storage for a new packet. The storage is reused if it already holds the type.
+	template<std::size_t Index>
+	void _prepare_header()
+	{
+		if (_read_header.index() == Index) {
+			std::error_code ec;
+			_reset(*_read_header.template get<Index>(ec));
+		} else {
+			_read_header.template emplace<Index>();
+		}
+	}
+	template<typename Header>
+	static void _reset(Header& header) noexcept
+	{
+		header = Header{};
+	}
+	static void _reset(protocol::Publish_header<String>& header)
+	{
+		detail::clear(header.topic);
+		header.duplicate         = false;
+		header.retain            = false;
+		header.qos               = QoS::at_most_once;
+		header.packet_identifier = 0;
+	}
+	static void _reset(protocol::Suback_header<Return_code_container>& header)
+	{
+		detail::clear(header.return_codes);
+		header.packet_identifier = 0;
+	}
 	void _skip_ignored()
 	{
 		if (const std::size_t skip = std::min(_read_ignore, _read_context.available)) {
@@ -363,7 +767,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling CONNACK packet");
 		constexpr auto index = 0;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -380,7 +784,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PUBLISH packet");
 		constexpr auto index = 1;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		protocol::Variable_integer_type payload_size = 0;
@@ -388,23 +792,44 @@ private:
 		                          payload_size) &&
 		    !ec) {
 			_clear_read();
-			detail::Constrained_streambuf buf{ *_input->rdbuf(), payload_size };
-			std::istream payload{ &buf };
 			auto& header = *_read_header.template get<index>(ec);
 			if (!ec) {
 				TERRAQTT_LOG(DEBUG, "Received PUBLISH packet");
-				on_publish(ec, header, payload, payload_size);
+				auto& parent         = *_input->rdbuf();
+				const bool duplicate = _acknowledgements && header.qos == QoS::exactly_once &&
+				                       _acknowledgements->received.contains(header.packet_identifier);
+				std::size_t read;
+				if (detail::Streambuf_access::buffered(parent) >= payload_size) {
+					// the payload can be handed out in place
+					if (!duplicate) {
+						on_publish(ec, header, detail::Streambuf_access::get_pointer(parent), payload_size);
+					}
+					detail::Streambuf_access::consume(parent, payload_size);
+					read = payload_size;
+				} else if (duplicate) {
+					_read_ignore = payload_size;
+					read         = 0;
+				} else {
+					detail::Constrained_streambuf buf{ parent, payload_size };
+					std::istream payload{ &buf };
+					on_publish(ec, header, payload, payload_size);
+
+					// ignore remaining
+					_read_ignore = buf.release();
+					read         = payload_size - _read_ignore;
+				}
 
-				// ignore remaining
-				_read_ignore           = buf.release();
-				const std::size_t read = payload_size - _read_ignore;
 				if (read > _read_context.available) {
-					_read_context.available = 0;
 					_overread               = read - _read_context.available;
+					_read_context.available = 0;
 				} else {
 					_read_context.available -= read;
 				}
 				TERRAQTT_LOG(TRACE, "Handler read {}/{} bytes from the payload", read, payload_size);
+
+				if (!ec && _acknowledgements) {
+					_acknowledge_publish(ec, header);
+				}
 			}
 		}
 	}
@@ -413,7 +838,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PUBACK packet");
 		constexpr auto index = 2;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -430,7 +855,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PUBREC packet");
 		constexpr auto index = 3;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -447,7 +872,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PUBREL packet");
 		constexpr auto index = 4;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -456,6 +881,10 @@ private:
 			if (!ec) {
 				TERRAQTT_LOG(DEBUG, "Received PUBREL packet");
 				on_pubrel(ec, header);
+				if (!ec && _acknowledgements) {
+					_acknowledgements->received.release(header.packet_identifier);
+					_acknowledge(ec, protocol::Control_packet_type::pubcomp, header.packet_identifier);
+				}
 			}
 		}
 	}
@@ -464,7 +893,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PUBCOMP packet");
 		constexpr auto index = 5;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -481,7 +910,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling SUBACK packet");
 		constexpr auto index = 6;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -499,7 +928,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling UNSUBACK packet");
 		constexpr auto index = 7;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -516,7 +945,7 @@ private:
 		TERRAQTT_LOG(TRACE, "Handling PINGRESP packet");
 		constexpr auto index = 8;
 		if (!_read_context.sequence) {
-			_read_header.template emplace<index>();
+			_prepare_header<index>();
 		}
 
 		if (protocol::read_packet(*_input, ec, _read_context, *_read_header.template get<index>(ec)) && !ec) {
@@ -0,0 +1,583 @@
+#ifndef TERRAQTT_CLIENT_POOL_HPP_
+#define TERRAQTT_CLIENT_POOL_HPP_
+
+#include "buffer_input.hpp"
+#include "detail/system.hpp"
+#include "epoll_reactor.hpp"
+#include "error.hpp"
+#include "protocol/writer.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * A buffer of a Client_pool that is lent to a connection while it has bytes to send or an incomplete packet.
+ *
+ * @private
+ */
+struct Pool_buffer {
+	std::vector<char> data;
+	/// How many bytes at the front have been sent.
+	std::size_t sent = 0;
+	/// The next free buffer.
+	Pool_buffer* next = nullptr;
+};
+
+/**
+ * Returns how many bytes at the front of the received data form complete packets.
+ *
+ * @private
+ * @param data The received bytes.
+ * @param size The amount of received bytes.
+ * @param capacity The size of the receive buffer. Packets larger than that can never be received completely
+ * and are passed on as they arrive.
+ * @param[in,out] rest How many bytes of such a packet are still expected.
+ * @returns The amount of bytes that can be processed.
+ */
+inline std::size_t complete_packets(const char* data, std::size_t size, std::size_t capacity,
+                                    std::uint32_t& rest) noexcept
+{
+	std::size_t complete = std::min<std::size_t>(rest, size);
+	rest -= static_cast<std::uint32_t>(complete);
+	while (complete < size) {
+		// the fixed header is the type followed by one to four bytes of the remaining length
+		std::size_t length = 0;
+		std::size_t header = 1;
+		while (true) {
+			if (complete + header >= size) {
+				return complete;
+			}
+			const auto byte = static_cast<std::uint8_t>(data[complete + header]);
+			length |= static_cast<std::size_t>(byte & 0x7f) << (7 * (header - 1));
+			++header;
+			if (!(byte & 0x80)) {
+				break;
+			} else if (header > 4) {
+				// malformed, the client reports it
+				return size;
+			}
+		}
+
+		const auto total = header + length;
+		if (total <= size - complete) {
+			complete += total;
+		} else if (total > capacity) {
+			rest = static_cast<std::uint32_t>(total - (size - complete));
+			return size;
+		} else {
+			return complete;
+		}
+	}
+	return complete;
+}
+
+} // namespace detail
+
+/**
+ * Runs many clients on one thread over a single Epoll_reactor while keeping the state of idle connections
+ * small. Instead of a Socket_input and a Socket_output with their own buffers, every client decodes from one
+ * receive buffer shared by the whole pool and writes to its Connection, which borrows a buffer from the pool
+ * only while bytes wait to be sent. Only complete packets are passed to the clients, so payloads are always
+ * handed out in place; the incomplete rest of a read is kept in a borrowed buffer until the next one.
+ *
+ * Readiness is handled in batches: all connections that became ready are received from and processed first,
+ * then everything the clients wrote in the meantime is sent with one `send()` per connection. This also
+ * covers packets written to one client from the callbacks of another, like when forwarding messages.
+ *
+ * @code{.cpp}
+ * typedef Client_pool<std::chrono::steady_clock> Pool;
+ * class Device : public Pool_client<Basic_client<Buffer_input, Pool::Connection, ...>> { ... };
+ *
+ * Pool pool;
+ * pool.open(ec);
+ * for (const int socket : sockets) {
+ * 	pool.add<Device>(ec, socket)->connect(ec, "id", true, std::chrono::seconds{ 30 });
+ * }
+ * while (!ec) {
+ * 	pool.run_once(ec);
+ * }
+ * @endcode
+ *
+ * The pool owns the clients and their sockets. A client that fails is destroyed after
+ * Pool_client::on_error(). Clients may remove other clients from within their callbacks but never
+ * themselves; they set the error code of the callback instead.
+ *
+ * @tparam Clock The clock of the deadlines.
+ */
+template<typename Clock>
+class Client_pool {
+public:
+	typedef Epoll_reactor<Clock> Reactor;
+	typedef typename Clock::time_point time_point;
+
+	/**
+	 * A socket of the pool and the output of the client running over it. Written packets are collected in a
+	 * buffer of the pool and sent by the pool. Whatever the socket cannot take stays buffered until it becomes
+	 * writable again and counts towards the flow control window.
+	 */
+	class Connection : private Reactor::Handler {
+	public:
+		typedef char char_type;
+
+		Connection(const Connection& copy) = delete;
+		/**
+		 * Buffers the data until the pool sends it.
+		 *
+		 * @param data The data.
+		 * @param size The amount of characters.
+		 * @returns `*this`
+		 */
+		Connection& write(const char_type* data, std::size_t size)
+		{
+			if (const auto buffer = _prepare_write()) {
+				buffer->data.insert(buffer->data.end(), data, data + size);
+			}
+			return *this;
+		}
+		/**
+		 * Buffers all chunks until the pool sends them.
+		 *
+		 * @param chunks The chunks.
+		 * @param count The amount of chunks.
+		 * @returns `*this`
+		 * @see protocol::write_chunks()
+		 */
+		Connection& writev(const protocol::Chunk* chunks, std::size_t count)
+		{
+			if (const auto buffer = _prepare_write()) {
+				for (std::size_t i = 0; i < count; ++i) {
+					const auto data = static_cast<const char_type*>(chunks[i].data);
+					buffer->data.insert(buffer->data.end(), data, data + chunks[i].size);
+				}
+			}
+			return *this;
+		}
+		/// How many bytes wait to be sent.
+		std::size_t buffered() const noexcept { return _output ? _output->data.size() - _output->sent : 0; }
+		int socket() const noexcept { return _socket; }
+		Client_pool& pool() const noexcept { return *_pool; }
+		/// The error of the socket after sending failed.
+		std::error_code error() const noexcept
+		{
+			return _error ? std::error_code{ _error, std::system_category() } : std::error_code{};
+		}
+		explicit operator bool() const noexcept { return !_error; }
+		Connection& operator=(const Connection& copy) = delete;
+
+	protected:
+		/**
+		 * Constructor.
+		 *
+		 * @param[in] pool The pool.
+		 * @param socket The connected socket. It is owned from now on.
+		 */
+		Connection(Client_pool& pool, int socket) noexcept : _pool(&pool), _socket(socket) {}
+		/// Leaves the pool and closes the socket. Buffered bytes are only sent if the socket takes them at once.
+		~Connection() noexcept
+		{
+			_pool->_leave(*this);
+			::close(_socket);
+		}
+
+	private:
+		friend Client_pool;
+
+		Client_pool* _pool;
+		/// The bytes waiting to be sent.
+		detail::Pool_buffer* _output = nullptr;
+		/// The incomplete packet at the end of the last read.
+		detail::Pool_buffer* _carry = nullptr;
+		/// How many bytes of a packet larger than the receive buffer are still expected.
+		std::uint32_t _rest = 0;
+		/// The position in the pool.
+		std::uint32_t _index = 0;
+		int _socket;
+		/// The `errno` of a failed send.
+		int _error = 0;
+		/// Whether the connection is in the list of the pool to send.
+		bool _dirty = false;
+		/// Whether the reactor waits for writability.
+		bool _writing = false;
+
+		virtual void _attach(Timer_wheel<Clock>* wheel, void* context) = 0;
+		virtual void _process(std::error_code& ec, std::size_t available) = 0;
+		virtual void _update(std::error_code& ec) = 0;
+		virtual void _failed(const std::error_code& ec) = 0;
+		void on_ready(std::uint32_t events) override { _pool->_ready(*this, events); }
+		void on_timer() override { _pool->_timer(*this); }
+		detail::Pool_buffer* _prepare_write()
+		{
+			if (_error) {
+				return nullptr;
+			} else if (!_output) {
+				_output = _pool->_lease();
+			} else if (_output->sent && _output->sent >= buffered()) {
+				_output->data.erase(_output->data.begin(),
+				                    _output->data.begin() + static_cast<std::ptrdiff_t>(_output->sent));
+				_output->sent = 0;
+			}
+			// a blocked connection is sent to as soon as it becomes writable
+			if (!_dirty && !_writing) {
+				_pool->_dirty.push_back(this);
+				_dirty = true;
+			}
+			return _output;
+		}
+	};
+
+	/**
+	 * Constructor. The pool must be opened before use.
+	 *
+	 * @param buffer_size The size of the receive buffer shared by all clients. Larger packets are processed in
+	 * parts like with a Socket_input.
+	 * @param resolution The resolution of the timer wheel.
+	 */
+	explicit Client_pool(std::size_t buffer_size = 64 * 1024,
+	                     typename Clock::duration resolution = Reactor::Wheel::default_resolution())
+	    : _reactor(resolution), _buffer(std::max<std::size_t>(buffer_size, 1))
+	{}
+	Client_pool(const Client_pool& copy) = delete;
+	/// Destroys all clients.
+	~Client_pool() noexcept
+	{
+		clear();
+		while (const auto buffer = _free) {
+			_free = buffer->next;
+			delete buffer;
+		}
+	}
+	/**
+	 * Opens the reactor.
+	 *
+	 * @param[out] ec The error of the system call.
+	 */
+	void open(std::error_code& ec) { _reactor.open(ec); }
+	/**
+	 * Creates a client and registers its socket and timers.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param socket The connected socket. It is owned by the pool even if adding fails.
+	 * @param args The arguments for the client after the pool and the socket.
+	 * @tparam Client The client type derived from Pool_client.
+	 * @returns The client or `nullptr` if adding failed.
+	 */
+	template<typename Client, typename... Args>
+	Client* add(std::error_code& ec, int socket, Args&&... args)
+	{
+		std::unique_ptr<Client> client{ new Client{ *this, socket, std::forward<Args>(args)... } };
+		Connection& connection = *client;
+		connection._index      = static_cast<std::uint32_t>(_connections.size());
+		_connections.push_back(&connection);
+		if (_reactor.add(ec, socket, connection, EPOLLIN), ec) {
+			return nullptr;
+		}
+		connection._attach(&_reactor.wheel(), &static_cast<typename Reactor::Handler&>(connection));
+		return client.release();
+	}
+	/// Destroys the client. Must not be called by the client on itself from within its callbacks.
+	void remove(Connection& connection) noexcept { delete &connection; }
+	/// Destroys all clients.
+	void clear() noexcept
+	{
+		while (!_connections.empty()) {
+			delete _connections.back();
+		}
+		_dirty.clear();
+	}
+	/**
+	 * Sends what the clients wrote, waits until a socket is ready, the next timer is due or the deadline
+	 * passed and handles the batch of ready connections and timers. What the clients wrote while doing so is
+	 * sent afterwards.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param deadline Returns at the latest at this time.
+	 * @returns The amount of ready connections and fired timers.
+	 */
+	std::size_t run_once(std::error_code& ec, time_point deadline = time_point::max())
+	{
+		flush();
+		const auto handled = _reactor.run_once(ec, deadline);
+		flush();
+		return handled;
+	}
+	/// Sends what the clients wrote as far as their sockets take it. Connections failing here are destroyed.
+	void flush() noexcept
+	{
+		// failing connections may destroy others or write to them
+		for (std::size_t i = 0; i < _dirty.size(); ++i) {
+			if (const auto connection = _dirty[i]) {
+				connection->_dirty = false;
+				_send(*connection);
+			}
+		}
+		_dirty.clear();
+	}
+	/// The amount of clients.
+	std::size_t size() const noexcept { return _connections.size(); }
+	bool empty() const noexcept { return _connections.empty(); }
+	/// How many buffers are lent to connections that have bytes to send or an incomplete packet.
+	std::size_t lent() const noexcept { return _lent; }
+	/// The input the clients decode from while they process.
+	Buffer_input& input() noexcept { return _input; }
+	/// The reactor. Other handlers may run on it as well.
+	Reactor& reactor() noexcept { return _reactor; }
+	Client_pool& operator=(const Client_pool& copy) = delete;
+
+private:
+	/// How many returned buffers are kept for reuse.
+	constexpr static std::size_t max_free = 64;
+
+	Reactor _reactor;
+	Buffer_input _input;
+	/// The receive buffer of all connections.
+	std::vector<char> _buffer;
+	std::vector<Connection*> _connections;
+	/// The connections with bytes to send. Destroyed connections are replaced by `nullptr`.
+	std::vector<Connection*> _dirty;
+	detail::Pool_buffer* _free = nullptr;
+	std::size_t _free_count    = 0;
+	std::size_t _lent          = 0;
+
+	detail::Pool_buffer* _lease()
+	{
+		++_lent;
+		if (const auto buffer = _free) {
+			_free = buffer->next;
+			--_free_count;
+			return buffer;
+		}
+		return new detail::Pool_buffer{};
+	}
+	void _release(detail::Pool_buffer* buffer) noexcept
+	{
+		--_lent;
+		if (_free_count == max_free) {
+			delete buffer;
+			return;
+		}
+		// buffers that grew while a connection was blocked should not stay that large
+		if (buffer->data.capacity() > _buffer.size()) {
+			std::vector<char>{}.swap(buffer->data);
+		}
+		buffer->data.clear();
+		buffer->sent = 0;
+		buffer->next = _free;
+		_free        = buffer;
+		++_free_count;
+	}
+	void _leave(Connection& connection) noexcept
+	{
+		_reactor.remove(connection._socket, connection);
+		if (connection._dirty) {
+			*std::find(_dirty.rbegin(), _dirty.rend(), &connection) = nullptr;
+		}
+		if (const auto buffer = connection._output) {
+			if (!connection._error) {
+				::send(connection._socket, buffer->data.data() + buffer->sent, connection.buffered(),
+				       MSG_DONTWAIT | MSG_NOSIGNAL);
+			}
+			_release(buffer);
+		}
+		if (connection._carry) {
+			_release(connection._carry);
+		}
+
+		// not added yet if the construction or adding failed
+		if (connection._index < _connections.size() && _connections[connection._index] == &connection) {
+			const auto last                 = _connections.back();
+			last->_index                    = connection._index;
+			_connections[connection._index] = last;
+			_connections.pop_back();
+		}
+	}
+	/// Destroys the connection after telling its client.
+	void _fail(Connection& connection, const std::error_code& ec) noexcept
+	{
+		connection._failed(ec);
+		delete &connection;
+	}
+	/**
+	 * Sends as many buffered bytes as the socket takes and waits for writability for the rest.
+	 *
+	 * @returns `false` if the connection failed and was destroyed.
+	 */
+	bool _send(Connection& connection) noexcept
+	{
+		std::error_code ec;
+		if (const auto buffer = connection._output) {
+			while (buffer->sent < buffer->data.size()) {
+				const auto n = ::send(connection._socket, buffer->data.data() + buffer->sent, connection.buffered(),
+				                      MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (n > 0) {
+					buffer->sent += static_cast<std::size_t>(n);
+				} else if (n < 0 && errno == EINTR) {
+					continue;
+				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					_wait_for_writability(ec, connection, true);
+					break;
+				} else {
+					connection._error = n < 0 ? errno : EIO;
+					ec                = connection.error();
+					break;
+				}
+			}
+			if (!ec && buffer->sent == buffer->data.size()) {
+				connection._output = nullptr;
+				_release(buffer);
+			}
+		}
+		if (!ec && !connection._output) {
+			_wait_for_writability(ec, connection, false);
+		}
+		if (ec) {
+			_fail(connection, ec);
+			return false;
+		}
+		return true;
+	}
+	void _wait_for_writability(std::error_code& ec, Connection& connection, bool enable)
+	{
+		if (enable != connection._writing) {
+			_reactor.modify(ec, connection._socket, connection, enable ? EPOLLIN | EPOLLOUT : EPOLLIN);
+			connection._writing = enable;
+		}
+	}
+	void _ready(Connection& connection, std::uint32_t events)
+	{
+		if ((events & EPOLLOUT) && !_send(connection)) {
+			return;
+		} else if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+			return;
+		}
+
+		std::error_code ec;
+		if (const auto size = _receive(ec, connection)) {
+			// complete packets are processed even if the connection is closed
+			std::error_code process_ec;
+			const auto complete =
+			  detail::complete_packets(_buffer.data(), size, _buffer.size(), connection._rest);
+			if (complete) {
+				_input.assign(_buffer.data(), complete);
+				connection._process(process_ec, complete);
+			}
+			if (!process_ec && complete < size) {
+				connection._carry = _lease();
+				connection._carry->data.assign(_buffer.data() + complete, _buffer.data() + size);
+			}
+			if (process_ec) {
+				ec = process_ec;
+			}
+		}
+		if (ec) {
+			_fail(connection, ec);
+		}
+	}
+	/**
+	 * Receives into the shared buffer behind the incomplete packet of the last read.
+	 *
+	 * @returns The amount of bytes in the buffer or `0` if nothing was received.
+	 */
+	std::size_t _receive(std::error_code& ec, Connection& connection)
+	{
+		const auto carry = connection._carry;
+		std::size_t size = 0;
+		if (carry) {
+			size = carry->data.size();
+			std::memcpy(_buffer.data(), carry->data.data(), size);
+		}
+
+		while (true) {
+			const auto n = ::recv(connection._socket, _buffer.data() + size, _buffer.size() - size, MSG_DONTWAIT);
+			if (n > 0) {
+				if (carry) {
+					connection._carry = nullptr;
+					_release(carry);
+				}
+				return size + static_cast<std::size_t>(n);
+			} else if (n == 0) {
+				ec = Error::connection_closed;
+			} else if (errno == EINTR) {
+				continue;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ec = detail::last_system_error();
+			}
+			return 0;
+		}
+	}
+	void _timer(Connection& connection)
+	{
+		std::error_code ec;
+		if (connection._update(ec), ec) {
+			_fail(connection, ec);
+		}
+	}
+};
+
+/**
+ * A client owned by a Client_pool. It decodes from the shared input of the pool and writes to its
+ * Client_pool::Connection. Clients are created with Client_pool::add() and the timers of keep alive and
+ * retransmission run on the wheel of the pool.
+ *
+ * @tparam Client The client type, like Basic_client or Advanced_client, with Buffer_input as input and
+ * Client_pool::Connection as output.
+ */
+template<typename Client>
+class Pool_client : public Client_pool<typename Client::Clock_type>::Connection, public Client {
+public:
+	typedef Client_pool<typename Client::Clock_type> Pool;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param[in] pool The pool.
+	 * @param socket The connected socket. It is owned from now on.
+	 * @param args The arguments for the client before its input and output.
+	 */
+	template<typename... Args>
+	explicit Pool_client(Pool& pool, int socket, Args&&... args)
+	    : Pool::Connection{ pool, socket },
+	      Client{ std::forward<Args>(args)..., pool.input(), static_cast<typename Pool::Connection&>(*this) }
+	{}
+	/// Disconnects. The DISCONNECT packet is only sent if the socket takes it right away.
+	~Pool_client() noexcept
+	{
+		std::error_code ec;
+		this->disconnect(ec);
+	}
+
+protected:
+	/**
+	 * Called when receiving, processing, sending or updating the state failed. The pool destroys the client
+	 * afterwards.
+	 *
+	 * @param ec The error.
+	 */
+	virtual void on_error(const std::error_code& ec) {}
+
+private:
+	void _attach(Timer_wheel<typename Client::Clock_type>* wheel, void* context) override
+	{
+		this->attach(wheel, context);
+	}
+	void _process(std::error_code& ec, std::size_t available) override { this->process_all(ec, available); }
+	void _update(std::error_code& ec) override { this->update_state(ec); }
+	void _failed(const std::error_code& ec) override { on_error(ec); }
+};
+
+} // namespace terraqtt
+
+#endif
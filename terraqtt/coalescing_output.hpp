@@ -0,0 +1,254 @@
+#ifndef TERRAQTT_COALESCING_OUTPUT_HPP_
+#define TERRAQTT_COALESCING_OUTPUT_HPP_
+
+#include "detail/output.hpp"
+#include "protocol/general.hpp"
+#include "protocol/writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace terraqtt {
+
+/// Decides when a Coalescing_output passes its buffered packets on.
+struct Flush_policy {
+	/// Flush once at least this many bytes are buffered. The buffer capacity is always a limit.
+	std::size_t bytes = std::numeric_limits<std::size_t>::max();
+	/// Flush once this many packets are complete. `0` disables the limit.
+	std::size_t packets = 0;
+	/// Flush once the oldest buffered byte waited this long. `0` disables the deadline.
+	std::chrono::microseconds max_delay{ 0 };
+	/// The packet types that are flushed as soon as they are complete as bit mask of `1 << type`.
+	std::uint16_t immediate_types = 1 << static_cast<int>(protocol::Control_packet_type::connect) |
+	                                1 << static_cast<int>(protocol::Control_packet_type::pingreq) |
+	                                1 << static_cast<int>(protocol::Control_packet_type::disconnect);
+
+	/// Returns the mask bit of the packet type.
+	constexpr static std::uint16_t type_bit(protocol::Control_packet_type type) noexcept
+	{
+		return static_cast<std::uint16_t>(1 << static_cast<int>(type));
+	}
+};
+
+/**
+ * An output that coalesces small packets into a fixed size buffer before passing them to the underlying
+ * output. The written bytes are scanned for the fixed headers, so packets written with
+ * protocol::write_packet() are recognized without any help from the writer.
+ *
+ * The buffer is flushed when the policy says so, when it cannot take the next write or when flush() is
+ * called. Writes larger than the capacity are passed through after flushing. If the underlying output
+ * provides `flush()`, it is called after every flush. The deadline of Flush_policy::max_delay is checked on
+ * every write and by update(), which Basic_client::update_state() calls.
+ *
+ * @code{.cpp}
+ * Flush_policy policy;
+ * policy.packets   = 16;
+ * policy.max_delay = std::chrono::milliseconds{ 5 };
+ * Coalescing_output<std::ostream, std::chrono::steady_clock> output{ stream, policy };
+ * @endcode
+ *
+ * @tparam Output The underlying output type.
+ * @tparam Clock The clock for the delay deadline.
+ * @tparam Capacity The size of the buffer in bytes.
+ */
+template<typename Output, typename Clock, std::size_t Capacity = 1460>
+class Coalescing_output {
+public:
+	static_assert(Capacity > 0, "capacity must be positive");
+
+	typedef typename Output::char_type char_type;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param[in] output The underlying output.
+	 * @param policy The flush policy.
+	 */
+	Coalescing_output(Output& output, const Flush_policy& policy = {}) noexcept
+	    : _output(output), _policy(policy)
+	{}
+	Coalescing_output(const Coalescing_output& copy) = delete;
+	/// Flushes the remaining bytes.
+	~Coalescing_output() { flush(); }
+	/**
+	 * Buffers the data or writes it through if it is larger than the buffer.
+	 *
+	 * @param data The data.
+	 * @param size The amount of characters.
+	 * @returns `*this`
+	 */
+	Coalescing_output& write(const char_type* data, std::size_t size)
+	{
+		const auto bytes = static_cast<const protocol::Byte*>(static_cast<const void*>(data));
+		_append(bytes, size * sizeof(char_type));
+		_scan(bytes, size * sizeof(char_type));
+		_apply_policy();
+		return *this;
+	}
+	/**
+	 * Buffers all chunks.
+	 *
+	 * @param chunks The chunks.
+	 * @param count The amount of chunks.
+	 * @returns `*this`
+	 * @see protocol::write_chunks()
+	 */
+	Coalescing_output& writev(const protocol::Chunk* chunks, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count && _good; ++i) {
+			const auto bytes = static_cast<const protocol::Byte*>(chunks[i].data);
+			_append(bytes, chunks[i].size);
+			_scan(bytes, chunks[i].size);
+		}
+		_apply_policy();
+		return *this;
+	}
+	/**
+	 * Writes all buffered bytes to the underlying output.
+	 *
+	 * @returns `*this`
+	 */
+	Coalescing_output& flush()
+	{
+		if (_size && _good) {
+			_output.write(reinterpret_cast<const char_type*>(_buffer), _size / sizeof(char_type));
+			_good = static_cast<bool>(_output);
+		}
+		_size    = 0;
+		_packets = 0;
+		if (_good) {
+			detail::flush_output(_output);
+			_good = static_cast<bool>(_output);
+		}
+		return *this;
+	}
+	/// Flushes if the delay deadline expired.
+	void update()
+	{
+		if (_size && _policy.max_delay.count() && Clock::now() >= deadline()) {
+			flush();
+		}
+	}
+	/// The time when the buffered bytes must be flushed. Only meaningful if a delay is configured.
+	typename Clock::time_point deadline() const noexcept
+	{
+		return _first_write + std::chrono::duration_cast<typename Clock::duration>(_policy.max_delay);
+	}
+	/// The deadline if bytes wait for it, otherwise `Clock::time_point::max()`.
+	typename Clock::time_point next_deadline() const noexcept
+	{
+		return _size && _policy.max_delay.count() ? deadline() : Clock::time_point::max();
+	}
+	/// How many bytes are buffered.
+	std::size_t buffered() const noexcept { return _size; }
+	/// How many complete packets are buffered.
+	std::size_t buffered_packets() const noexcept { return _packets; }
+	Output& output() noexcept { return _output; }
+	const Flush_policy& policy() const noexcept { return _policy; }
+	void policy(const Flush_policy& policy) noexcept { _policy = policy; }
+	bool good() const noexcept { return _good; }
+	explicit operator bool() const noexcept { return _good; }
+	bool operator!() const noexcept { return !_good; }
+
+private:
+	Output& _output;
+	Flush_policy _policy;
+	bool _good = true;
+	/// Whether a packet requiring an immediate flush was completed.
+	bool _immediate = false;
+	std::size_t _size    = 0;
+	std::size_t _packets = 0;
+	typename Clock::time_point _first_write;
+	/// The remaining body size of the current packet.
+	protocol::Variable_integer_type _body = 0;
+	/// The remaining length of the current packet being decoded.
+	protocol::Variable_integer_type _length = 0;
+	/// The position in the fixed header: `0` for the type, then the bytes of the remaining length.
+	std::uint8_t _header = 0;
+	std::uint8_t _type   = 0;
+	protocol::Byte _buffer[Capacity];
+
+	void _append(const protocol::Byte* data, std::size_t size)
+	{
+		if (!_good || !size) {
+			return;
+		}
+		if (size > Capacity - _size) {
+			flush();
+			// too large for the buffer
+			if (size >= Capacity) {
+				if (_good) {
+					_output.write(reinterpret_cast<const char_type*>(data), size / sizeof(char_type));
+					if ((_good = static_cast<bool>(_output))) {
+						detail::flush_output(_output);
+						_good = static_cast<bool>(_output);
+					}
+				}
+				return;
+			}
+		}
+
+		if (!_size && _policy.max_delay.count()) {
+			_first_write = Clock::now();
+		}
+		std::memcpy(_buffer + _size, data, size);
+		_size += size;
+	}
+	/// Follows the packet boundaries.
+	void _scan(const protocol::Byte* data, std::size_t size) noexcept
+	{
+		while (size) {
+			if (_body) {
+				const auto n = static_cast<protocol::Variable_integer_type>(
+				  std::min<std::size_t>(size, _body));
+				_body -= n;
+				data += n;
+				size -= n;
+				if (!_body) {
+					_end_packet();
+				}
+			} else if (!_header) {
+				_type   = *data >> 4;
+				_length = 0;
+				_header = 1;
+				++data;
+				--size;
+			} else {
+				_length |= static_cast<protocol::Variable_integer_type>(*data & 0x7f) << (7 * (_header - 1));
+				++_header;
+				if (!(*data & 0x80) || _header > 4) {
+					_header = 0;
+					_body   = _length;
+					if (!_body) {
+						_end_packet();
+					}
+				}
+				++data;
+				--size;
+			}
+		}
+	}
+	void _end_packet() noexcept
+	{
+		// packets that were written through are not buffered anymore
+		if (_size) {
+			++_packets;
+			_immediate = _immediate || (_policy.immediate_types & (1 << _type));
+		}
+	}
+	void _apply_policy()
+	{
+		if (_immediate || (_policy.packets && _packets >= _policy.packets) || _size >= _policy.bytes ||
+		    (_size && _policy.max_delay.count() && Clock::now() >= deadline())) {
+			_immediate = false;
+			flush();
+		}
+	}
+};
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef TERRAQTT_DETAIL_BITS_HPP_
+#define TERRAQTT_DETAIL_BITS_HPP_
+
+#include <cstdint>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * Returns the index of the lowest set bit.
+ *
+ * @private
+ * @param value must not be `0`
+ */
+inline unsigned lowest_bit(std::uint64_t value) noexcept
+{
+#if defined(__GNUC__)
+	return static_cast<unsigned>(__builtin_ctzll(value));
+#else
+	unsigned index = 0;
+	for (; !(value & 1); value >>= 1) {
+		++index;
+	}
+	return index;
+#endif
+}
+
+/**
+ * Returns the index of the highest set bit.
+ *
+ * @private
+ * @param value must not be `0`
+ */
+inline unsigned highest_bit(std::uint64_t value) noexcept
+{
+#if defined(__GNUC__)
+	return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#else
+	unsigned index = 0;
+	while (value >>= 1) {
+		++index;
+	}
+	return index;
+#endif
+}
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
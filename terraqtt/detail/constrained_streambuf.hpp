@@ -1,6 +1,10 @@
 #ifndef TERRAQTT_DETAIL_CONSTRAINED_STREAMBUF_HPP_
 #define TERRAQTT_DETAIL_CONSTRAINED_STREAMBUF_HPP_
 
+#include "streambuf_access.hpp"
+
+#include <algorithm>
+#include <cstring>
 #include <streambuf>
 
 namespace terraqtt {
@@ -10,6 +14,10 @@ namespace detail {
  * Constrains the available readable size of an existing streambuf to a given size. Once the bytes are read
  * they cannot be returned.
  *
+ * Bytes the parent has already buffered are exposed directly as the get area, so reading them costs no copy
+ * and no virtual call per byte. The parent only advances by the bytes that were actually read. While this
+ * object is reading, the parent must not be read from elsewhere.
+ *
  * @private
  */
 class Constrained_streambuf : public std::streambuf {
@@ -24,38 +32,108 @@ public:
 	{
 		_remaining = remaining;
 	}
+	Constrained_streambuf(const Constrained_streambuf& copy) = delete;
+	~Constrained_streambuf() { _return_view(); }
 	/// How many bytes can be read.
-	std::size_t remaining() const noexcept { return _remaining; }
-	std::size_t release()
+	std::size_t remaining() const noexcept { return _remaining + static_cast<std::size_t>(egptr() - gptr()); }
+	/**
+	 * Stops reading.
+	 *
+	 * @returns How many bytes of the allowed size were not taken from the parent.
+	 */
+	std::size_t release() noexcept
 	{
-		const std::size_t remaining = _remaining - static_cast<std::size_t>(egptr() - gptr());
+		_return_view();
+		const std::size_t remaining = _remaining;
 		_remaining                  = 0;
-		setg(nullptr, nullptr, nullptr);
 		return remaining;
 	}
 
 protected:
-	/**
-	 * @todo Improve performance batch reading and not one character only.
-	 */
 	int_type underflow() override
 	{
-		if (gptr() == egptr()) {
-			if (!_remaining) {
-				return traits_type::eof();
-			}
-			_parent.sgetn(_buffer, 1);
-			setg(_buffer, _buffer, _buffer + 1);
-			--_remaining;
+		_return_view();
+		if (!_remaining) {
+			return traits_type::eof();
+		} else if (_view()) {
+			return traits_type::to_int_type(*gptr());
 		}
+
+		// let the parent buffer more data
+		if (traits_type::eq_int_type(_parent.sgetc(), traits_type::eof())) {
+			return traits_type::eof();
+		} else if (_view()) {
+			return traits_type::to_int_type(*gptr());
+		}
+
+		// the parent does not buffer
+		if (_parent.sgetn(_buffer, 1) != 1) {
+			return traits_type::eof();
+		}
+		setg(_buffer, _buffer, _buffer + 1);
+		--_remaining;
 		return traits_type::to_int_type(_buffer[0]);
 	}
+	std::streamsize xsgetn(char_type* buffer, std::streamsize count) override
+	{
+		std::streamsize n = std::min<std::streamsize>(count, egptr() - gptr());
+		if (n > 0) {
+			std::memcpy(buffer, gptr(), static_cast<std::size_t>(n));
+			setg(eback(), gptr() + n, egptr());
+		}
+
+		// read the rest directly from the parent
+		if (n < count && _remaining) {
+			_return_view();
+			const auto read =
+			  _parent.sgetn(buffer + n, static_cast<std::streamsize>(
+			                              std::min(static_cast<std::size_t>(count - n), _remaining)));
+			_remaining -= static_cast<std::size_t>(read);
+			n += read;
+		}
+		return n;
+	}
+	std::streamsize showmanyc() override
+	{
+		if (!_remaining) {
+			return -1;
+		}
+		return static_cast<std::streamsize>(
+		  std::min(_remaining, static_cast<std::size_t>(std::max<std::streamsize>(_parent.in_avail(), 0))));
+	}
 
 private:
 	std::streambuf& _parent;
 	std::size_t _remaining;
-	/// The internal buffer.
+	/// Whether the get area is a view into the get area of the parent.
+	bool _viewing = false;
+	/// The internal buffer if the parent does not buffer.
 	char _buffer[1];
+
+	/// Exposes the buffered bytes of the parent as the get area.
+	bool _view() noexcept
+	{
+		const auto first = Streambuf_access::get_pointer(_parent);
+		const auto n     = std::min(Streambuf_access::buffered(_parent), _remaining);
+		if (!n) {
+			return false;
+		}
+
+		setg(first, first, first + n);
+		_remaining -= n;
+		_viewing = true;
+		return true;
+	}
+	/// Consumes the read bytes of the viewed area from the parent and clears the get area.
+	void _return_view() noexcept
+	{
+		if (_viewing) {
+			_remaining += static_cast<std::size_t>(egptr() - gptr());
+			Streambuf_access::consume(_parent, static_cast<std::size_t>(gptr() - eback()));
+			_viewing = false;
+		}
+		setg(nullptr, nullptr, nullptr);
+	}
 };
 
 } // namespace detail
@@ -0,0 +1,121 @@
+#ifndef TERRAQTT_DETAIL_CONTAINER_HPP_
+#define TERRAQTT_DETAIL_CONTAINER_HPP_
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace terraqtt {
+namespace detail {
+
+/// Orders overloads; a higher rank is preferred.
+template<std::size_t Rank>
+struct Priority : Priority<Rank - 1> {};
+
+template<>
+struct Priority<0> {};
+
+template<typename Char, typename Traits, typename Allocator>
+inline Char* contiguous_data(std::basic_string<Char, Traits, Allocator>& string, Priority<3>) noexcept
+{
+	// non-const data() is only available since C++17
+	return &string[0];
+}
+
+template<typename Char, typename Traits, typename Allocator>
+inline const Char* contiguous_data(const std::basic_string<Char, Traits, Allocator>& string,
+                                   Priority<3>) noexcept
+{
+	return string.data();
+}
+
+template<typename Container>
+inline auto contiguous_data(Container& container, Priority<2>) noexcept -> typename std::enable_if<
+  std::is_pointer<decltype(container.data())>::value, decltype(container.data())>::type
+{
+	return container.data();
+}
+
+template<typename Container>
+inline auto contiguous_data(Container& container, Priority<1>) noexcept -> typename std::enable_if<
+  std::is_pointer<decltype(container.begin())>::value, decltype(container.begin())>::type
+{
+	return container.begin();
+}
+
+template<typename Container>
+inline std::nullptr_t contiguous_data(Container& container, Priority<0>) noexcept
+{
+	return nullptr;
+}
+
+/**
+ * Returns a pointer to the first element if the container stores its elements contiguously, like
+ * `std::string`, `std::vector`, Static_container and String_view do. Otherwise `nullptr` is returned.
+ *
+ * @private
+ */
+template<typename Container>
+inline auto contiguous_data(Container& container) noexcept
+  -> decltype(contiguous_data(container, Priority<3>{}))
+{
+	return contiguous_data(container, Priority<3>{});
+}
+
+/**
+ * Checks whether the elements of the container are stored contiguously.
+ *
+ * @private
+ * @see contiguous_data()
+ */
+template<typename Container>
+struct Is_contiguous
+    : std::integral_constant<bool, !std::is_same<decltype(contiguous_data(std::declval<Container&>())),
+                                                 std::nullptr_t>::value> {};
+
+/**
+ * Checks whether the container can be extended in bulk with `resize()`.
+ *
+ * @private
+ */
+template<typename Container, typename = void>
+struct Is_resizable : std::false_type {};
+
+template<typename Container>
+struct Is_resizable<Container, decltype(std::declval<Container&>().resize(std::size_t{}), void())>
+    : std::true_type {};
+
+template<typename Container>
+inline auto clear(Container& container, Priority<2>) -> decltype(container.clear(), void())
+{
+	container.clear();
+}
+
+template<typename Container>
+inline auto clear(Container& container, Priority<1>) -> decltype(container.resize(std::size_t{}), void())
+{
+	container.resize(0);
+}
+
+template<typename Container>
+inline void clear(Container& container, Priority<0>)
+{
+	container = Container{};
+}
+
+/**
+ * Removes all elements from the container but keeps its storage if possible.
+ *
+ * @private
+ */
+template<typename Container>
+inline void clear(Container& container)
+{
+	clear(container, Priority<2>{});
+}
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef TERRAQTT_DETAIL_OUTPUT_HPP_
+#define TERRAQTT_DETAIL_OUTPUT_HPP_
+
+#include "container.hpp"
+#include "streambuf_access.hpp"
+
+#include <cstddef>
+
+namespace terraqtt {
+namespace detail {
+
+template<typename Output>
+inline auto flush_output(Output& output, Priority<1>) -> decltype(output.flush(), void())
+{
+	output.flush();
+}
+
+template<typename Output>
+inline void flush_output(Output& output, Priority<0>) noexcept
+{}
+
+/**
+ * Calls `output.flush()` if the output provides it.
+ *
+ * @private
+ */
+template<typename Output>
+inline void flush_output(Output& output)
+{
+	flush_output(output, Priority<1>{});
+}
+
+template<typename Output>
+inline auto update_output(Output& output, Priority<1>) -> decltype(output.update(), void())
+{
+	output.update();
+}
+
+template<typename Output>
+inline void update_output(Output& output, Priority<0>) noexcept
+{}
+
+/**
+ * Calls `output.update()` if the output provides it. This lets outputs act on time based events like flush
+ * deadlines.
+ *
+ * @private
+ */
+template<typename Output>
+inline void update_output(Output& output)
+{
+	update_output(output, Priority<1>{});
+}
+
+template<typename Time_point, typename Output>
+inline auto output_deadline(Output& output, Priority<1>) -> decltype(Time_point{ output.next_deadline() })
+{
+	return output.next_deadline();
+}
+
+template<typename Time_point, typename Output>
+inline Time_point output_deadline(Output& output, Priority<0>) noexcept
+{
+	return Time_point::max();
+}
+
+/**
+ * Returns `output.next_deadline()` if the output provides it with the same clock, otherwise
+ * `Time_point::max()`.
+ *
+ * @private
+ */
+template<typename Time_point, typename Output>
+inline Time_point output_deadline(Output& output)
+{
+	return output_deadline<Time_point>(output, Priority<1>{});
+}
+
+template<typename Output>
+inline auto buffered_output(Output& output, Priority<2>)
+  -> decltype(static_cast<std::size_t>(output.buffered()))
+{
+	return static_cast<std::size_t>(output.buffered());
+}
+
+template<typename Output>
+inline auto buffered_output(Output& output, Priority<1>)
+  -> decltype(Streambuf_access::pending(*output.rdbuf()))
+{
+	return output.rdbuf() ? Streambuf_access::pending(*output.rdbuf()) : 0;
+}
+
+template<typename Output>
+inline std::size_t buffered_output(Output& output, Priority<0>) noexcept
+{
+	return 0;
+}
+
+/**
+ * Returns how many bytes the output holds back, either from `output.buffered()` like Coalescing_output or
+ * from the put area of a stream. Outputs without either report `0`.
+ *
+ * @private
+ */
+template<typename Output>
+inline std::size_t buffered_output(Output& output)
+{
+	return buffered_output(output, Priority<2>{});
+}
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef TERRAQTT_DETAIL_STREAMBUF_ACCESS_HPP_
+#define TERRAQTT_DETAIL_STREAMBUF_ACCESS_HPP_
+
+#include <cstddef>
+#include <streambuf>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * Grants access to the get and put areas of arbitrary stream buffers. This allows reading the bytes a stream
+ * buffer has already buffered without copying them out.
+ *
+ * @private
+ */
+class Streambuf_access : public std::streambuf {
+public:
+	/// Returns the next byte of the get area of `buffer`.
+	static char_type* get_pointer(std::streambuf& buffer) noexcept
+	{
+		return (buffer.*&Streambuf_access::gptr)();
+	}
+	/// Returns the end of the get area of `buffer`.
+	static char_type* end_pointer(std::streambuf& buffer) noexcept
+	{
+		return (buffer.*&Streambuf_access::egptr)();
+	}
+	/// Returns how many bytes are in the get area of `buffer`.
+	static std::size_t buffered(std::streambuf& buffer) noexcept
+	{
+		return static_cast<std::size_t>(end_pointer(buffer) - get_pointer(buffer));
+	}
+	/// Consumes `count` bytes of the get area of `buffer`. The get area must contain at least `count` bytes.
+	static void consume(std::streambuf& buffer, std::size_t count) noexcept
+	{
+		const auto first = (buffer.*&Streambuf_access::eback)();
+		(buffer.*&Streambuf_access::setg)(first, get_pointer(buffer) + count, end_pointer(buffer));
+	}
+	/// Returns how many bytes were written to the put area of `buffer` but not passed on yet.
+	static std::size_t pending(std::streambuf& buffer) noexcept
+	{
+		return static_cast<std::size_t>((buffer.*&Streambuf_access::pptr)() -
+		                                (buffer.*&Streambuf_access::pbase)());
+	}
+};
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef TERRAQTT_DETAIL_SYSTEM_HPP_
+#define TERRAQTT_DETAIL_SYSTEM_HPP_
+
+#include <cerrno>
+#include <system_error>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * Returns the error of the last failed system call.
+ *
+ * @private
+ */
+inline std::error_code last_system_error() noexcept
+{
+	return { errno, std::system_category() };
+}
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
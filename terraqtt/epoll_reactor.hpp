@@ -0,0 +1,362 @@
+#ifndef TERRAQTT_EPOLL_REACTOR_HPP_
+#define TERRAQTT_EPOLL_REACTOR_HPP_
+
+#include "detail/system.hpp"
+#include "socket.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <sys/epoll.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * Returns the timeout for `epoll_wait()` in milliseconds, rounded up so the deadline has passed on return.
+ *
+ * @private
+ * @returns The timeout or `-1` for `time_point::max()`.
+ */
+template<typename Clock>
+inline int wait_timeout(typename Clock::time_point deadline)
+{
+	if (deadline == Clock::time_point::max()) {
+		return -1;
+	}
+	const auto now = Clock::now();
+	if (deadline <= now) {
+		return 0;
+	}
+	const auto left =
+	  std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds{ 1 };
+	return static_cast<int>(
+	  std::min<std::chrono::milliseconds::rep>(left.count(), std::numeric_limits<int>::max()));
+}
+
+} // namespace detail
+
+/**
+ * A single threaded event loop over `epoll` with a Timer_wheel for the deadlines. Handlers are registered
+ * with the file descriptors they wait for and are called when these become ready or when a timer with the
+ * handler as context fires. Reactor_client connects a client to the reactor.
+ *
+ * @code{.cpp}
+ * Epoll_reactor<std::chrono::steady_clock> reactor;
+ * reactor.open(ec);
+ * Reactor_client<Advanced_client<Socket_input, Socket_output, ...>> client{ socket };
+ * client.start(ec, reactor);
+ * client.connect(ec, "id", true, std::chrono::seconds{ 30 });
+ * while (!ec) {
+ * 	reactor.run_once(ec);
+ * }
+ * @endcode
+ *
+ * @tparam Clock The clock of the deadlines.
+ */
+template<typename Clock>
+class Epoll_reactor {
+public:
+	typedef typename Clock::time_point time_point;
+	typedef Timer_wheel<Clock> Wheel;
+
+	/// Something waiting for file descriptors or timers of a reactor.
+	class Handler {
+	public:
+		Handler(const Handler& copy) = delete;
+		Handler& operator=(const Handler& copy) = delete;
+
+	protected:
+		Handler() = default;
+		virtual ~Handler() = default;
+
+	private:
+		friend Epoll_reactor;
+
+		/// Called with the `epoll` events of a file descriptor registered for this handler.
+		virtual void on_ready(std::uint32_t events) = 0;
+		/// Called when a timer of the wheel with this handler as context fired.
+		virtual void on_timer() = 0;
+	};
+
+	/**
+	 * Constructor. The reactor must be opened before use.
+	 *
+	 * @param resolution The resolution of the timer wheel.
+	 */
+	explicit Epoll_reactor(typename Clock::duration resolution = Wheel::default_resolution())
+	    : _wheel(resolution)
+	{}
+	Epoll_reactor(const Epoll_reactor& copy) = delete;
+	~Epoll_reactor() noexcept { close(); }
+	/**
+	 * Creates the `epoll` instance.
+	 *
+	 * @param[out] ec The error of the system call.
+	 */
+	void open(std::error_code& ec)
+	{
+		close();
+		if ((_fd = ::epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			ec = detail::last_system_error();
+		}
+	}
+	/// Closes the `epoll` instance. Registered handlers are forgotten but their timers stay scheduled.
+	void close() noexcept
+	{
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+		_count = 0;
+	}
+	bool is_open() const noexcept { return _fd >= 0; }
+	/**
+	 * Registers a file descriptor.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param fd The file descriptor. A file descriptor can only be registered once.
+	 * @param[in] handler The handler to call. Must stay alive until the file descriptor is removed.
+	 * @param events The `epoll` events to wait for, like `EPOLLIN`.
+	 */
+	void add(std::error_code& ec, int fd, Handler& handler, std::uint32_t events)
+	{
+		_control(ec, EPOLL_CTL_ADD, fd, handler, events);
+	}
+	/// Changes the events a registered file descriptor waits for.
+	void modify(std::error_code& ec, int fd, Handler& handler, std::uint32_t events)
+	{
+		_control(ec, EPOLL_CTL_MOD, fd, handler, events);
+	}
+	/**
+	 * Unregisters a file descriptor. Events of the handler that are still waiting to be dispatched by the
+	 * current run_once() are dropped, so handlers may remove and destroy each other while being called.
+	 *
+	 * @param fd The file descriptor.
+	 * @param[in] handler The handler it was registered with.
+	 */
+	void remove(int fd, Handler& handler) noexcept
+	{
+		if (_fd >= 0) {
+			epoll_event event{};
+			::epoll_ctl(_fd, EPOLL_CTL_DEL, fd, &event);
+		}
+		for (auto i = _next; i < _count; ++i) {
+			if (_events[i].data.ptr == &handler) {
+				_events[i].data.ptr = nullptr;
+			}
+		}
+	}
+	/**
+	 * Waits until a file descriptor is ready, the next timer is due or the deadline passed and calls the
+	 * handlers. Timers that are due are fired afterwards.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param deadline Returns at the latest at this time.
+	 * @returns The amount of dispatched events and fired timers.
+	 */
+	std::size_t run_once(std::error_code& ec, time_point deadline = time_point::max())
+	{
+		deadline       = std::min(deadline, _wheel.next_deadline());
+		const int wait = ::epoll_wait(_fd, _events, max_events, detail::wait_timeout<Clock>(deadline));
+		if (wait < 0) {
+			if (errno != EINTR) {
+				ec = detail::last_system_error();
+			}
+			return 0;
+		}
+
+		std::size_t dispatched = 0;
+		_count                 = static_cast<std::size_t>(wait);
+		for (_next = 0; _next < _count;) {
+			const auto& event = _events[_next++];
+			if (event.data.ptr) {
+				++dispatched;
+				static_cast<Handler*>(event.data.ptr)->on_ready(event.events);
+			}
+		}
+		_count = 0;
+
+		return dispatched + _wheel.expire(Clock::now(), [](typename Wheel::Timer& timer) {
+			       static_cast<Handler*>(timer.context())->on_timer();
+		       });
+	}
+	/// The wheel of the deadlines. The context of its timers must be the Handler to call.
+	Wheel& wheel() noexcept { return _wheel; }
+	int native_handle() const noexcept { return _fd; }
+	Epoll_reactor& operator=(const Epoll_reactor& copy) = delete;
+
+private:
+	constexpr static std::size_t max_events = 64;
+
+	int _fd = -1;
+	Wheel _wheel;
+	epoll_event _events[max_events];
+	/// The amount of events of the current run_once().
+	std::size_t _count = 0;
+	/// The next event run_once() dispatches.
+	std::size_t _next = 0;
+
+	void _control(std::error_code& ec, int operation, int fd, Handler& handler, std::uint32_t events)
+	{
+		epoll_event event{};
+		event.events   = events;
+		event.data.ptr = &handler;
+		if (::epoll_ctl(_fd, operation, fd, &event)) {
+			ec = detail::last_system_error();
+		}
+	}
+};
+
+/**
+ * Runs a client over a socket on an Epoll_reactor. The client reads from a Socket_input and writes to a
+ * Socket_output. When the socket is readable, everything it has is received and processed with
+ * Basic_client::process_all(), when it becomes writable again the output is flushed and the timers of keep
+ * alive and retransmission fire through the wheel of the reactor. After every event the written packets are
+ * flushed and the reactor only waits for writability while the socket cannot take them.
+ *
+ * Packets written outside of the callbacks of the client are sent by flush().
+ *
+ * @tparam Client The client type, like Advanced_client or Persistent_client, with Socket_input and
+ * Socket_output as input and output.
+ */
+template<typename Client>
+class Reactor_client : private detail::Socket_streams,
+                       public Client,
+                       private Epoll_reactor<typename Client::Clock_type>::Handler {
+public:
+	typedef Epoll_reactor<typename Client::Clock_type> Reactor;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param socket The connected socket. It is not owned.
+	 * @param args The arguments for the client before its input and output.
+	 */
+	template<typename... Args>
+	explicit Reactor_client(int socket, Args&&... args)
+	    : detail::Socket_streams{ socket, 16 * 1024, 16 * 1024 },
+	      Client{ std::forward<Args>(args)..., socket_input, socket_output }
+	{}
+	/// Stops and disconnects. The DISCONNECT packet is only sent if the socket takes it right away.
+	~Reactor_client() noexcept
+	{
+		stop();
+		std::error_code ec;
+		this->disconnect(ec);
+		socket_output.flush();
+	}
+	/**
+	 * Registers the socket and the timers with the reactor.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param[in] reactor The reactor. Must outlive the client or the client must be stopped.
+	 */
+	void start(std::error_code& ec, Reactor& reactor)
+	{
+		stop();
+		if (reactor.add(ec, socket_input.socket(), _handler(), EPOLLIN), !ec) {
+			_reactor = &reactor;
+			_writing = false;
+			this->attach(&reactor.wheel(), &_handler());
+		}
+	}
+	/// Unregisters from the reactor.
+	void stop() noexcept
+	{
+		if (_reactor) {
+			_reactor->remove(socket_input.socket(), _handler());
+			_reactor = nullptr;
+			this->attach(nullptr, nullptr);
+		}
+	}
+#if defined(__cpp_exceptions)
+	void flush()
+	{
+		std::error_code ec;
+		if (flush(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Sends the written packets as far as the socket takes them and waits for writability for the rest.
+	 *
+	 * @param[out] ec The error code if any.
+	 */
+	void flush(std::error_code& ec)
+	{
+		if (Client::flush(ec), !ec) {
+			_wait_for_writability(ec, socket_output.buffered() > 0);
+		}
+	}
+	bool is_started() const noexcept { return _reactor; }
+
+protected:
+	/**
+	 * Called when receiving, processing, sending or updating the state failed from within the reactor. The
+	 * client is already stopped and may be destroyed in here.
+	 *
+	 * @param ec The error.
+	 */
+	virtual void on_error(const std::error_code& ec) {}
+
+private:
+	Reactor* _reactor = nullptr;
+	/// Whether the reactor waits for writability.
+	bool _writing = false;
+
+	typename Reactor::Handler& _handler() noexcept { return *this; }
+	void on_ready(std::uint32_t events) override
+	{
+		std::error_code ec;
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+			socket_input.receive(ec);
+			// buffered bytes are processed even if the connection is closed
+			std::error_code process_ec;
+			if (socket_input.available()) {
+				this->process_all(process_ec, socket_input.available());
+			}
+			if (process_ec) {
+				ec = process_ec;
+			}
+		}
+		_after(ec);
+	}
+	void on_timer() override
+	{
+		std::error_code ec;
+		this->update_state(ec);
+		_after(ec);
+	}
+	void _after(std::error_code& ec)
+	{
+		if (!ec && !socket_output) {
+			ec = socket_output.error();
+		} else if (!ec) {
+			flush(ec);
+		}
+		if (ec) {
+			stop();
+			on_error(ec);
+		}
+	}
+	void _wait_for_writability(std::error_code& ec, bool enable)
+	{
+		if (_reactor && enable != _writing) {
+			_reactor->modify(ec, socket_input.socket(), _handler(), enable ? EPOLLIN | EPOLLOUT : EPOLLIN);
+			_writing = enable;
+		}
+	}
+};
+
+} // namespace terraqtt
+
+#endif
@@ -35,6 +35,11 @@ enum class Error {
 
 	bad_variant_cast,
 	connection_timed_out,
+	bad_topic_filter,
+	payload_size_mismatch,
+	packet_identifiers_exhausted,
+	would_block,
+	connection_closed,
 };
 
 inline const std::error_category& terraqtt_category() noexcept
@@ -48,6 +53,11 @@ inline const std::error_category& terraqtt_category() noexcept
 			case Error::empty_client_identifier: return "empty client identifier";
 			case Error::bad_variant_cast: return "bad variant cast";
 			case Error::connection_timed_out: return "connection timed out";
+			case Error::bad_topic_filter: return "bad topic filter";
+			case Error::payload_size_mismatch: return "payload size mismatch";
+			case Error::packet_identifiers_exhausted: return "packet identifiers exhausted";
+			case Error::would_block: return "would block";
+			case Error::connection_closed: return "connection closed";
 			default: return "(unknown error code)";
 			}
 		}
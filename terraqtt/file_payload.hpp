@@ -0,0 +1,323 @@
+#ifndef TERRAQTT_FILE_PAYLOAD_HPP_
+#define TERRAQTT_FILE_PAYLOAD_HPP_
+
+#include "detail/container.hpp"
+#include "detail/output.hpp"
+#include "detail/system.hpp"
+#include "error.hpp"
+#include "produced_payload.hpp"
+#include "protocol/publishing.hpp"
+#include "protocol/writer.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#if defined(__linux__)
+#	include <sys/sendfile.h>
+#endif
+
+namespace terraqtt {
+namespace detail {
+
+template<typename Output>
+inline auto native_handle(Output& output, Priority<1>) -> decltype(static_cast<int>(output.native_handle()))
+{
+	return static_cast<int>(output.native_handle());
+}
+
+template<typename Output>
+inline int native_handle(Output& output, Priority<0>) noexcept
+{
+	return -1;
+}
+
+/**
+ * Returns the file descriptor of `output.native_handle()` or `-1` if the output has none.
+ *
+ * @private
+ */
+template<typename Output>
+inline int native_handle(Output& output)
+{
+	return native_handle(output, Priority<1>{});
+}
+
+/**
+ * Reads a file region with `pread()`.
+ *
+ * @private
+ */
+class File_producer {
+public:
+	File_producer(int fd, off_t offset) noexcept : _fd(fd), _offset(offset) {}
+	std::size_t operator()(char* buffer, std::size_t size) noexcept
+	{
+		ssize_t n;
+		while ((n = ::pread(_fd, buffer, size, _offset)) < 0 && errno == EINTR) {}
+		if (n <= 0) {
+			return 0;
+		}
+		_offset += n;
+		return static_cast<std::size_t>(n);
+	}
+
+private:
+	int _fd;
+	off_t _offset;
+};
+
+/**
+ * Blocks `SIGPIPE` for the calling thread while it exists, since `sendfile()` has no `MSG_NOSIGNAL`. A
+ * `SIGPIPE` raised in the meantime is discarded, so a closed peer is only reported as `EPIPE`.
+ *
+ * @private
+ */
+class Sigpipe_block {
+public:
+	Sigpipe_block() noexcept
+	{
+		sigset_t pending;
+		sigset_t previous;
+		sigemptyset(&_set);
+		sigaddset(&_set, SIGPIPE);
+		_was_pending = !::sigpending(&pending) && sigismember(&pending, SIGPIPE) == 1;
+		_was_blocked = !::pthread_sigmask(SIG_BLOCK, &_set, &previous) && sigismember(&previous, SIGPIPE) == 1;
+	}
+	Sigpipe_block(const Sigpipe_block& copy) = delete;
+	~Sigpipe_block() noexcept
+	{
+		sigset_t pending;
+		if (!_was_pending && !::sigpending(&pending) && sigismember(&pending, SIGPIPE) == 1) {
+			const timespec immediately{};
+			while (::sigtimedwait(&_set, nullptr, &immediately) < 0 && errno == EINTR) {}
+		}
+		if (!_was_blocked) {
+			::pthread_sigmask(SIG_UNBLOCK, &_set, nullptr);
+		}
+	}
+	Sigpipe_block& operator=(const Sigpipe_block& copy) = delete;
+
+private:
+	sigset_t _set;
+	bool _was_pending;
+	bool _was_blocked;
+};
+
+} // namespace detail
+
+/**
+ * A payload read from a region of a file. If the output provides `native_handle()` returning a socket, the
+ * region is sent with `sendfile()` on Linux after the header was written and the output flushed, so the file
+ * data never passes through user space. Otherwise, or if the output still holds back part of the header after
+ * the flush, the region is read in bounded chunks like a Produced_payload. `SIGPIPE` is blocked during
+ * `sendfile()`, a closed peer is reported as `std::errc::broken_pipe`.
+ *
+ * The file position is not changed, so the same payload can be published many times and concurrently.
+ *
+ * A non-blocking socket that is not writable makes `sendfile()` wait with `poll()` for at most the send
+ * timeout without any progress. If it expires, the packet is incomplete and the connection must be closed.
+ * Event loops that cannot afford to stall their thread for that long should lower the timeout or use an
+ * output without `native_handle()`.
+ *
+ * @code{.cpp}
+ * const int fd = ::open("image.bin", O_RDONLY);
+ * const File_payload image{ ec, fd };
+ * for (const auto& topic : topics) {
+ *   client.publish(ec, topic, image);
+ * }
+ * @endcode
+ */
+class File_payload {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param fd the file; must stay open while the payload is used
+	 * @param size the size of the region in bytes
+	 * @param offset the start of the region
+	 */
+	File_payload(int fd, std::size_t size, off_t offset = 0) noexcept : _fd(fd), _offset(offset), _size(size)
+	{}
+	/**
+	 * Constructor for the complete file.
+	 *
+	 * @param ec[out] the error code, if the size could not be determined
+	 * @param fd the file; must stay open while the payload is used
+	 */
+	File_payload(std::error_code& ec, int fd) noexcept : _fd(fd)
+	{
+		struct stat status;
+		if (::fstat(fd, &status)) {
+			ec = detail::last_system_error();
+		} else {
+			_size = static_cast<std::size_t>(status.st_size);
+		}
+	}
+	int fd() const noexcept { return _fd; }
+	off_t offset() const noexcept { return _offset; }
+	std::size_t size() const noexcept { return _size; }
+	std::chrono::milliseconds send_timeout() const noexcept { return _send_timeout; }
+	/**
+	 * Sets how long `sendfile()` waits for a non-blocking socket to become writable again.
+	 *
+	 * @param timeout the timeout; `0` gives up as soon as the socket would block
+	 */
+	void send_timeout(std::chrono::milliseconds timeout) noexcept { _send_timeout = timeout; }
+	/**
+	 * Writes the header chunks followed by the file region. Called by protocol::write_packet().
+	 *
+	 * @param output[in] the output
+	 * @param ec[out] the error code; Error::payload_size_mismatch if the file is shorter than the region or
+	 * Error::connection_timed_out if the socket was not writable within the send timeout
+	 * @param chunks the header chunks; must have room for one more
+	 * @param count the amount of header chunks
+	 */
+	template<typename Output>
+	void write(Output& output, std::error_code& ec, protocol::Chunk* chunks, std::size_t count) const
+	{
+#if defined(__linux__)
+		const int socket = detail::native_handle(output);
+		if (socket >= 0) {
+			// the header must have left all user space buffers before the payload is sent
+			if (protocol::write_chunks(output, ec, chunks, count), ec) {
+				return;
+			} else if (detail::flush_output(output), !output) {
+				ec = std::make_error_code(std::errc::io_error);
+				return;
+			} else if (!detail::buffered_output(output)) {
+				_send(socket, ec);
+				return;
+			}
+			// the rest of the header is still buffered, so the payload has to follow it through the output
+			count = 0;
+		}
+#endif
+		const auto payload = produced_payload<16 * 1024>(_size, detail::File_producer{ _fd, _offset });
+		protocol::detail::write_payload(output, ec, chunks, count, payload);
+	}
+
+private:
+	int _fd;
+	off_t _offset                           = 0;
+	std::size_t _size                       = 0;
+	std::chrono::milliseconds _send_timeout = std::chrono::seconds{ 10 };
+
+#if defined(__linux__)
+	void _send(int socket, std::error_code& ec) const
+	{
+		const detail::Sigpipe_block block;
+		auto offset = _offset;
+		auto left   = _size;
+		while (left) {
+			const auto n = ::sendfile(socket, _fd, &offset, left);
+			if (n > 0) {
+				left -= static_cast<std::size_t>(n);
+			} else if (n == 0) {
+				ec = Error::payload_size_mismatch;
+				return;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// errors and hang ups are reported by the next sendfile()
+				pollfd writable{ socket, POLLOUT, 0 };
+				const auto ready = ::poll(&writable, 1, static_cast<int>(_send_timeout.count()));
+				if (ready == 0) {
+					ec = Error::connection_timed_out;
+					return;
+				} else if (ready < 0 && errno != EINTR) {
+					ec = detail::last_system_error();
+					return;
+				}
+			} else if (errno != EINTR) {
+				ec = detail::last_system_error();
+				return;
+			}
+		}
+	}
+#endif
+};
+
+/**
+ * A read only memory mapping of a complete file. It meets the requirements of a contiguous `Container`, so it
+ * can be published directly and is passed to the output as a single chunk without being copied first. Unlike
+ * File_payload the file is only mapped once, which pays off when the same file is published repeatedly to an
+ * output without `native_handle()`.
+ */
+class Mapped_file {
+public:
+	typedef char value_type;
+
+	Mapped_file() = default;
+	/**
+	 * Maps the file.
+	 *
+	 * @param ec[out] the error code, if the file could not be mapped
+	 * @param fd the file; can be closed afterwards
+	 */
+	Mapped_file(std::error_code& ec, int fd) noexcept { map(ec, fd); }
+	Mapped_file(const Mapped_file& copy) = delete;
+	Mapped_file(Mapped_file&& move) noexcept : _data(move._data), _size(move._size)
+	{
+		move._data = nullptr;
+		move._size = 0;
+	}
+	~Mapped_file() noexcept { unmap(); }
+	void map(std::error_code& ec, int fd) noexcept
+	{
+		unmap();
+		struct stat status;
+		if (::fstat(fd, &status)) {
+			ec = detail::last_system_error();
+			return;
+		} else if (!status.st_size) {
+			return;
+		}
+
+		const auto size = static_cast<std::size_t>(status.st_size);
+		const auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			ec = detail::last_system_error();
+			return;
+		}
+		::madvise(data, size, MADV_SEQUENTIAL);
+		_data = static_cast<const char*>(data);
+		_size = size;
+	}
+	void unmap() noexcept
+	{
+		if (_data) {
+			::munmap(const_cast<char*>(_data), _size);
+			_data = nullptr;
+			_size = 0;
+		}
+	}
+	Mapped_file& operator=(const Mapped_file& copy) = delete;
+	Mapped_file& operator=(Mapped_file&& move) noexcept
+	{
+		if (this != &move) {
+			unmap();
+			std::swap(_data, move._data);
+			std::swap(_size, move._size);
+		}
+		return *this;
+	}
+	const char* data() const noexcept { return _data; }
+	const char* begin() const noexcept { return _data; }
+	const char* end() const noexcept { return _data + _size; }
+	std::size_t size() const noexcept { return _size; }
+
+private:
+	const char* _data = nullptr;
+	std::size_t _size = 0;
+};
+
+} // namespace terraqtt
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef TERRAQTT_KEEP_ALIVER_HPP_
 #define TERRAQTT_KEEP_ALIVER_HPP_
 
+#include "timer_wheel.hpp"
+
 #include <chrono>
 #include <cstdint>
 
@@ -10,7 +12,10 @@ namespace terraqtt {
 typedef std::chrono::duration<std::uint16_t> Seconds;
 
 /**
- * Keeps track of the keep-alive state of client connection. This class is not thread safe.
+ * Keeps track of the keep-alive state of client connection. Every outgoing packet counts as activity, so a
+ * PINGREQ is only needed after the connection was idle for the whole keep alive interval. Every incoming
+ * packet proves that the broker is alive and ends the ping timeout. The round-trip time of PINGREQ and
+ * PINGRESP is smoothed like the TCP estimate of RFC 6298. This class is not thread safe.
  *
  * @private
  * @tparam Clock A clock type that statisfies the Clock requirements.
@@ -28,16 +33,76 @@ public:
 		_timeout = timeout;
 		reset();
 	}
-	/// Resets the timer for the next required ping.
+	/// Sets a new timeout and resets the timer.
+	void timeout(Seconds timeout)
+	{
+		_timeout = timeout;
+		reset();
+	}
+	Seconds timeout() const noexcept { return _timeout; }
+	/**
+	 * Registers the next deadline with a timer wheel from now on, so the connection only needs to be updated
+	 * when its timer fires.
+	 *
+	 * @param[in] wheel The wheel or `nullptr` to detach.
+	 * @param context Passed through Timer_wheel::Timer::context().
+	 */
+	void attach(Timer_wheel<Clock>* wheel, void* context)
+	{
+		_timer.cancel();
+		_timer.context(context);
+		_wheel = wheel;
+		schedule();
+	}
+	/// Resets the timer for the next required ping and forgets a pending ping.
 	void reset()
 	{
 		_next_ping    = Clock::now() + _timeout;
 		_ping_timeout = typename Clock::time_point{};
+		_ping_sent    = typename Clock::time_point{};
+		schedule();
+	}
+	/// Records that a packet was sent, which postpones the next ping.
+	void sent()
+	{
+		if (_timeout != Seconds{ 0 }) {
+			_next_ping = Clock::now() + _timeout;
+			schedule();
+		}
+	}
+	/// Records that a packet was received, which ends the ping timeout.
+	void received()
+	{
+		if (_ping_timeout != typename Clock::time_point{}) {
+			_ping_timeout = typename Clock::time_point{};
+			schedule();
+		}
 	}
-	/// Marks the ping as completed.
-	void complete() { _ping_timeout = typename Clock::time_point{}; }
-	/// Starts the timeout for the required ping response from the broker.
-	void start_ping_timeout() { _ping_timeout = Clock::now() + std::chrono::seconds{ 15 }; }
+	/// Marks the ping as completed and takes a round-trip time sample.
+	void complete()
+	{
+		if (_ping_sent != typename Clock::time_point{}) {
+			_sample(Clock::now() - _ping_sent);
+			_ping_sent = typename Clock::time_point{};
+		}
+		received();
+	}
+	/// Starts the timeout for the required ping response from the broker unless one is already running.
+	void start_ping_timeout()
+	{
+		if (_ping_timeout == typename Clock::time_point{}) {
+			_ping_sent    = Clock::now();
+			_ping_timeout = _ping_sent + _ping_timeout_duration;
+			schedule();
+		}
+	}
+	typename Clock::duration ping_timeout() const noexcept { return _ping_timeout_duration; }
+	/// Sets how long to wait for any packet after a PINGREQ. Applies to the next ping.
+	void ping_timeout(typename Clock::duration timeout) noexcept { _ping_timeout_duration = timeout; }
+	/// The smoothed round-trip time or `0` without a sample.
+	typename Clock::duration smoothed_rtt() const noexcept { return _smoothed_rtt; }
+	/// The smoothed mean deviation of the round-trip time.
+	typename Clock::duration rtt_variation() const noexcept { return _rtt_variation; }
 	/// Checks whether a ping operation is required to keep the connection alive.
 	bool needs_ping() const noexcept { return _timeout != Seconds{ 0 } && Clock::now() >= _next_ping; }
 	/// Checks whether the timeout has expired.
@@ -46,11 +111,55 @@ public:
 		return _timeout != Seconds{ 0 } && _ping_timeout != typename Clock::time_point{} &&
 		       _ping_timeout < Clock::now();
 	}
+	/**
+	 * Returns the time of the next ping or of the timeout of a pending ping, whichever is earlier. Nothing
+	 * happens before then.
+	 *
+	 * @returns The deadline or `Clock::time_point::max()` if there is no timeout.
+	 */
+	typename Clock::time_point next_deadline() const noexcept
+	{
+		if (_timeout == Seconds{ 0 }) {
+			return Clock::time_point::max();
+		}
+		return _ping_timeout != typename Clock::time_point{} && _ping_timeout < _next_ping ? _ping_timeout
+		                                                                                 : _next_ping;
+	}
+	/// Schedules the timer for next_deadline() if a wheel is attached.
+	void schedule()
+	{
+		if (!_wheel) {
+			return;
+		} else if (_timeout == Seconds{ 0 }) {
+			_timer.cancel();
+		} else {
+			_wheel->schedule(_timer, next_deadline());
+		}
+	}
 
 private:
 	typename Clock::time_point _next_ping;
 	typename Clock::time_point _ping_timeout;
+	/// When the PINGREQ without PINGRESP was sent.
+	typename Clock::time_point _ping_sent;
 	Seconds _timeout;
+	typename Clock::duration _ping_timeout_duration = std::chrono::seconds{ 15 };
+	typename Clock::duration _smoothed_rtt          = Clock::duration::zero();
+	typename Clock::duration _rtt_variation         = Clock::duration::zero();
+	Timer_wheel<Clock>* _wheel = nullptr;
+	typename Timer_wheel<Clock>::Timer _timer;
+
+	void _sample(typename Clock::duration rtt) noexcept
+	{
+		if (_smoothed_rtt == Clock::duration::zero()) {
+			_smoothed_rtt  = rtt;
+			_rtt_variation = rtt / 2;
+		} else {
+			const auto deviation = rtt < _smoothed_rtt ? _smoothed_rtt - rtt : rtt - _smoothed_rtt;
+			_rtt_variation += (deviation - _rtt_variation) / 4;
+			_smoothed_rtt += (rtt - _smoothed_rtt) / 8;
+		}
+	}
 };
 
 } // namespace terraqtt
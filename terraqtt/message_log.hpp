@@ -0,0 +1,635 @@
+#ifndef TERRAQTT_MESSAGE_LOG_HPP_
+#define TERRAQTT_MESSAGE_LOG_HPP_
+
+#include "detail/system.hpp"
+#include "protocol/general.hpp"
+#include "string_view.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace terraqtt {
+
+/// Decides when a Message_log writes its changes to the disk.
+struct Commit_policy {
+	/// Commit once this many bytes were appended since the last commit.
+	std::size_t max_bytes = 256 * 1024;
+	/// Commit once the oldest change waited this long. `0` disables the deadline.
+	std::chrono::microseconds max_delay{ 10000 };
+};
+
+/// A message restored by Message_log::replay(). The strings point into the log.
+struct Log_record {
+	std::uint16_t packet_id;
+	QoS qos;
+	bool retain;
+	/// Whether a PUBREC was received, i.e. only the PUBREL is missing.
+	bool released;
+	String_view topic;
+	String_view payload;
+};
+
+/**
+ * An append-only log of outgoing QoS::at_least_once and QoS::exactly_once messages in a memory mapped ring
+ * file. Every message is appended with its topic, flags and packet identifier and its state is updated in
+ * place when it is released or acknowledged. Acknowledged records are not removed immediately, the head of
+ * the ring only moves past them when the space is needed or on commit().
+ *
+ * Since the file is mapped shared, the data is in the page cache as soon as a call returns and a crash of
+ * the process loses nothing. Only a crash of the system can lose the changes since the last commit(), which
+ * is issued by the Commit_policy in groups instead of once per message. update() checks the deadline and
+ * should be called regularly, Persistent_client does it in update_state().
+ *
+ * Records are checksummed together with their position in the ring, so torn writes and records of earlier
+ * laps end the log when it is opened again. The file is written in native byte order.
+ *
+ * @tparam Clock The clock for the commit deadline.
+ */
+template<typename Clock>
+class Message_log {
+public:
+	Message_log() = default;
+	Message_log(const Message_log& copy) = delete;
+	/// Commits and closes the log.
+	~Message_log() noexcept { close(); }
+	/**
+	 * Opens or creates the log and restores its records.
+	 *
+	 * @param ec[out] the error code, if any; `std::errc::invalid_argument` if the file is no log
+	 * @param path the file
+	 * @param capacity the size of the ring in bytes; only used if the file is created and rounded up to a
+	 * multiple of 8
+	 * @param policy the commit policy
+	 */
+	void open(std::error_code& ec, const char* path, std::size_t capacity, const Commit_policy& policy = {})
+	{
+		close();
+		_policy = policy;
+		_fd     = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		struct stat status;
+		if (_fd < 0 || ::fstat(_fd, &status)) {
+			ec = detail::last_system_error();
+			close();
+			return;
+		}
+
+		auto size = static_cast<std::size_t>(status.st_size);
+		if (!size) {
+			size = header_size + (capacity + alignment - 1) / alignment * alignment;
+			if (capacity < record_header_size || ::ftruncate(_fd, static_cast<off_t>(size))) {
+				ec = capacity < record_header_size ? std::make_error_code(std::errc::invalid_argument)
+				                                   : detail::last_system_error();
+				close();
+				return;
+			}
+		}
+
+		if (size <= header_size) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			close();
+			return;
+		}
+
+		const auto data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		if (data == MAP_FAILED) {
+			ec = detail::last_system_error();
+			close();
+			return;
+		}
+		_data = static_cast<char*>(data);
+		_size = size;
+
+		File_header header;
+		std::memcpy(&header, _data, sizeof(header));
+		if (!header.magic) {
+			header.magic    = magic;
+			header.version  = version;
+			header.capacity = size - header_size;
+			header.head     = 0;
+			std::memcpy(_data, &header, sizeof(header));
+		} else if (header.magic != magic || header.version != version ||
+		           header.capacity != size - header_size || header.capacity % alignment) {
+			ec = std::make_error_code(std::errc::invalid_argument);
+			close();
+			return;
+		}
+		_capacity = header.capacity;
+		_head     = header.head;
+		_recover();
+	}
+	/// Commits and closes the log.
+	void close() noexcept
+	{
+		if (_data) {
+			std::error_code ec;
+			commit(ec);
+			::munmap(_data, _size);
+			_data = nullptr;
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+		_positions.clear();
+		_pending = 0;
+	}
+	/**
+	 * Appends a message. Acknowledged records are compacted if the ring is full.
+	 *
+	 * @param ec[out] the error code, if any; `std::errc::no_buffer_space` if the message does not fit and
+	 * `std::errc::file_exists` if a message with the identifier is not acknowledged yet
+	 * @param packet_id the packet identifier of the message
+	 * @param qos the QoS
+	 * @param retain the retain flag
+	 * @param topic the topic
+	 * @param payload the payload; must meet the requirements of a `Container`
+	 */
+	template<typename Topic, typename Payload>
+	void append(std::error_code& ec, std::uint16_t packet_id, QoS qos, bool retain, const Topic& topic,
+	            const Payload& payload)
+	{
+		const auto topic_size = static_cast<std::size_t>(topic.size());
+		const auto size       = record_header_size + topic_size + static_cast<std::size_t>(payload.size());
+		const auto aligned    = _align(size);
+		if (!_data || !packet_id || topic_size > 0xffff || aligned > _capacity ||
+		    size > std::numeric_limits<std::uint32_t>::max()) {
+			ec = std::make_error_code(!_data ? std::errc::bad_file_descriptor : std::errc::no_buffer_space);
+			return;
+		} else if (contains(packet_id)) {
+			ec = std::make_error_code(std::errc::file_exists);
+			return;
+		}
+
+		// records never wrap around, the end of the ring is padded instead
+		auto to_end = _capacity - _tail % _capacity;
+		auto needed = aligned <= to_end ? aligned : to_end + aligned;
+		if (_capacity - (_tail - _head) < needed) {
+			_compact();
+			to_end = _capacity - _tail % _capacity;
+			needed = aligned <= to_end ? aligned : to_end + aligned;
+			if (_capacity - (_tail - _head) < needed) {
+				ec = std::make_error_code(std::errc::no_buffer_space);
+				return;
+			}
+		}
+		if (aligned > to_end) {
+			if (to_end >= record_header_size) {
+				Record_header padding{};
+				padding.size  = static_cast<std::uint32_t>(to_end);
+				padding.state = padding_record;
+				_write_header(_tail, padding);
+			}
+			_tail += to_end;
+		}
+
+		const auto record = _record(_tail);
+		std::copy(topic.begin(), topic.end(), record + record_header_size);
+		std::copy(payload.begin(), payload.end(), record + record_header_size + topic_size);
+
+		// the header comes last, so a torn record does not pass the checksum
+		Record_header header{};
+		header.size       = static_cast<std::uint32_t>(size);
+		header.packet_id  = packet_id;
+		header.topic_size = static_cast<std::uint16_t>(topic_size);
+		header.state      = pending_record;
+		header.flags      = static_cast<std::uint8_t>(static_cast<int>(qos) << 1 | retain);
+		_write_header(_tail, header);
+
+		_positions[packet_id] = _tail;
+		_tail += aligned;
+		++_pending;
+		_touch(aligned);
+		if (_appended >= _policy.max_bytes) {
+			commit(ec);
+		}
+	}
+	/// Marks the QoS::exactly_once message as released after its PUBREC was received.
+	void release(std::uint16_t packet_id) noexcept { _set_state(packet_id, released_record); }
+	/// Marks the message as delivered. Its space is reclaimed once all older records are delivered as well.
+	void acknowledge(std::uint16_t packet_id) noexcept
+	{
+		if (_set_state(packet_id, acknowledged_record)) {
+			_positions[packet_id] = none;
+			--_pending;
+		}
+	}
+	/// Whether the message is in the log and not acknowledged.
+	bool contains(std::uint16_t packet_id) const noexcept
+	{
+		return _data && _positions[packet_id] != none;
+	}
+	/**
+	 * Calls `visitor(const Log_record&)` for every unacknowledged message from the oldest to the newest.
+	 *
+	 * @param visitor the visitor
+	 */
+	template<typename Visitor>
+	void replay(Visitor&& visitor) const
+	{
+		for (auto position = _head; position < _tail;) {
+			Record_header header;
+			if (!_next_record(position, header)) {
+				continue;
+			}
+			if (header.state == pending_record || header.state == released_record) {
+				const auto record = _record(position);
+				const Log_record entry{ header.packet_id,
+					                static_cast<QoS>(header.flags >> 1 & 0x03),
+					                static_cast<bool>(header.flags & 0x01),
+					                header.state == released_record,
+					                String_view{ record + record_header_size, header.topic_size },
+					                String_view{ record + record_header_size + header.topic_size,
+					                             header.size - record_header_size - header.topic_size } };
+				visitor(entry);
+			}
+			position += _align(header.size);
+		}
+	}
+	/**
+	 * Reclaims the acknowledged records at the head and writes all changes to the disk.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void commit(std::error_code& ec) noexcept
+	{
+		if (!_data) {
+			return;
+		}
+		_compact();
+		if (_dirty && ::msync(_data, _size, MS_SYNC)) {
+			ec = detail::last_system_error();
+			return;
+		}
+		_dirty    = false;
+		_appended = 0;
+	}
+	/// Commits if the deadline of Commit_policy::max_delay expired.
+	void update(std::error_code& ec) noexcept
+	{
+		if (_dirty && _policy.max_delay.count() && Clock::now() >= deadline()) {
+			commit(ec);
+		}
+	}
+	/// The time by which the oldest uncommitted change is committed, only meaningful if dirty().
+	typename Clock::time_point deadline() const noexcept
+	{
+		return _first_change + std::chrono::duration_cast<typename Clock::duration>(_policy.max_delay);
+	}
+	/// The deadline if changes wait for it, otherwise `Clock::time_point::max()`.
+	typename Clock::time_point next_deadline() const noexcept
+	{
+		return _dirty && _policy.max_delay.count() ? deadline() : Clock::time_point::max();
+	}
+	/// Whether there are changes that were not committed yet.
+	bool dirty() const noexcept { return _dirty; }
+	bool is_open() const noexcept { return _data; }
+	/// The amount of unacknowledged messages.
+	std::size_t size() const noexcept { return _pending; }
+	/// The size of the ring in bytes.
+	std::size_t capacity() const noexcept { return _capacity; }
+	/// The bytes between the head and the tail of the ring including acknowledged records.
+	std::size_t used() const noexcept { return static_cast<std::size_t>(_tail - _head); }
+	Message_log& operator=(const Message_log& copy) = delete;
+
+private:
+	struct File_header {
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::uint64_t capacity;
+		/// The logical offset of the oldest record; the physical offset is modulo the capacity.
+		std::uint64_t head;
+	};
+
+	struct Record_header {
+		/// The size without the alignment.
+		std::uint32_t size;
+		std::uint32_t checksum;
+		std::uint16_t packet_id;
+		std::uint16_t topic_size;
+		/// Not part of the checksum, since it is changed in place.
+		std::uint8_t state;
+		std::uint8_t flags;
+		std::uint16_t reserved;
+	};
+
+	constexpr static std::uint32_t magic              = 0x4c4d5154;
+	constexpr static std::uint32_t version            = 1;
+	constexpr static std::size_t header_size          = 64;
+	constexpr static std::size_t record_header_size   = 16;
+	constexpr static std::size_t alignment            = 8;
+	constexpr static std::uint64_t none               = std::numeric_limits<std::uint64_t>::max();
+	constexpr static std::uint8_t pending_record      = 1;
+	constexpr static std::uint8_t released_record     = 2;
+	constexpr static std::uint8_t acknowledged_record = 3;
+	constexpr static std::uint8_t padding_record      = 4;
+
+	static_assert(sizeof(Record_header) == 16, "unexpected record header layout");
+	static_assert(sizeof(File_header) <= 64, "unexpected file header layout");
+
+	Commit_policy _policy;
+	int _fd                 = -1;
+	char* _data             = nullptr;
+	std::size_t _size       = 0;
+	std::uint64_t _capacity = 0;
+	std::uint64_t _head     = 0;
+	std::uint64_t _tail     = 0;
+	/// The logical offset of the record of every unacknowledged packet identifier.
+	std::vector<std::uint64_t> _positions;
+	std::size_t _pending  = 0;
+	std::size_t _appended = 0;
+	bool _dirty           = false;
+	typename Clock::time_point _first_change;
+
+	static std::uint64_t _align(std::uint64_t size) noexcept
+	{
+		return (size + alignment - 1) & ~std::uint64_t{ alignment - 1 };
+	}
+	/// FNV-1a of the record seeded with its logical offset.
+	static std::uint32_t _checksum(std::uint64_t position, const Record_header& header,
+	                               const char* body) noexcept
+	{
+		std::uint32_t hash = 2166136261u;
+		const auto feed    = [&hash](const void* data, std::size_t size) {
+			for (auto it = static_cast<const unsigned char*>(data), end = it + size; it != end; ++it) {
+				hash = (hash ^ *it) * 16777619u;
+			}
+		};
+		feed(&position, sizeof(position));
+		feed(&header.size, sizeof(header.size));
+		feed(&header.packet_id, sizeof(header.packet_id));
+		feed(&header.topic_size, sizeof(header.topic_size));
+		feed(&header.flags, sizeof(header.flags));
+		if (header.state != padding_record) {
+			feed(body, header.size - record_header_size);
+		}
+		return hash;
+	}
+	char* _record(std::uint64_t position) const noexcept
+	{
+		return _data + header_size + position % _capacity;
+	}
+	void _write_header(std::uint64_t position, Record_header& header) noexcept
+	{
+		const auto record = _record(position);
+		header.checksum   = _checksum(position, header, record + record_header_size);
+		std::memcpy(record, &header, sizeof(header));
+	}
+	/**
+	 * Reads the header at `position` if the ring has room for one there, otherwise or for padding `position`
+	 * moves to the next lap.
+	 */
+	bool _next_record(std::uint64_t& position, Record_header& header) const noexcept
+	{
+		const auto to_end = _capacity - position % _capacity;
+		if (to_end < record_header_size) {
+			position += to_end;
+			return false;
+		}
+		std::memcpy(&header, _record(position), sizeof(header));
+		if (header.state == padding_record) {
+			position += to_end;
+			return false;
+		}
+		return true;
+	}
+	/// Finds the tail by validating the records after the head and rebuilds the index.
+	void _recover()
+	{
+		_positions.assign(0x10000, std::uint64_t{ none });
+		_pending = 0;
+		_tail    = _head;
+		while (_tail - _head < _capacity) {
+			const auto to_end = _capacity - _tail % _capacity;
+			if (to_end < record_header_size) {
+				_tail += to_end;
+				continue;
+			}
+
+			Record_header header;
+			const auto record = _record(_tail);
+			std::memcpy(&header, record, sizeof(header));
+			if (header.size < record_header_size || header.size > to_end || !header.state ||
+			    header.state > padding_record ||
+			    header.topic_size > header.size - record_header_size ||
+			    header.checksum != _checksum(_tail, header, record + record_header_size)) {
+				break;
+			} else if (header.state == padding_record) {
+				_tail += to_end;
+				continue;
+			} else if (header.state == pending_record || header.state == released_record) {
+				if (_positions[header.packet_id] == none) {
+					++_pending;
+				}
+				_positions[header.packet_id] = _tail;
+			}
+			_tail += _align(header.size);
+		}
+		_dirty    = false;
+		_appended = 0;
+	}
+	/// Moves the head past the acknowledged records.
+	void _compact() noexcept
+	{
+		const auto head = _head;
+		while (_head < _tail) {
+			Record_header header;
+			if (!_next_record(_head, header)) {
+				continue;
+			} else if (header.state != acknowledged_record) {
+				break;
+			}
+			_head += _align(header.size);
+		}
+		if (_head > _tail) {
+			_head = _tail;
+		}
+		if (_head != head) {
+			std::memcpy(_data + offsetof(File_header, head), &_head, sizeof(_head));
+			_touch(0);
+		}
+	}
+	bool _set_state(std::uint16_t packet_id, std::uint8_t state) noexcept
+	{
+		if (!contains(packet_id)) {
+			return false;
+		}
+		_record(_positions[packet_id])[offsetof(Record_header, state)] = static_cast<char>(state);
+		_touch(0);
+		return true;
+	}
+	void _touch(std::size_t appended) noexcept
+	{
+		if (!_dirty) {
+			_dirty        = true;
+			_first_change = Clock::now();
+		}
+		_appended += appended;
+	}
+};
+
+/**
+ * Adds a Message_log to an Advanced_client. Every message with an acknowledgement is appended to the log
+ * before it is sent and its state follows the acknowledgements. A message that does not fit into the log is
+ * not sent at all. After a restart the messages are taken over with restore(). Until then their packet
+ * identifiers stay reserved, so new messages cannot be published with them.
+ *
+ * @code{.cpp}
+ * Message_log<std::chrono::steady_clock> log;
+ * log.open(ec, "outbox.log", 4 * 1024 * 1024);
+ * Persistent_client<Advanced_client<...>> client{ log, input, output };
+ * client.connect(ec, "id", false, std::chrono::seconds{ 30 });
+ * // after the CONNACK
+ * client.restore(ec);
+ * @endcode
+ *
+ * @tparam Client The Advanced_client type.
+ */
+template<typename Client>
+class Persistent_client : public Client {
+public:
+	typedef Message_log<typename Client::Clock_type> Log;
+
+	/**
+	 * Constructor. Reserves the packet identifiers of the unacknowledged messages in the log.
+	 *
+	 * @param[in] log The open log. Must outlive the client.
+	 * @param args The arguments for the client.
+	 */
+	template<typename... Args>
+	Persistent_client(Log& log, Args&&... args) : Client{ std::forward<Args>(args)... }, _log(log)
+	{
+		_log.replay([this](const Log_record& record) { this->acquire_packet_identifier(record.packet_id); });
+	}
+#if defined(__cpp_exceptions)
+	template<typename Topic, typename Payload>
+	std::uint16_t publish(const Topic& topic, const Payload& payload, QoS qos = QoS::at_most_once,
+	                      bool retain = false)
+	{
+		std::error_code ec;
+		const auto id = publish(ec, topic, payload, qos, retain);
+		return ec ? throw std::system_error{ ec } : id;
+	}
+#endif
+	/**
+	 * Appends the payload to the log and publishes it. If the log cannot take it, nothing is sent and no
+	 * identifier is used.
+	 *
+	 * @param ec[out] the error code, if any; see Advanced_client::publish() and Message_log::append()
+	 * @param topic the topic
+	 * @param payload the payload; must meet the requirements of a `Container`
+	 * @param qos the QoS
+	 * @param retain whether the payload should be stored on the broker
+	 * @returns The allocated packet identifier or `0` for QoS::at_most_once and if it could not be sent.
+	 */
+	template<typename Topic, typename Payload>
+	std::uint16_t publish(std::error_code& ec, const Topic& topic, const Payload& payload,
+	                      QoS qos = QoS::at_most_once, bool retain = false)
+	{
+		_logged       = 0;
+		const auto id = Client::publish(ec, topic, payload, qos, retain);
+		// the message was logged but could not be sent
+		if (!id && _logged) {
+			_log.acknowledge(_logged);
+		}
+		return id;
+	}
+#if defined(__cpp_exceptions)
+	void restore()
+	{
+		std::error_code ec;
+		if (restore(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Sends every message of the log that is not in flight again with Advanced_client::resume(). Should be
+	 * called after the CONNACK of a connection without a clean session.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void restore(std::error_code& ec)
+	{
+		_log.replay([&](const Log_record& record) {
+			if (!ec && !this->is_in_flight(record.packet_id)) {
+				this->release_packet_identifier(record.packet_id);
+				this->resume(ec, record.packet_id, record.topic, record.payload, record.qos, record.retain,
+				             record.released);
+			}
+		});
+	}
+#if defined(__cpp_exceptions)
+	void update_state()
+	{
+		std::error_code ec;
+		if (update_state(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Updates the state of the client and commits the log if its deadline expired.
+	 *
+	 * @param ec[out] the error code, if any
+	 */
+	void update_state(std::error_code& ec)
+	{
+		if (Client::update_state(ec), !ec) {
+			_log.update(ec);
+		}
+	}
+	/// Includes the commit deadline of the log.
+	typename Client::Clock_type::time_point next_deadline() const override
+	{
+		return std::min(Client::next_deadline(), _log.next_deadline());
+	}
+	Log& log() noexcept { return _log; }
+
+protected:
+	/// Appends the message to the log before it is sent. Overrides must call this.
+	void on_publishing(std::error_code& ec, std::uint16_t packet_id, const typename Client::String_type& topic,
+	                   const typename Client::String_type& payload, QoS qos, bool retain) override
+	{
+		const auto pending = _log.contains(packet_id);
+		_log.append(ec, packet_id, qos, retain, topic, payload);
+		// a failed commit leaves the record in the log
+		if (!pending && _log.contains(packet_id)) {
+			_logged = packet_id;
+		}
+		if (!ec) {
+			Client::on_publishing(ec, packet_id, topic, payload, qos, retain);
+		}
+	}
+	void on_released(std::error_code& ec, std::uint16_t packet_id) override
+	{
+		_log.release(packet_id);
+		Client::on_released(ec, packet_id);
+	}
+	/// Acknowledges the message in the log. Overrides must call this.
+	void on_delivered(std::error_code& ec, std::uint16_t packet_id) override
+	{
+		_log.acknowledge(packet_id);
+		Client::on_delivered(ec, packet_id);
+	}
+
+private:
+	Log& _log;
+	/// The message of the current publish() that was appended to the log.
+	std::uint16_t _logged = 0;
+};
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef TERRAQTT_PACKET_BATCH_HPP_
+#define TERRAQTT_PACKET_BATCH_HPP_
+
+#include "detail/container.hpp"
+#include "protocol/connection.hpp"
+#include "protocol/ping.hpp"
+#include "protocol/publishing.hpp"
+#include "protocol/subscription.hpp"
+#include "protocol/writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * Writes into memory that was sized in advance.
+ *
+ * @private
+ */
+class Memory_output {
+public:
+	typedef char char_type;
+
+	Memory_output(char* first, char* last) noexcept : _position(first), _last(last) {}
+	Memory_output& write(const char_type* data, std::size_t size) noexcept
+	{
+		_copy(data, size);
+		return *this;
+	}
+	Memory_output& writev(const protocol::Chunk* chunks, std::size_t count) noexcept
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			_copy(chunks[i].data, chunks[i].size);
+		}
+		return *this;
+	}
+	char* position() const noexcept { return _position; }
+	explicit operator bool() const noexcept { return _good; }
+
+private:
+	char* _position;
+	char* _last;
+	bool _good = true;
+
+	void _copy(const void* data, std::size_t size) noexcept
+	{
+		if (size > static_cast<std::size_t>(_last - _position)) {
+			_good = false;
+		} else if (size) {
+			std::memcpy(_position, data, size);
+			_position += size;
+		}
+	}
+};
+
+} // namespace detail
+
+/**
+ * Encodes many packets back to back into one contiguous buffer owned by the caller, so they can be handed to
+ * the output with a single write. The exact size of every packet is computed with protocol::packet_size()
+ * before it is encoded, so the buffer grows at most once per packet and fixed size buffers like
+ * Static_container are never overrun.
+ *
+ * The offset of every packet is recorded. After a partial write packet_index() tells which packet was cut
+ * and write_batch() resumes at any byte offset.
+ *
+ * @code{.cpp}
+ * std::vector<char> buffer;
+ * Packet_batch<std::vector<char>> batch{ buffer };
+ * for (const auto& message : backlog) {
+ *   batch.append(ec, protocol::Publish_header<const std::string&>{ message.topic }, message.payload);
+ * }
+ * write_batch(output, ec, batch);
+ * @endcode
+ *
+ * @tparam Buffer The buffer type. Must be contiguous, support `resize()` and hold bytes.
+ * @tparam Offsets The container for the packet offsets. Must support `push_back()` and random access.
+ */
+template<typename Buffer, typename Offsets = std::vector<std::size_t>>
+class Packet_batch {
+public:
+	static_assert(detail::Is_contiguous<Buffer>::value && detail::Is_resizable<Buffer>::value,
+	              "buffer must be contiguous and resizable");
+	static_assert(sizeof(typename Buffer::value_type) == 1, "buffer must hold bytes");
+
+	/**
+	 * Constructor. Packets are appended after the current content of the buffer.
+	 *
+	 * @param[in] buffer The buffer. Must outlive this object.
+	 */
+	Packet_batch(Buffer& buffer) noexcept : _buffer(buffer), _base(buffer.size()) {}
+#if defined(__cpp_exceptions)
+	template<typename Header, typename... Payload>
+	void append(const Header& header, const Payload&... payload)
+	{
+		std::error_code ec;
+		if (append(ec, header, payload...), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Encodes a packet at the end of the batch. On error the batch is left unchanged.
+	 *
+	 * @param[out] ec The error code if any. `std::errc::not_enough_memory` if the buffer or the offsets
+	 * cannot hold the packet.
+	 * @param header The header of any packet that can be written with protocol::write_packet().
+	 * @param payload The payload if the header requires one.
+	 */
+	template<typename Header, typename... Payload>
+	void append(std::error_code& ec, const Header& header, const Payload&... payload)
+	{
+		const auto size = protocol::packet_size(ec, header, payload...);
+		if (ec) {
+			return;
+		}
+
+		const auto offset = _buffer.size();
+		if (size > _buffer.max_size() - offset || _offsets.size() >= _offsets.max_size()) {
+			ec = std::make_error_code(std::errc::not_enough_memory);
+			return;
+		}
+
+		_buffer.resize(offset + size);
+		const auto first = reinterpret_cast<char*>(detail::contiguous_data(_buffer));
+		detail::Memory_output output{ first + offset, first + offset + size };
+		protocol::write_packet(output, ec, header, payload...);
+		if (ec || output.position() != first + offset + size) {
+			if (!ec) {
+				ec = std::make_error_code(std::errc::io_error);
+			}
+			_buffer.resize(offset);
+			return;
+		}
+		_offsets.push_back(offset - _base);
+	}
+	/// Removes all packets from the buffer.
+	void clear()
+	{
+		_buffer.resize(_base);
+		detail::clear(_offsets);
+	}
+	/// The first byte of the batch.
+	const char* data() const noexcept
+	{
+		return reinterpret_cast<const char*>(detail::contiguous_data(_buffer)) + _base;
+	}
+	/// The size of all packets in bytes.
+	std::size_t bytes() const noexcept { return _buffer.size() - _base; }
+	/// The amount of packets.
+	std::size_t size() const noexcept { return _offsets.size(); }
+	bool empty() const noexcept { return !_offsets.size(); }
+	/**
+	 * Returns where a packet starts.
+	 *
+	 * @param index The index of the packet. If it equals size(), bytes() is returned.
+	 * @returns The offset relative to data().
+	 */
+	std::size_t offset(std::size_t index) const noexcept
+	{
+		return index < _offsets.size() ? _offsets[index] : bytes();
+	}
+	/**
+	 * Returns the packet containing the byte, for example the packet that was cut by a partial write.
+	 *
+	 * @param byte_offset The offset relative to data().
+	 * @returns The index of the packet or size() if the offset is not within the batch.
+	 */
+	std::size_t packet_index(std::size_t byte_offset) const noexcept
+	{
+		if (byte_offset >= bytes()) {
+			return size();
+		}
+		const auto first = _offsets.begin();
+		return static_cast<std::size_t>(std::upper_bound(first, _offsets.end(), byte_offset) - first) - 1;
+	}
+
+private:
+	Buffer& _buffer;
+	/// The size of the buffer before the first packet.
+	std::size_t _base;
+	Offsets _offsets;
+};
+
+/**
+ * Writes the packets of a batch with a single write call.
+ *
+ * @param output[in] the output stream
+ * @param ec[out] the error code, if the output fails
+ * @param batch the batch
+ * @param byte_offset where to start; allows resuming after a partial write
+ */
+template<typename Output, typename Buffer, typename Offsets>
+inline void write_batch(Output& output, std::error_code& ec, const Packet_batch<Buffer, Offsets>& batch,
+                        std::size_t byte_offset = 0)
+{
+	if (byte_offset < batch.bytes()) {
+		output.write(reinterpret_cast<const typename Output::char_type*>(batch.data() + byte_offset),
+		             batch.bytes() - byte_offset);
+		if (!output) {
+			ec = std::make_error_code(std::errc::io_error);
+		}
+	}
+}
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef TERRAQTT_PACKET_IDENTIFIER_SET_HPP_
+#define TERRAQTT_PACKET_IDENTIFIER_SET_HPP_
+
+#include "detail/bits.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace terraqtt {
+
+/**
+ * A bitmap of the packet identifiers in use. Identifiers are handed out round robin, so a released
+ * identifier is not reused immediately which keeps late acknowledgements from matching a new packet. All
+ * operations are constant time and the set does not allocate.
+ */
+class Packet_identifier_set {
+public:
+	/// The highest possible packet identifier.
+	constexpr static std::size_t max_capacity = 65535;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param capacity Only the identifiers `1` to `capacity` are handed out. Clamped to max_capacity.
+	 */
+	Packet_identifier_set(std::size_t capacity = max_capacity) noexcept
+	    : _capacity(capacity < max_capacity ? capacity : std::size_t{ max_capacity })
+	{
+		// mark the identifiers that are out of range as used
+		_words[0] = 1;
+		for (std::size_t id = _capacity + 1; id <= max_capacity; ++id) {
+			_words[id / 64] |= std::uint64_t{ 1 } << id % 64;
+		}
+		for (std::size_t i = 0; i < word_count; ++i) {
+			_update_summary(i);
+		}
+	}
+	/**
+	 * Reserves the next free identifier.
+	 *
+	 * @returns The identifier or `0` if all are in use.
+	 */
+	std::uint16_t acquire() noexcept
+	{
+		if (_size == _capacity) {
+			return 0;
+		}
+
+		// the rest of the current word and then every word with a free bit in the summary
+		auto word = _next / 64;
+		auto free = ~_words[word] & (~std::uint64_t{ 0 } << _next % 64);
+		if (!free) {
+			word = _next_free_word(word + 1);
+			free = ~_words[word];
+		}
+
+		const auto id = static_cast<std::uint16_t>(word * 64 + detail::lowest_bit(free));
+		_insert(id);
+		const auto next = static_cast<std::size_t>(id) + 1;
+		_next           = next < word_count * 64 ? next : 0;
+		return id;
+	}
+	/**
+	 * Reserves a specific identifier.
+	 *
+	 * @returns `false` if the identifier is already in use or out of range.
+	 */
+	bool acquire(std::uint16_t id) noexcept
+	{
+		if (!id || id > _capacity || _test(id)) {
+			return false;
+		}
+		_insert(id);
+		return true;
+	}
+	/// Releases the identifier if it is in use.
+	void release(std::uint16_t id) noexcept
+	{
+		if (contains(id)) {
+			_words[id / 64] &= ~(std::uint64_t{ 1 } << id % 64);
+			_full[id / 64 / 64] &= ~(std::uint64_t{ 1 } << id / 64 % 64);
+			--_size;
+		}
+	}
+	bool contains(std::uint16_t id) const noexcept { return id && id <= _capacity && _test(id); }
+	/// The amount of identifiers in use.
+	std::size_t size() const noexcept { return _size; }
+	std::size_t capacity() const noexcept { return _capacity; }
+	bool empty() const noexcept { return !_size; }
+	bool full() const noexcept { return _size == _capacity; }
+
+private:
+	constexpr static std::size_t word_count = (max_capacity + 1) / 64;
+
+	std::uint64_t _words[word_count]{};
+	/// One bit per word that has no free identifier left.
+	std::uint64_t _full[word_count / 64]{};
+	std::size_t _capacity;
+	std::size_t _size = 0;
+	/// Where the search for the next identifier starts.
+	std::size_t _next = 1;
+
+	bool _test(std::uint16_t id) const noexcept { return _words[id / 64] >> id % 64 & 1; }
+	void _insert(std::uint16_t id) noexcept
+	{
+		_words[id / 64] |= std::uint64_t{ 1 } << id % 64;
+		_update_summary(id / 64);
+		++_size;
+	}
+	void _update_summary(std::size_t word) noexcept
+	{
+		if (!~_words[word]) {
+			_full[word / 64] |= std::uint64_t{ 1 } << word % 64;
+		}
+	}
+	/// Finds the next word with a free bit starting at `word` and wrapping around. One must exist.
+	std::size_t _next_free_word(std::size_t word) const noexcept
+	{
+		for (std::size_t i = 0; i <= word_count / 64; ++i) {
+			const auto summary = (word / 64 + i) % (word_count / 64);
+			auto free          = ~_full[summary];
+			if (!i) {
+				free &= ~std::uint64_t{ 0 } << word % 64;
+			}
+			if (free) {
+				return summary * 64 + detail::lowest_bit(free);
+			}
+		}
+		return 0;
+	}
+};
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef TERRAQTT_PRODUCED_PAYLOAD_HPP_
+#define TERRAQTT_PRODUCED_PAYLOAD_HPP_
+
+#include <cstddef>
+#include <istream>
+#include <utility>
+
+namespace terraqtt {
+
+/**
+ * A payload of known size whose bytes are produced while the packet is written instead of being held in
+ * memory. The payload is written in chunks of at most `Chunk_size` bytes from a buffer on the stack, so the
+ * memory usage does not depend on the size of the payload.
+ *
+ * The producer is called with a buffer and its size and returns how many bytes it filled in. Returning `0`
+ * before `size()` bytes were produced fails the write with Error::payload_size_mismatch. Because the header
+ * was already written at this point, the connection should be closed.
+ *
+ * @code{.cpp}
+ * std::ifstream file{ "firmware.bin", std::ios::binary };
+ * client.publish(ec, String_view{ "devices/42/firmware" }, stream_payload(firmware_size, file));
+ * @endcode
+ *
+ * @tparam Producer A callable like `std::size_t(char* buffer, std::size_t size)`.
+ * @tparam Chunk_size The maximum amount of bytes produced at once.
+ */
+template<typename Producer, std::size_t Chunk_size = 4096>
+class Produced_payload {
+public:
+	static_assert(Chunk_size > 0, "chunk size must be positive");
+
+	constexpr static std::size_t chunk_size = Chunk_size;
+
+	Produced_payload(std::size_t size, Producer producer) : _size(size), _producer(std::move(producer)) {}
+	/// The size in bytes of the complete payload.
+	std::size_t size() const noexcept { return _size; }
+	/// Produces at most `size` bytes into the buffer.
+	std::size_t produce(char* buffer, std::size_t size) const { return _producer(buffer, size); }
+
+private:
+	std::size_t _size;
+	mutable Producer _producer;
+};
+
+template<typename Producer, std::size_t Chunk_size>
+constexpr std::size_t Produced_payload<Producer, Chunk_size>::chunk_size;
+
+namespace detail {
+
+/**
+ * Reads the payload from a stream.
+ *
+ * @private
+ */
+template<typename Char, typename Traits>
+class Stream_producer {
+public:
+	static_assert(sizeof(Char) == 1, "stream must consist of bytes");
+
+	Stream_producer(std::basic_istream<Char, Traits>& stream) noexcept : _stream(&stream) {}
+	std::size_t operator()(char* buffer, std::size_t size)
+	{
+		_stream->read(reinterpret_cast<Char*>(buffer), static_cast<std::streamsize>(size));
+		return static_cast<std::size_t>(_stream->gcount());
+	}
+
+private:
+	std::basic_istream<Char, Traits>* _stream;
+};
+
+/**
+ * Copies the payload from an input iterator range.
+ *
+ * @private
+ */
+template<typename Iterator>
+class Iterator_producer {
+public:
+	Iterator_producer(Iterator first, Iterator last) : _first(std::move(first)), _last(std::move(last)) {}
+	std::size_t operator()(char* buffer, std::size_t size)
+	{
+		std::size_t count = 0;
+		for (; count < size && _first != _last; ++count, ++_first) {
+			buffer[count] = static_cast<char>(*_first);
+		}
+		return count;
+	}
+
+private:
+	Iterator _first;
+	Iterator _last;
+};
+
+} // namespace detail
+
+/**
+ * Creates a payload produced by a callable.
+ *
+ * @param size the size of the payload in bytes
+ * @param producer the producer; see Produced_payload
+ */
+template<std::size_t Chunk_size = 4096, typename Producer>
+inline Produced_payload<Producer, Chunk_size> produced_payload(std::size_t size, Producer producer)
+{
+	return { size, std::move(producer) };
+}
+
+/**
+ * Creates a payload read from a stream. Only `size` bytes are read.
+ *
+ * @param size the size of the payload in bytes
+ * @param stream the stream; must outlive the payload
+ */
+template<std::size_t Chunk_size = 4096, typename Char, typename Traits>
+inline Produced_payload<detail::Stream_producer<Char, Traits>, Chunk_size>
+  stream_payload(std::size_t size, std::basic_istream<Char, Traits>& stream)
+{
+	return { size, detail::Stream_producer<Char, Traits>{ stream } };
+}
+
+/**
+ * Creates a payload copied from an input iterator range, for example `std::istreambuf_iterator`.
+ *
+ * @param size the size of the payload in bytes; the range must hold at least this many elements
+ * @param first the first element
+ * @param last the end of the range
+ */
+template<std::size_t Chunk_size = 4096, typename Iterator>
+inline Produced_payload<detail::Iterator_producer<Iterator>, Chunk_size>
+  iterator_payload(std::size_t size, Iterator first, Iterator last)
+{
+	return { size, detail::Iterator_producer<Iterator>{ std::move(first), std::move(last) } };
+}
+
+} // namespace terraqtt
+
+#endif
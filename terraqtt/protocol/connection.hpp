@@ -41,38 +41,69 @@ struct Connack_header {
 
 struct Disconnect_header {};
 
-template<typename Output, typename String, typename Will_message, typename Password>
-inline void write_packet(Output& output, std::error_code& ec,
-                         const Connect_header<String, Will_message, Password>& header)
+/**
+ * Validates a connect header and computes the remaining length of its packet.
+ *
+ * @param ec[out] the error code, if the header is invalid or the packet is too large
+ * @param header the connect header
+ * @return the remaining length
+ */
+template<typename String, typename Will_message, typename Password>
+inline Variable_integer_type remaining_length(std::error_code& ec,
+                                              const Connect_header<String, Will_message, Password>& header)
 {
 	if (!header.will && (header.will_qos != QoS::at_most_once || header.will_retain)) {
 		ec = Error::bad_will;
-		return;
+		return 0;
 	} else if (!header.username && header.password) {
 		ec = Error::bad_username_password;
-		return;
+		return 0;
 	} else if (!header.clean_session && !header.client_identifier.size()) {
 		ec = Error::empty_client_identifier;
-		return;
+		return 0;
 	}
 
 	// fixed header & protocol name & level & connect flags
-	typename std::underlying_type<Variable_integer>::type remaining =
+	Variable_integer_type remaining =
 	  12 + (header.will ? 4 : 0) + (header.username ? 2 : 0) + (header.password ? 2 : 0);
-	const auto protocol_level = Byte{ 0x04 };
-	const auto connect_flags  = static_cast<Byte>(
-    (header.username ? 0x80 : 0x00) | (header.password ? 0x40 : 0x00) | (header.will_retain << 5) |
-    (static_cast<int>(header.will_qos) << 3) | (header.will ? 0x04 : 0x00) | (header.clean_session << 1));
-
 	if (!protected_add(remaining, header.client_identifier.size()) ||
 	    (header.will && !protected_add(remaining, header.will->first.size())) ||
 	    (header.will && !protected_add(remaining, header.will->second.size())) ||
 	    (header.username && !protected_add(remaining, header.username->size())) ||
 	    (header.password && !protected_add(remaining, header.password->size()))) {
 		ec = Error::payload_too_large;
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded connect packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param header the connect header
+ * @return the size in bytes or `0` on error
+ */
+template<typename String, typename Will_message, typename Password>
+inline std::size_t packet_size(std::error_code& ec,
+                               const Connect_header<String, Will_message, Password>& header)
+{
+	return encoded_size(ec, remaining_length(ec, header));
+}
+
+template<typename Output, typename String, typename Will_message, typename Password>
+inline void write_packet(Output& output, std::error_code& ec,
+                         const Connect_header<String, Will_message, Password>& header)
+{
+	const auto remaining = remaining_length(ec, header);
+	if (ec) {
 		return;
 	}
 
+	const auto protocol_level = Byte{ 0x04 };
+	const auto connect_flags  = static_cast<Byte>(
+    (header.username ? 0x80 : 0x00) | (header.password ? 0x40 : 0x00) | (header.will_retain << 5) |
+    (static_cast<int>(header.will_qos) << 3) | (header.will ? 0x04 : 0x00) | (header.clean_session << 1));
+
 	write_elements(output, ec, Byte{ static_cast<int>(Control_packet_type::connect) << 4 },
 	               static_cast<Variable_integer>(remaining), std::uint16_t{ 4 }, Byte{ 'M' }, Byte{ 'Q' },
 	               Byte{ 'T' }, Byte{ 'T' }, protocol_level, connect_flags, header.keep_alive);
@@ -157,6 +188,11 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return true;
 }
 
+inline std::size_t packet_size(std::error_code& ec, const Disconnect_header& header) noexcept
+{
+	return 2;
+}
+
 /**
  * Writes a disconnect packet to the output stream.
  *
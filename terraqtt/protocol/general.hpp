@@ -80,6 +80,19 @@ inline bool protected_add(Left& left, Right right) noexcept
 	return true;
 }
 
+/// The largest value a variable integer can encode.
+constexpr Variable_integer_type variable_integer_max = 268435455;
+
+/**
+ * Returns how many bytes the variable integer encoding of the value needs.
+ *
+ * @param value The value. Must not be larger than #variable_integer_max.
+ */
+constexpr std::size_t variable_integer_size(Variable_integer_type value) noexcept
+{
+	return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
 } // namespace protocol
 } // namespace terraqtt
 
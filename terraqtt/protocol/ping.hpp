@@ -12,6 +12,11 @@ struct Pingreq_header {};
 
 struct Pingresp_header {};
 
+inline std::size_t packet_size(std::error_code& ec, const Pingreq_header& header) noexcept
+{
+	return 2;
+}
+
 template<typename Output>
 inline void write_packet(Output& output, std::error_code& ec, const Pingreq_header& header)
 {
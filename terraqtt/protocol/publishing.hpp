@@ -1,13 +1,94 @@
 #ifndef TERRAQTT_PROTOCOL_PUBLISHING_HPP_
 #define TERRAQTT_PROTOCOL_PUBLISHING_HPP_
 
+#include "../produced_payload.hpp"
 #include "general.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
 
+#include <cstring>
+
 namespace terraqtt {
 namespace protocol {
 
+namespace detail {
+
+/**
+ * Writes the header chunks followed by the payload. A contiguous payload is appended as another chunk.
+ *
+ * @param chunks the header chunks; must have room for one more
+ */
+template<typename Output, typename Payload>
+inline void write_payload(Output& output, std::error_code& ec, Chunk* chunks, std::size_t count,
+                          const Payload& payload, terraqtt::detail::Priority<0>)
+{
+	static_assert(sizeof(*payload.begin()) == 1, "payload must consist of bytes");
+
+	const auto payload_data = terraqtt::detail::contiguous_data(payload);
+	if (payload_data || !payload.size()) {
+		if (payload.size()) {
+			chunks[count++] = Chunk{ payload_data, payload.size() };
+		}
+		write_chunks(output, ec, chunks, count);
+	} else if (write_chunks(output, ec, chunks, count), !ec) {
+		write_blob<false>(output, ec, payload);
+	}
+}
+
+/**
+ * Streams the payload in bounded chunks. The first chunk is written together with the header chunks.
+ *
+ * @param chunks the header chunks; must have room for one more
+ */
+template<typename Output, typename Producer, std::size_t Chunk_size>
+inline void write_payload(Output& output, std::error_code& ec, Chunk* chunks, std::size_t count,
+                          const Produced_payload<Producer, Chunk_size>& payload,
+                          terraqtt::detail::Priority<1>)
+{
+	char buffer[Chunk_size];
+	auto left = payload.size();
+	do {
+		std::size_t produced = 0;
+		if (left) {
+			const auto size = std::min(left, Chunk_size);
+			produced        = payload.produce(buffer, size);
+			if (!produced || produced > size) {
+				ec = Error::payload_size_mismatch;
+				return;
+			}
+			chunks[count++] = Chunk{ buffer, produced };
+		}
+		if (write_chunks(output, ec, chunks, count), ec) {
+			return;
+		}
+		count = 0;
+		left -= produced;
+	} while (left);
+}
+
+/// Lets payloads like File_payload write themselves and the header chunks.
+template<typename Output, typename Payload>
+inline auto write_payload(Output& output, std::error_code& ec, Chunk* chunks, std::size_t count,
+                          const Payload& payload, terraqtt::detail::Priority<1>)
+  -> decltype(payload.write(output, ec, chunks, count), void())
+{
+	payload.write(output, ec, chunks, count);
+}
+
+/**
+ * Writes the header chunks followed by the payload.
+ *
+ * @param chunks the header chunks; must have room for one more
+ */
+template<typename Output, typename Payload>
+inline void write_payload(Output& output, std::error_code& ec, Chunk* chunks, std::size_t count,
+                          const Payload& payload)
+{
+	write_payload(output, ec, chunks, count, payload, terraqtt::detail::Priority<1>{});
+}
+
+} // namespace detail
+
 template<typename String>
 struct Publish_header {
 	String topic;
@@ -33,35 +114,275 @@ struct Pubcomp_header {
 	std::uint16_t packet_identifier;
 };
 
+/**
+ * Computes the remaining length of a publish packet.
+ *
+ * @param ec[out] the error code, if the topic or the packet is too large
+ * @param header the publish header
+ * @param payload the payload
+ * @return the remaining length
+ */
+template<typename String, typename Payload>
+inline Variable_integer_type remaining_length(std::error_code& ec, const Publish_header<String>& header,
+                                              const Payload& payload) noexcept
+{
+	Variable_integer_type remaining = 2 + (header.qos != QoS::at_most_once ? 2 : 0);
+	if (header.topic.size() > std::numeric_limits<std::uint16_t>::max()) {
+		ec = Error::string_too_long;
+	} else if (!protected_add(remaining, header.topic.size()) || !protected_add(remaining, payload.size())) {
+		ec = Error::payload_too_large;
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded publish packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param header the publish header
+ * @param payload the payload
+ * @return the size in bytes or `0` on error
+ */
+template<typename String, typename Payload>
+inline std::size_t packet_size(std::error_code& ec, const Publish_header<String>& header,
+                               const Payload& payload) noexcept
+{
+	return encoded_size(ec, remaining_length(ec, header, payload));
+}
+
+/**
+ * Writes a publish packet. The fixed header is encoded into a stack buffer together with the topic and the
+ * packet identifier if the topic is short. All chunks are written with a single call to write_chunks(), so a
+ * contiguous payload is written as two chunks and long contiguous topics add two more. Non contiguous topics
+ * and payloads are written element by element. A Produced_payload is streamed in bounded chunks.
+ */
 template<typename Output, typename String, typename Payload>
 inline void write_packet(Output& output, std::error_code& ec, const Publish_header<String>& header,
                          const Payload& payload)
 {
-	typename std::underlying_type<Variable_integer>::type remaining =
-	  2 + (header.qos != QoS::at_most_once ? 2 : 0);
+	static_assert(sizeof(*header.topic.begin()) == 1, "topic must consist of bytes");
 
-	if (!protected_add(remaining, header.topic.size()) || !protected_add(remaining, payload.size())) {
-		ec = Error::payload_too_large;
+	// topics up to this size are copied into the header buffer
+	constexpr std::size_t inline_topic_size = 128;
+
+	const auto remaining = remaining_length(ec, header, payload);
+	if (ec) {
 		return;
 	}
 
-	write_elements(
-	  output, ec,
+	const auto topic_size = header.topic.size();
+
+	Byte buffer[elements_max_size<Byte, Variable_integer, std::uint16_t>() + inline_topic_size + 2];
+	auto end = write_elements(
+	  buffer, ec,
 	  static_cast<Byte>(static_cast<int>(Control_packet_type::publish) << 4 |
 	                    (header.duplicate << 3 | static_cast<int>(header.qos) << 1 | header.retain)),
-	  static_cast<Variable_integer>(remaining));
-
-	if (ec || (write_blob<true>(output, ec, header.topic), ec)) {
+	  static_cast<Variable_integer>(remaining), static_cast<std::uint16_t>(topic_size));
+	if (ec) {
 		return;
 	}
 
+	Chunk chunks[4];
+	std::size_t count       = 0;
+	const auto topic_data   = terraqtt::detail::contiguous_data(header.topic);
+	const bool inline_topic = topic_size <= inline_topic_size;
+	if (inline_topic) {
+		end = std::copy(header.topic.begin(), header.topic.end(), end);
+	} else {
+		chunks[count++] = Chunk{ buffer, static_cast<std::size_t>(end - buffer) };
+		if (topic_data) {
+			chunks[count++] = Chunk{ topic_data, topic_size };
+		} else {
+			write_chunks(output, ec, chunks, count);
+			count = 0;
+			if (ec || (write_blob<false>(output, ec, header.topic), ec)) {
+				return;
+			}
+		}
+	}
+
+	// the packet identifier follows the topic
+	auto identifier = end;
 	if (header.qos != QoS::at_most_once) {
-		if (write_elements(output, ec, header.packet_identifier), ec) {
+		end = write_elements(end, ec, header.packet_identifier);
+	}
+	if (end != identifier || inline_topic) {
+		const auto first = inline_topic ? buffer : identifier;
+		chunks[count++]  = Chunk{ first, static_cast<std::size_t>(end - first) };
+	}
+
+	detail::write_payload(output, ec, chunks, count, payload);
+}
+
+/**
+ * A pre-encoded publish packet for a fixed topic, QoS and retain flag. The flags byte and the topic block
+ * with its size prefix are encoded once, so writing a message only encodes the remaining length and the
+ * packet identifier.
+ *
+ * @code{.cpp}
+ * protocol::Publish_template<std::string> temperature{ String_view{ "sensors/temperature" } };
+ * protocol::write_packet(output, ec, temperature, payload);
+ * @endcode
+ *
+ * @tparam Container The storage of the topic block. Must be contiguous and support `push_back()`, like
+ * `std::string` or Static_container.
+ */
+template<typename Container>
+class Publish_template {
+public:
+	static_assert(terraqtt::detail::Is_contiguous<Container>::value, "container must be contiguous");
+
+	Publish_template() = default;
+#if defined(__cpp_exceptions)
+	template<typename Topic>
+	Publish_template(const Topic& topic, QoS qos = QoS::at_most_once, bool retain = false)
+	{
+		assign(topic, qos, retain);
+	}
+	template<typename Topic>
+	void assign(const Topic& topic, QoS qos = QoS::at_most_once, bool retain = false)
+	{
+		std::error_code ec;
+		if (assign(ec, topic, qos, retain), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Encodes the topic and the flags.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param topic The topic. Must meet the requirements of a `Container`.
+	 * @param qos The QoS of all messages.
+	 * @param retain Whether the messages should be stored by the broker.
+	 */
+	template<typename Topic>
+	void assign(std::error_code& ec, const Topic& topic, QoS qos = QoS::at_most_once, bool retain = false)
+	{
+		terraqtt::detail::clear(_block);
+		_body_size = 0;
+
+		const auto size = topic.size();
+		if (size > std::numeric_limits<std::uint16_t>::max()) {
+			ec = Error::string_too_long;
+			return;
+		} else if (size + 2 > _block.max_size()) {
+			ec = std::make_error_code(std::errc::not_enough_memory);
 			return;
 		}
+
+		_block.push_back(static_cast<typename Container::value_type>(size >> 8));
+		_block.push_back(static_cast<typename Container::value_type>(size & 0xff));
+		for (const auto c : topic) {
+			_block.push_back(static_cast<typename Container::value_type>(c));
+		}
+		_flags     = static_cast<Byte>(static_cast<int>(Control_packet_type::publish) << 4 |
+		                              static_cast<int>(qos) << 1 | retain);
+		_body_size = static_cast<Variable_integer_type>(size + 2 + (qos != QoS::at_most_once ? 2 : 0));
+	}
+	QoS qos() const noexcept { return static_cast<QoS>(_flags >> 1 & 0x03); }
+	bool retain() const noexcept { return _flags & 1; }
+	/// Whether assign() succeeded.
+	bool valid() const noexcept { return _body_size; }
+	/// The encoded flags byte without the duplicate flag.
+	Byte flags() const noexcept { return _flags; }
+	/// The encoded topic with its size prefix.
+	const Container& topic_block() const noexcept { return _block; }
+	/// The size of the variable header.
+	Variable_integer_type variable_header_size() const noexcept { return _body_size; }
+
+private:
+	Container _block;
+	Byte _flags                      = 0;
+	Variable_integer_type _body_size = 0;
+};
+
+/**
+ * Computes the remaining length of a publish packet written from a template.
+ *
+ * @param ec[out] the error code, if the template is not assigned or the packet is too large
+ * @param publish the template
+ * @param payload the payload
+ * @return the remaining length
+ */
+template<typename Container, typename Payload>
+inline Variable_integer_type remaining_length(std::error_code& ec, const Publish_template<Container>& publish,
+                                              const Payload& payload) noexcept
+{
+	auto remaining = publish.variable_header_size();
+	if (!remaining) {
+		ec = std::make_error_code(std::errc::invalid_argument);
+	} else if (!protected_add(remaining, payload.size())) {
+		ec = Error::payload_too_large;
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded publish packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param publish the template
+ * @param payload the payload
+ * @return the size in bytes or `0` on error
+ */
+template<typename Container, typename Payload>
+inline std::size_t packet_size(std::error_code& ec, const Publish_template<Container>& publish,
+                               const Payload& payload) noexcept
+{
+	return encoded_size(ec, remaining_length(ec, publish, payload));
+}
+
+/**
+ * Writes a publish packet from a template with a single call to write_chunks().
+ *
+ * @param output[in] the output stream
+ * @param ec[out] the error code, if any
+ * @param publish the assigned template
+ * @param payload the payload; must meet the requirements of a `Container` or be a Produced_payload
+ * @param packet_identifier the packet identifier; only written if the QoS is not QoS::at_most_once
+ * @param duplicate whether this is a redelivery
+ */
+template<typename Output, typename Container, typename Payload>
+inline void write_packet(Output& output, std::error_code& ec, const Publish_template<Container>& publish,
+                         const Payload& payload, std::uint16_t packet_identifier = 0, bool duplicate = false)
+{
+	const auto remaining = remaining_length(ec, publish, payload);
+	if (ec) {
+		return;
 	}
 
-	write_blob<false>(output, ec, payload);
+	// short topic blocks are copied next to the header to save chunks
+	constexpr std::size_t inline_block_size = 128;
+	Byte buffer[elements_max_size<Byte, Variable_integer>() + inline_block_size + 2];
+	auto end = write_elements(buffer, ec, static_cast<Byte>(publish.flags() | duplicate << 3),
+	                          static_cast<Variable_integer>(remaining));
+	if (ec) {
+		return;
+	}
+
+	const auto& block     = publish.topic_block();
+	const auto block_data = terraqtt::detail::contiguous_data(block);
+	Chunk chunks[4];
+	std::size_t count = 0;
+	if (block.size() <= inline_block_size) {
+		std::memcpy(end, block_data, block.size());
+		end += block.size();
+	} else {
+		chunks[count++] = Chunk{ buffer, static_cast<std::size_t>(end - buffer) };
+		chunks[count++] = Chunk{ block_data, block.size() };
+	}
+
+	const auto identifier = end;
+	if (publish.qos() != QoS::at_most_once) {
+		end = write_elements(end, ec, packet_identifier);
+	}
+	if (!count || end != identifier) {
+		const auto first = count ? identifier : buffer;
+		chunks[count++]  = Chunk{ first, static_cast<std::size_t>(end - first) };
+	}
+
+	detail::write_payload(output, ec, chunks, count, payload);
 }
 
 template<typename Input, typename String>
@@ -105,6 +426,11 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return true;
 }
 
+inline std::size_t packet_size(std::error_code& ec, const Puback_header& header) noexcept
+{
+	return 4;
+}
+
 template<typename Output>
 inline void write_packet(Output& output, std::error_code& ec, const Puback_header& header)
 {
@@ -139,6 +465,11 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return read_element(input, ec, context, header.packet_identifier);
 }
 
+inline std::size_t packet_size(std::error_code& ec, const Pubrec_header& header) noexcept
+{
+	return 4;
+}
+
 template<typename Output>
 inline void write_packet(Output& output, std::error_code& ec, const Pubrec_header& header)
 {
@@ -173,10 +504,15 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return read_element(input, ec, context, header.packet_identifier);
 }
 
+inline std::size_t packet_size(std::error_code& ec, const pubrel_header& header) noexcept
+{
+	return 4;
+}
+
 template<typename Output>
 inline void write_packet(Output& output, std::error_code& ec, const pubrel_header& header)
 {
-	write_elements(output, ec, static_cast<Byte>(static_cast<int>(Control_packet_type::pubrel) << 4),
+	write_elements(output, ec, static_cast<Byte>(static_cast<int>(Control_packet_type::pubrel) << 4 | 0x02),
 	               static_cast<Variable_integer>(2), header.packet_identifier);
 }
 
@@ -187,7 +523,7 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 		Byte type;
 		if (!read_element(input, ec, context, type) || ec) {
 			return false;
-		} else if (type != static_cast<Byte>(static_cast<int>(Control_packet_type::pubrel) << 4)) {
+		} else if (type != static_cast<Byte>(static_cast<int>(Control_packet_type::pubrel) << 4 | 0x02)) {
 			ec = Error::bad_pubrel_flags;
 			return false;
 		}
@@ -207,6 +543,11 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return read_element(input, ec, context, header.packet_identifier);
 }
 
+inline std::size_t packet_size(std::error_code& ec, const Pubcomp_header& header) noexcept
+{
+	return 4;
+}
+
 template<typename Output>
 inline void write_packet(Output& output, std::error_code& ec, const Pubcomp_header& header)
 {
@@ -1,9 +1,12 @@
 #ifndef TERRAQTT_PROTOCOL_READER_HPP_
 #define TERRAQTT_PROTOCOL_READER_HPP_
 
+#include "../detail/container.hpp"
 #include "../error.hpp"
 #include "general.hpp"
 
+#include <algorithm>
+#include <ios>
 #include <type_traits>
 #include <utility>
 
@@ -66,7 +69,10 @@ inline bool read_element(Input& input, std::error_code& ec, Read_context& contex
 		return false;
 	}
 
-	out                      = buffer[0] << 8 | buffer[1];
+	// the buffer holds raw bytes in network order
+	const auto high          = static_cast<Byte>(buffer[0]);
+	const auto low           = static_cast<Byte>(buffer[1]);
+	out                      = static_cast<std::uint16_t>(high << 8 | low);
 	context.sequence_data[0] = 0;
 	context.sequence_data[1] = 0;
 	++context.sequence;
@@ -114,20 +120,42 @@ inline bool read_element(Input& input, std::error_code& ec, Read_context& contex
 	return true;
 }
 
+namespace detail {
+
+/// Reads the next chunk of the blob with a single call by extending the blob once.
 template<typename Input, typename Blob>
-inline bool read_blob(Input& input, std::error_code& ec, Read_context& context, Blob& blob)
+inline bool read_blob_data(Input& input, std::error_code& ec, Read_context& context, Blob& blob,
+                           std::true_type)
 {
-	std::uint16_t size = static_cast<std::uint16_t>(context.sequence_data[0]);
-	if ((!size && !read_element(input, ec, context, size)) || ec) {
+	const auto n    = std::min<std::size_t>(context.sequence_data[1], context.available);
+	const auto size = blob.size();
+	if (n > blob.max_size() - size) {
+		ec = std::make_error_code(std::errc::not_enough_memory);
 		return false;
-	} else if (context.remaining_size < size) {
-		ec = Error::bad_remaining_size;
+	}
+
+	blob.resize(size + n);
+	input.read(reinterpret_cast<typename Input::char_type*>(terraqtt::detail::contiguous_data(blob) + size),
+	           static_cast<std::streamsize>(n));
+	if (!input) {
+		blob.resize(size);
+		ec = std::make_error_code(std::errc::io_error);
 		return false;
 	}
 
-	context.sequence_data[0] = size;
-	for (; context.sequence_data[0] && context.available;
-	     --context.sequence_data[0], --context.available, --context.remaining_size) {
+	context.sequence_data[1] -= static_cast<std::uint32_t>(n);
+	context.available -= n;
+	context.remaining_size -= static_cast<Variable_integer_type>(n);
+	return true;
+}
+
+/// Reads the next chunk of the blob element by element for containers that cannot be extended in bulk.
+template<typename Input, typename Blob>
+inline bool read_blob_data(Input& input, std::error_code& ec, Read_context& context, Blob& blob,
+                           std::false_type)
+{
+	for (; context.sequence_data[1] && context.available;
+	     --context.sequence_data[1], --context.available, --context.remaining_size) {
 		if (blob.size() >= blob.max_size()) {
 			ec = std::make_error_code(std::errc::not_enough_memory);
 			return false;
@@ -140,7 +168,59 @@ inline bool read_blob(Input& input, std::error_code& ec, Read_context& context,
 		}
 		blob.push_back(static_cast<typename Blob::value_type>(c));
 	}
-	return !context.sequence_data[0];
+	return true;
+}
+
+} // namespace detail
+
+/**
+ * Reads a blob with a two byte size prefix and appends it to `blob`. The read can be resumed at any byte.
+ *
+ * @param[out] blob The container to append to. Contiguous containers of bytes supporting `resize()` are
+ * filled with a single read per call, all others element by element with `push_back()`.
+ * @returns `true` if the blob was read completely.
+ */
+template<typename Input, typename Blob>
+inline bool read_blob(Input& input, std::error_code& ec, Read_context& context, Blob& blob)
+{
+	// sequence_data[0] counts the read bytes of the size prefix and sequence_data[1] holds the prefix; once
+	// complete, sequence_data[1] is the amount of blob bytes still to read
+	while (context.sequence_data[0] < 2) {
+		if (!context.available) {
+			return false;
+		} else if (!context.remaining_size) {
+			ec = Error::bad_remaining_size;
+			return false;
+		}
+
+		const auto c = input.get();
+		if (!input) {
+			ec = std::make_error_code(std::errc::io_error);
+			return false;
+		}
+
+		--context.available;
+		--context.remaining_size;
+		++context.sequence_data[0];
+		context.sequence_data[1] = context.sequence_data[1] << 8 | static_cast<Byte>(c);
+	}
+
+	if (context.remaining_size < context.sequence_data[1]) {
+		ec = Error::bad_remaining_size;
+		return false;
+	}
+
+	typedef std::integral_constant<bool, terraqtt::detail::Is_contiguous<Blob>::value &&
+	                                       terraqtt::detail::Is_resizable<Blob>::value &&
+	                                       sizeof(typename Blob::value_type) == 1>
+	  Bulk;
+	if (!detail::read_blob_data(input, ec, context, blob, Bulk{}) || context.sequence_data[1]) {
+		return false;
+	}
+
+	context.sequence_data[0] = 0;
+	++context.sequence;
+	return true;
 }
 
 } // namespace protocol
@@ -51,6 +51,40 @@ struct Unsuback_header {
 	std::uint16_t packet_identifier;
 };
 
+/**
+ * Computes the remaining length of a subscribe packet.
+ *
+ * @param ec[out] the error code, if the packet is too large
+ * @param header the subscribe header
+ * @return the remaining length
+ */
+template<typename Topic_container>
+inline Variable_integer_type remaining_length(std::error_code& ec,
+                                              const Subscribe_header<Topic_container>& header) noexcept
+{
+	Variable_integer_type remaining = 2;
+	for (const auto& i : header.topics) {
+		if (!protected_add(remaining, 3u) || !protected_add(remaining, i.filter.size())) {
+			ec = Error::payload_too_large;
+			break;
+		}
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded subscribe packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param header the subscribe header
+ * @return the size in bytes or `0` on error
+ */
+template<typename Topic_container>
+inline std::size_t packet_size(std::error_code& ec, const Subscribe_header<Topic_container>& header) noexcept
+{
+	return encoded_size(ec, remaining_length(ec, header));
+}
+
 /**
  * Writes a subscribe packet to the output stream.
  *
@@ -62,12 +96,9 @@ struct Unsuback_header {
 template<typename Output, typename Topic_container>
 inline void write_packet(Output& output, std::error_code& ec, const Subscribe_header<Topic_container>& header)
 {
-	typename std::underlying_type<Variable_integer>::type remaining = 2;
-	for (const auto& i : header.topics) {
-		if (!protected_add(remaining, 3u) || !protected_add(remaining, i.filter.size())) {
-			ec = Error::payload_too_large;
-			return;
-		}
+	const auto remaining = remaining_length(ec, header);
+	if (ec) {
+		return;
 	}
 
 	write_elements(output, ec, static_cast<Byte>(static_cast<int>(Control_packet_type::subscribe) << 4 | 0x02),
@@ -87,6 +118,38 @@ inline void write_packet(Output& output, std::error_code& ec, const Subscribe_he
 	}
 }
 
+/**
+ * Computes the remaining length of a suback packet.
+ *
+ * @param ec[out] the error code, if the packet is too large
+ * @param header the suback header
+ * @return the remaining length
+ */
+template<typename Return_code_container>
+inline Variable_integer_type remaining_length(std::error_code& ec,
+                                              const Suback_header<Return_code_container>& header) noexcept
+{
+	Variable_integer_type remaining = 2;
+	if (!protected_add(remaining, header.return_codes.size())) {
+		ec = Error::payload_too_large;
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded suback packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param header the suback header
+ * @return the size in bytes or `0` on error
+ */
+template<typename Return_code_container>
+inline std::size_t packet_size(std::error_code& ec,
+                               const Suback_header<Return_code_container>& header) noexcept
+{
+	return encoded_size(ec, remaining_length(ec, header));
+}
+
 /**
  * Writes a suback packet to the output stream.
  *
@@ -99,8 +162,13 @@ template<typename Output, typename Return_code_container>
 inline void write_packet(Output& output, std::error_code& ec,
                          const Suback_header<Return_code_container>& header)
 {
+	const auto remaining = remaining_length(ec, header);
+	if (ec) {
+		return;
+	}
+
 	write_elements(output, ec, static_cast<Byte>(static_cast<int>(Control_packet_type::suback) << 4),
-	               static_cast<Variable_integer>(2 + header.return_codes.size()), header.packet_identifier);
+	               static_cast<Variable_integer>(remaining), header.packet_identifier);
 	if (ec) {
 		return;
 	}
@@ -148,6 +216,41 @@ inline bool read_packet(Input& input, std::error_code& ec, Read_context& context
 	return true;
 }
 
+/**
+ * Computes the remaining length of an unsubscribe packet.
+ *
+ * @param ec[out] the error code, if the packet is too large
+ * @param header the unsubscribe header
+ * @return the remaining length
+ */
+template<typename Topic_container>
+inline Variable_integer_type remaining_length(std::error_code& ec,
+                                              const Unsubscribe_header<Topic_container>& header) noexcept
+{
+	Variable_integer_type remaining = 2;
+	for (const auto& i : header.topics) {
+		if (!protected_add(remaining, 2u) || !protected_add(remaining, i.size())) {
+			ec = Error::payload_too_large;
+			break;
+		}
+	}
+	return remaining;
+}
+
+/**
+ * Returns the size of the encoded unsubscribe packet without writing it.
+ *
+ * @param ec[out] the error code, if the packet cannot be encoded
+ * @param header the unsubscribe header
+ * @return the size in bytes or `0` on error
+ */
+template<typename Topic_container>
+inline std::size_t packet_size(std::error_code& ec,
+                               const Unsubscribe_header<Topic_container>& header) noexcept
+{
+	return encoded_size(ec, remaining_length(ec, header));
+}
+
 /**
  * Writes a unsubscribe packet to the output stream.
  *
@@ -160,12 +263,9 @@ template<typename Output, typename Topic_container>
 inline void write_packet(Output& output, std::error_code& ec,
                          const Unsubscribe_header<Topic_container>& header)
 {
-	typename std::underlying_type<Variable_integer>::type remaining = 2;
-	for (const auto& i : header.topics) {
-		if (!protected_add(remaining, 2u) || !protected_add(remaining, i.size())) {
-			ec = Error::payload_too_large;
-			return;
-		}
+	const auto remaining = remaining_length(ec, header);
+	if (ec) {
+		return;
 	}
 
 	write_elements(output, ec,
@@ -1,6 +1,7 @@
 #ifndef TERRAQTT_PROTOCOL_WRITER_HPP_
 #define TERRAQTT_PROTOCOL_WRITER_HPP_
 
+#include "../detail/container.hpp"
 #include "../error.hpp"
 #include "general.hpp"
 
@@ -90,7 +91,109 @@ inline void write_elements(Output& output, std::error_code& ec, Elements&&... el
 }
 
 /**
- * Writes a blob and an optional size header to the stream.
+ * Returns the size of a complete packet from its remaining length.
+ *
+ * @param ec[out] the error code, if the remaining length is too large for a variable integer
+ * @param remaining the remaining length
+ * @return the size of the fixed header plus `remaining` or `0` on error
+ */
+inline std::size_t encoded_size(std::error_code& ec, Variable_integer_type remaining) noexcept
+{
+	if (ec) {
+		return 0;
+	} else if (remaining > variable_integer_max) {
+		ec = Error::variable_integer_too_large;
+		return 0;
+	}
+	return 1 + variable_integer_size(remaining) + remaining;
+}
+
+/**
+ * A contiguous piece of an encoded packet, similar to `iovec`.
+ */
+struct Chunk {
+	const void* data;
+	/// The size in bytes.
+	std::size_t size;
+};
+
+namespace detail {
+
+template<typename Output>
+inline auto write_chunks(Output& output, const Chunk* chunks, std::size_t count,
+                         terraqtt::detail::Priority<1>) -> decltype(output.writev(chunks, count), void())
+{
+	output.writev(chunks, count);
+}
+
+template<typename Output>
+inline void write_chunks(Output& output, const Chunk* chunks, std::size_t count,
+                         terraqtt::detail::Priority<0>)
+{
+	for (std::size_t i = 0; i < count && output; ++i) {
+		output.write(reinterpret_cast<const typename Output::char_type*>(chunks[i].data),
+		             chunks[i].size / sizeof(typename Output::char_type));
+	}
+}
+
+} // namespace detail
+
+/**
+ * Writes all chunks in order. If the output provides `writev(const Chunk* chunks, std::size_t count)` all
+ * chunks are passed in a single call, which allows socket based outputs to gather them with one system call.
+ * Otherwise every chunk is passed to `write()`.
+ *
+ * @param output[in] the output stream
+ * @param ec[out] the output error, if the output fails
+ * @param chunks the chunks
+ * @param count the amount of chunks
+ */
+template<typename Output>
+inline void write_chunks(Output& output, std::error_code& ec, const Chunk* chunks, std::size_t count)
+{
+	detail::write_chunks(output, chunks, count, terraqtt::detail::Priority<1>{});
+	if (!output) {
+		ec = std::make_error_code(std::errc::io_error);
+	}
+}
+
+namespace detail {
+
+/// Writes a contiguous blob and its size prefix with a single call.
+template<typename Output, typename Blob>
+inline void write_blob_data(Output& output, std::error_code& ec, const Byte* prefix, std::size_t prefix_size,
+                            const Blob& blob, std::true_type)
+{
+	const Chunk chunks[] = { Chunk{ prefix, prefix_size },
+	                         Chunk{ terraqtt::detail::contiguous_data(blob), blob.size() } };
+	write_chunks(output, ec, chunks + (prefix_size ? 0 : 1), prefix_size ? 2 : 1);
+}
+
+/// Writes the size prefix and then the blob element by element for containers that are not contiguous.
+template<typename Output, typename Blob>
+inline void write_blob_data(Output& output, std::error_code& ec, const Byte* prefix, std::size_t prefix_size,
+                            const Blob& blob, std::false_type)
+{
+	if (prefix_size) {
+		output.write(reinterpret_cast<const typename Output::char_type*>(prefix), prefix_size);
+	}
+	for (auto i : blob) {
+		if (!output) {
+			break;
+		}
+		output.write(reinterpret_cast<const typename Output::char_type*>(&i), sizeof(i));
+	}
+	if (!output) {
+		ec = std::make_error_code(std::errc::io_error);
+	}
+}
+
+} // namespace detail
+
+/**
+ * Writes a blob and an optional size header to the stream. Contiguous blobs like `std::string`,
+ * `std::vector`, String_view and Static_container are written with a single call, all others element by
+ * element.
  *
  * @exception see write_elements()
  * @param output[in] the output stream
@@ -105,25 +208,18 @@ inline void write_blob(Output& output, std::error_code& ec, const Blob& blob)
 	static_assert(sizeof(typename Blob::value_type) == sizeof(typename Output::char_type),
 	              "sizeof blob and output types must match");
 
+	Byte prefix[2]{};
 	if (Write_size) {
 		const auto size = blob.size();
 		if (size > std::numeric_limits<std::uint16_t>::max()) {
 			ec = Error::string_too_long;
 			return;
 		}
-		write_elements(output, ec, static_cast<std::uint16_t>(size));
-		if (ec) {
-			return;
-		}
+		write_elements(prefix, ec, static_cast<std::uint16_t>(size));
 	}
 
-	for (auto i : blob) {
-		output.write(reinterpret_cast<const typename Output::char_type*>(&i), sizeof(i));
-		if (!output) {
-			ec = std::make_error_code(std::errc::io_error);
-			return;
-		}
-	}
+	detail::write_blob_data(output, ec, prefix, Write_size ? sizeof(prefix) : 0, blob,
+	                        terraqtt::detail::Is_contiguous<const Blob>{});
 }
 
 } // namespace protocol
@@ -0,0 +1,317 @@
+#ifndef TERRAQTT_SOCKET_HPP_
+#define TERRAQTT_SOCKET_HPP_
+
+#include "buffer_input.hpp"
+#include "detail/system.hpp"
+#include "error.hpp"
+#include "protocol/writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <system_error>
+#include <vector>
+
+namespace terraqtt {
+
+/**
+ * An input reading from a socket without ever blocking. receive() moves whatever the socket has into an
+ * internal buffer and the client decodes it from there like from a Buffer_input, so payloads that arrived
+ * completely are handed out in place. The socket does not need to be in non-blocking mode.
+ *
+ * @code{.cpp}
+ * if (input.receive(ec), !ec) {
+ * 	client.process_all(ec, input.available());
+ * }
+ * @endcode
+ *
+ * Unread bytes are moved to the front of the buffer before receiving, so a packet is always contiguous.
+ * Packets larger than the buffer are processed in parts. The socket is not owned.
+ */
+class Socket_input : public Buffer_input {
+public:
+	/**
+	 * Constructor.
+	 *
+	 * @param socket The connected socket.
+	 * @param capacity The size of the receive buffer in bytes.
+	 */
+	explicit Socket_input(int socket, std::size_t capacity = 16 * 1024)
+	    : _socket(socket), _buffer(std::max<std::size_t>(capacity, 1))
+	{
+		assign(_buffer.data(), 0);
+	}
+	Socket_input(const Socket_input& copy) = delete;
+	/**
+	 * Receives as many bytes as the socket has and the buffer can take.
+	 *
+	 * @param[out] ec Error::connection_closed if the peer closed the connection or the error of the system
+	 * call
+	 * @returns The amount of received bytes; `0` if nothing was waiting or the buffer is full.
+	 */
+	std::size_t receive(std::error_code& ec)
+	{
+		std::size_t size;
+		const auto free = prepare(size);
+		if (!size) {
+			return 0;
+		}
+
+		while (true) {
+			const auto n = ::recv(_socket, free, size, MSG_DONTWAIT);
+			if (n > 0) {
+				commit(static_cast<std::size_t>(n));
+				return static_cast<std::size_t>(n);
+			} else if (n == 0) {
+				ec = Error::connection_closed;
+			} else if (errno == EINTR) {
+				continue;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ec = detail::last_system_error();
+			}
+			return 0;
+		}
+	}
+	/**
+	 * Moves the unread bytes to the front of the buffer and returns the free space behind them. This allows
+	 * receiving without receive(), for example with an asynchronous receive of Uring_reactor. The bytes are
+	 * made readable with commit().
+	 *
+	 * @param[out] size The size of the free space.
+	 * @returns The free space.
+	 */
+	char_type* prepare(std::size_t& size) noexcept
+	{
+		const auto unread = available();
+		if (unread && data() != _buffer.data()) {
+			std::memmove(_buffer.data(), data(), unread);
+		}
+		assign(_buffer.data(), unread);
+		size = _buffer.size() - unread;
+		return _buffer.data() + unread;
+	}
+	/**
+	 * Appends `size` received bytes to the readable range. The bytes must have been stored in the space
+	 * returned by the last prepare(). Reading may continue in between.
+	 */
+	void commit(std::size_t size) noexcept { assign(data(), available() + size); }
+	/// The size of the receive buffer.
+	std::size_t capacity() const noexcept { return _buffer.size(); }
+	int socket() const noexcept { return _socket; }
+	Socket_input& operator=(const Socket_input& copy) = delete;
+
+private:
+	int _socket;
+	std::vector<char> _buffer;
+};
+
+/**
+ * An output writing to a socket without ever blocking. Writes are collected in an internal buffer that is
+ * sent when it exceeds its capacity or on flush(). Whatever the socket cannot take right now stays buffered
+ * until the next flush(), so the buffer grows beyond its capacity instead of blocking; Flow_limits bound it.
+ * The socket does not need to be in non-blocking mode.
+ *
+ * Sent bytes are dropped from the front of the buffer and the rest is moved back once the sent part
+ * outweighs it, so the bytes handed to `send()` are always contiguous. The socket is not owned.
+ *
+ * Completion based reactors like Uring_reactor send the buffer asynchronously with begin_send() and
+ * end_send() instead, see defer().
+ *
+ * @note This output intentionally has no `native_handle()`: File_payload would send to the socket directly,
+ * which is only safe once the buffer is empty.
+ */
+class Socket_output {
+public:
+	typedef char char_type;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param socket The connected socket.
+	 * @param capacity How many bytes are collected before they are sent.
+	 */
+	explicit Socket_output(int socket, std::size_t capacity = 16 * 1024) : _socket(socket), _capacity(capacity)
+	{
+		_buffer.reserve(capacity);
+	}
+	Socket_output(const Socket_output& copy) = delete;
+	/**
+	 * Buffers the data. If the buffer exceeds its capacity, as much as possible is sent unless the last send
+	 * found the socket full.
+	 *
+	 * @param data The data.
+	 * @param size The amount of characters.
+	 * @returns `*this`
+	 */
+	Socket_output& write(const char_type* data, std::size_t size)
+	{
+		if (_good) {
+			_append(data, size);
+			if (buffered() >= _capacity && !_blocked && !_deferred) {
+				flush();
+			}
+		}
+		return *this;
+	}
+	/**
+	 * Buffers all chunks. If the buffer exceeds its capacity, as much as possible is sent unless the last send
+	 * found the socket full.
+	 *
+	 * @param chunks The chunks.
+	 * @param count The amount of chunks.
+	 * @returns `*this`
+	 * @see protocol::write_chunks()
+	 */
+	Socket_output& writev(const protocol::Chunk* chunks, std::size_t count)
+	{
+		if (_good) {
+			for (std::size_t i = 0; i < count; ++i) {
+				_append(static_cast<const char_type*>(chunks[i].data), chunks[i].size);
+			}
+			if (buffered() >= _capacity && !_blocked && !_deferred) {
+				flush();
+			}
+		}
+		return *this;
+	}
+	/**
+	 * Sends as many buffered bytes as the socket takes without blocking. The output fails if the socket
+	 * fails. Does nothing if sending is deferred.
+	 *
+	 * @returns `*this`
+	 */
+	Socket_output& flush()
+	{
+		if (_deferred || _sending) {
+			return *this;
+		}
+		_blocked = false;
+		while (_good && buffered()) {
+			const auto n = ::send(_socket, _buffer.data() + _sent, buffered(), MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n > 0) {
+				_sent += static_cast<std::size_t>(n);
+			} else if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				_blocked = true;
+				break;
+			} else {
+				_good  = false;
+				_error = n < 0 ? detail::last_system_error() : std::make_error_code(std::errc::io_error);
+			}
+		}
+		if (_sent == _buffer.size()) {
+			_buffer.clear();
+			_sent = 0;
+		}
+		return *this;
+	}
+	/**
+	 * Leaves sending to begin_send() and end_send(). flush() and full buffers then never send on their own.
+	 *
+	 * @param enable Whether sending is deferred.
+	 */
+	void defer(bool enable) noexcept { _deferred = enable; }
+	bool deferred() const noexcept { return _deferred; }
+	/**
+	 * Starts sending the buffered bytes asynchronously. They stay unchanged at sending_data() until
+	 * end_send(); bytes written in the meantime are queued behind them.
+	 *
+	 * @returns How many bytes to send; `0` if nothing is buffered or a send is already in progress.
+	 */
+	std::size_t begin_send() noexcept
+	{
+		if (_sending || !_good) {
+			return 0;
+		}
+		return _sending = _buffer.size() - _sent;
+	}
+	/// The bytes of the send in progress.
+	const char_type* sending_data() const noexcept { return _buffer.data() + _sent; }
+	/// How many bytes the send in progress has.
+	std::size_t sending() const noexcept { return _sending; }
+	/**
+	 * Completes the send in progress.
+	 *
+	 * @param sent How many bytes were sent. The rest is sent again by the next begin_send().
+	 */
+	void end_send(std::size_t sent)
+	{
+		_sent += std::min(sent, _sending);
+		_sending = 0;
+		if (_sent == _buffer.size()) {
+			_buffer.swap(_queued);
+			_queued.clear();
+			_sent = 0;
+		} else {
+			_buffer.insert(_buffer.end(), _queued.begin(), _queued.end());
+			_queued.clear();
+		}
+	}
+	/// Fails the output like a failed send, for example when an asynchronous send failed.
+	void fail(const std::error_code& ec) noexcept
+	{
+		_good  = false;
+		_error = ec;
+	}
+	/// How many bytes wait to be sent, including a send in progress.
+	std::size_t buffered() const noexcept { return _buffer.size() - _sent + _queued.size(); }
+	std::size_t capacity() const noexcept { return _capacity; }
+	int socket() const noexcept { return _socket; }
+	/// The error of the socket after the output failed.
+	const std::error_code& error() const noexcept { return _error; }
+	explicit operator bool() const noexcept { return _good; }
+	Socket_output& operator=(const Socket_output& copy) = delete;
+
+private:
+	int _socket;
+	std::size_t _capacity;
+	std::vector<char_type> _buffer;
+	/// The bytes written during a send in progress.
+	std::vector<char_type> _queued;
+	/// How many bytes at the front of the buffer have been sent.
+	std::size_t _sent = 0;
+	/// How many bytes behind the sent ones are being sent asynchronously.
+	std::size_t _sending = 0;
+	bool _good           = true;
+	/// Whether the socket could not take everything on the last send.
+	bool _blocked  = false;
+	bool _deferred = false;
+	std::error_code _error;
+
+	void _append(const char_type* data, std::size_t size)
+	{
+		if (_sending) {
+			_queued.insert(_queued.end(), data, data + size);
+			return;
+		} else if (_sent && _sent >= buffered()) {
+			_buffer.erase(_buffer.begin(), _buffer.begin() + static_cast<std::ptrdiff_t>(_sent));
+			_sent = 0;
+		}
+		_buffer.insert(_buffer.end(), data, data + size);
+	}
+};
+
+namespace detail {
+
+/**
+ * The sockets of a client running on a reactor. A base class so they are constructed before the client.
+ *
+ * @private
+ */
+struct Socket_streams {
+	Socket_input socket_input;
+	Socket_output socket_output;
+
+	Socket_streams(int socket, std::size_t input_capacity, std::size_t output_capacity)
+	    : socket_input{ socket, input_capacity }, socket_output{ socket, output_capacity }
+	{}
+};
+
+} // namespace detail
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef TERRAQTT_STATIC_TOPIC_FILTERS_HPP_
+#define TERRAQTT_STATIC_TOPIC_FILTERS_HPP_
+
+#include "detail/container.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace terraqtt {
+namespace detail {
+
+template<std::size_t... Indices>
+struct Index_sequence {};
+
+template<std::size_t Size, std::size_t... Indices>
+struct Make_index_sequence : Make_index_sequence<Size - 1, Size - 1, Indices...> {};
+
+template<std::size_t... Indices>
+struct Make_index_sequence<0, Indices...> {
+	typedef Index_sequence<Indices...> type;
+};
+
+constexpr std::size_t filter_length(const char* filter, std::size_t length = 0) noexcept
+{
+	return filter[length] ? filter_length(filter, length + 1) : length;
+}
+
+constexpr bool is_literal_filter(const char* filter) noexcept
+{
+	return !*filter || (*filter != '+' && *filter != '#' && is_literal_filter(filter + 1));
+}
+
+constexpr bool is_valid_filter_level(const char* filter, bool level_start) noexcept
+{
+	return !*filter ? true
+	                : *filter == '#' ? level_start && !filter[1]
+	                                 : *filter == '+' ? level_start && (!filter[1] || filter[1] == '/') &&
+	                                                      is_valid_filter_level(filter + 1, false)
+	                                                  : is_valid_filter_level(filter + 1, *filter == '/');
+}
+
+/// Checks whether the filter is a valid topic filter at compile time.
+constexpr bool is_valid_filter(const char* filter) noexcept
+{
+	return *filter && is_valid_filter_level(filter, true);
+}
+
+/// FNV-1a hash of the first level of a topic or topic filter.
+constexpr std::uint32_t first_level_hash(const char* first, const char* last,
+                                         std::uint32_t hash = 2166136261u) noexcept
+{
+	return first == last || *first == '/'
+	         ? hash
+	         : first_level_hash(first + 1, last, (hash ^ static_cast<unsigned char>(*first)) * 16777619u);
+}
+
+#if __cplusplus >= 201402L
+/// Checks whether the filter matches the topic `[topic, end)`. Wildcards on the first level do not match `$`.
+constexpr bool filter_matches(const char* filter, const char* topic, const char* end) noexcept
+{
+	if (topic != end && *topic == '$' && (*filter == '+' || *filter == '#')) {
+		return false;
+	}
+
+	for (; *filter; ++filter) {
+		if (*filter == '#') {
+			return true;
+		} else if (*filter == '+') {
+			while (topic != end && *topic != '/') {
+				++topic;
+			}
+		} else if (topic == end) {
+			// a/# matches a
+			return *filter == '/' && filter[1] == '#';
+		} else if (*filter != *topic++) {
+			return false;
+		}
+	}
+	return topic == end;
+}
+#else
+constexpr const char* skip_level(const char* topic, const char* end) noexcept
+{
+	return topic == end || *topic == '/' ? topic : skip_level(topic + 1, end);
+}
+
+constexpr bool match_filter(const char* filter, const char* topic, const char* end) noexcept
+{
+	return !*filter ? topic == end
+	                : *filter == '#'
+	                    ? true
+	                    : *filter == '+'
+	                        ? match_filter(filter + 1, skip_level(topic, end), end)
+	                        : topic == end ? *filter == '/' && filter[1] == '#'
+	                                       : *filter == *topic && match_filter(filter + 1, topic + 1, end);
+}
+
+/// Checks whether the filter matches the topic `[topic, end)`. Wildcards on the first level do not match `$`.
+constexpr bool filter_matches(const char* filter, const char* topic, const char* end) noexcept
+{
+	return !(topic != end && *topic == '$' && (*filter == '+' || *filter == '#')) &&
+	       match_filter(filter, topic, end);
+}
+#endif
+
+/**
+ * A single filter known at compile time.
+ *
+ * @private
+ */
+template<const char* Filter>
+struct Static_filter {
+	static_assert(is_valid_filter(Filter), "invalid topic filter");
+
+	constexpr static bool literal        = is_literal_filter(Filter);
+	constexpr static std::size_t length  = filter_length(Filter);
+	constexpr static bool wildcard_start = *Filter == '+' || *Filter == '#';
+	constexpr static std::uint32_t hash  = first_level_hash(Filter, Filter + length);
+
+	static bool matches(const char* topic, const char* end, std::uint32_t topic_hash) noexcept
+	{
+		if (literal) {
+			return static_cast<std::size_t>(end - topic) == length && !std::memcmp(topic, Filter, length);
+		}
+		return (wildcard_start || topic_hash == hash) && filter_matches(Filter, topic, end);
+	}
+};
+
+template<typename Indices, const char*... Filters>
+struct Static_filters;
+
+template<std::size_t... Indices, const char*... Filters>
+struct Static_filters<Index_sequence<Indices...>, Filters...> {
+	static std::uint64_t match(const char* topic, const char* end) noexcept
+	{
+		const auto hash    = first_level_hash(topic, end);
+		std::uint64_t mask = 0;
+#if __cplusplus >= 201703L
+		((mask |= std::uint64_t{ Static_filter<Filters>::matches(topic, end, hash) } << Indices), ...);
+#else
+		const int expand[] = { 0, (mask |= std::uint64_t{ Static_filter<Filters>::matches(topic, end, hash) }
+		                                   << Indices,
+		                           0)... };
+		(void) expand;
+#endif
+		return mask;
+	}
+	template<typename Visitor>
+	static std::size_t dispatch(const char* topic, const char* end, Visitor& visitor)
+	{
+		const auto hash   = first_level_hash(topic, end);
+		std::size_t count = 0;
+#if __cplusplus >= 201703L
+		((Static_filter<Filters>::matches(topic, end, hash)
+		    ? (visitor(std::integral_constant<std::size_t, Indices>{}), ++count)
+		    : 0),
+		 ...);
+#else
+		const int expand[] = { 0, (Static_filter<Filters>::matches(topic, end, hash)
+		                             ? (visitor(std::integral_constant<std::size_t, Indices>{}), ++count, 0)
+		                             : 0)... };
+		(void) expand;
+#endif
+		return count;
+	}
+};
+
+} // namespace detail
+
+/**
+ * A fixed set of topic filters known at compile time. The filters are validated at compile time and the
+ * matcher of every filter is generated from its characters: filters without wildcards compile to a length
+ * check and a `memcmp()`, all others are prefiltered by a precomputed hash of their first level. No memory is
+ * allocated and no runtime table is used. C++14 and later use an iterative matcher and C++17 folds the
+ * filters instead of expanding them into an array.
+ *
+ * @code{.cpp}
+ * constexpr char led_version[] = "+/led/version";
+ * constexpr char firmware[]    = "led/firmware/#";
+ * typedef Static_topic_filters<led_version, firmware> Filters;
+ *
+ * struct Visitor {
+ *   void operator()(std::integral_constant<std::size_t, 0>) { ... }
+ *   void operator()(std::integral_constant<std::size_t, 1>) { ... }
+ * };
+ *
+ * Visitor visitor;
+ * Filters::dispatch(header.topic, visitor);
+ * @endcode
+ *
+ * @tparam Filters The topic filters. Must be `constexpr` character arrays with linkage.
+ */
+template<const char*... Filters>
+class Static_topic_filters {
+public:
+	static_assert(sizeof...(Filters) <= 64, "at most 64 filters are supported");
+
+	/// Returns the amount of filters.
+	constexpr static std::size_t size() noexcept { return sizeof...(Filters); }
+	/**
+	 * Matches the topic against all filters.
+	 *
+	 * @param topic The topic.
+	 * @param size The size of the topic.
+	 * @returns A mask where the bit `1 << I` is set if the filter with the index `I` matches.
+	 */
+	static std::uint64_t match(const char* topic, std::size_t size) noexcept
+	{
+		return Impl::match(topic, topic + size);
+	}
+	/**
+	 * Matches the topic against all filters.
+	 *
+	 * @param topic The topic. Must store its characters contiguously.
+	 * @see match(const char*, std::size_t)
+	 */
+	template<typename Topic>
+	static std::uint64_t match(const Topic& topic) noexcept
+	{
+		static_assert(detail::Is_contiguous<const Topic>::value, "topic must be contiguous");
+		return match(detail::contiguous_data(topic), topic.size());
+	}
+	/**
+	 * Calls `visitor(std::integral_constant<std::size_t, I>{})` for every filter `I` matching the topic.
+	 *
+	 * @param topic The topic.
+	 * @param size The size of the topic.
+	 * @param visitor The visitor.
+	 * @returns How many filters matched.
+	 */
+	template<typename Visitor>
+	static std::size_t dispatch(const char* topic, std::size_t size, Visitor&& visitor)
+	{
+		return Impl::dispatch(topic, topic + size, visitor);
+	}
+	/**
+	 * Calls `visitor(std::integral_constant<std::size_t, I>{})` for every filter `I` matching the topic.
+	 *
+	 * @param topic The topic. Must store its characters contiguously.
+	 * @see dispatch(const char*, std::size_t, Visitor&&)
+	 */
+	template<typename Topic, typename Visitor>
+	static std::size_t dispatch(const Topic& topic, Visitor&& visitor)
+	{
+		static_assert(detail::Is_contiguous<const Topic>::value, "topic must be contiguous");
+		return dispatch(detail::contiguous_data(topic), topic.size(), visitor);
+	}
+
+private:
+	typedef detail::Static_filters<typename detail::Make_index_sequence<sizeof...(Filters)>::type, Filters...>
+	  Impl;
+};
+
+} // namespace terraqtt
+
+#endif
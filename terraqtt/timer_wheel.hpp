@@ -0,0 +1,340 @@
+#ifndef TERRAQTT_TIMER_WHEEL_HPP_
+#define TERRAQTT_TIMER_WHEEL_HPP_
+
+#include "detail/bits.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * A node of an intrusive circular list. A node that is not linked points to itself, so it can be used as list
+ * head.
+ *
+ * @private
+ */
+struct Timer_link {
+	Timer_link* previous = this;
+	Timer_link* next     = this;
+
+	Timer_link() = default;
+	Timer_link(const Timer_link& copy) = delete;
+	bool empty() const noexcept { return next == this; }
+	void push_back(Timer_link& node) noexcept
+	{
+		node.previous  = previous;
+		node.next      = this;
+		previous->next = &node;
+		previous       = &node;
+	}
+	void unlink() noexcept
+	{
+		previous->next = next;
+		next->previous = previous;
+		previous = next = this;
+	}
+	/// Moves all nodes of `other` to the end of this list.
+	void splice(Timer_link& other) noexcept
+	{
+		if (!other.empty()) {
+			other.previous->next = this;
+			other.next->previous = previous;
+			previous->next       = other.next;
+			previous             = other.previous;
+			other.previous = other.next = &other;
+		}
+	}
+	Timer_link& operator=(const Timer_link& copy) = delete;
+};
+
+} // namespace detail
+
+/**
+ * A hierarchical timer wheel for deadlines of many connections. Time is divided into ticks of a fixed
+ * resolution and every level has 64 slots, each slot of a level spanning a whole lap of the level below.
+ * Scheduling and canceling take constant time. expire() only touches the timers that are due, plus a timer
+ * once per level it moves down, and skips idle ticks with a bitmap of the occupied slots per level, so the
+ * cost per call depends neither on the amount of timers nor on the elapsed time.
+ * Deadlines further away than the four levels (`2^24` ticks, over 46 hours at the default resolution) wait in
+ * an overflow list.
+ *
+ * Timers are intrusive and never allocate. A timer fires at the first tick boundary at or after its
+ * deadline, never before.
+ *
+ * @code{.cpp}
+ * Timer_wheel<std::chrono::steady_clock> wheel;
+ * client.attach(&wheel, &client);
+ * // in the event loop
+ * wheel.expire(std::chrono::steady_clock::now(), [&](Timer_wheel<std::chrono::steady_clock>::Timer& timer) {
+ * 	static_cast<Client*>(timer.context())->update_state(ec);
+ * });
+ * @endcode
+ *
+ * @tparam Clock The clock of the deadlines.
+ */
+template<typename Clock>
+class Timer_wheel {
+public:
+	typedef typename Clock::duration duration;
+	typedef typename Clock::time_point time_point;
+
+	/// A deadline that can be scheduled on one wheel at a time. It is canceled on destruction.
+	class Timer : private detail::Timer_link {
+	public:
+		/**
+		 * Constructor.
+		 *
+		 * @param context Passed through context(), for example the connection the timer belongs to.
+		 */
+		explicit Timer(void* context = nullptr) noexcept : _context(context) {}
+		Timer(const Timer& copy) = delete;
+		~Timer() noexcept { cancel(); }
+		void cancel() noexcept
+		{
+			if (_wheel) {
+				unlink();
+				--_wheel->_size;
+				_wheel = nullptr;
+			}
+		}
+		bool scheduled() const noexcept { return _wheel; }
+		/// The deadline of the last schedule.
+		time_point deadline() const noexcept { return _deadline; }
+		void* context() const noexcept { return _context; }
+		void context(void* context) noexcept { _context = context; }
+		Timer& operator=(const Timer& copy) = delete;
+
+	private:
+		friend Timer_wheel;
+
+		void* _context;
+		Timer_wheel* _wheel = nullptr;
+		time_point _deadline;
+		std::uint64_t _tick = 0;
+	};
+
+	/**
+	 * Constructor.
+	 *
+	 * @param resolution The length of a tick; 10 milliseconds by default.
+	 * @param origin The start of the first tick.
+	 */
+	explicit Timer_wheel(duration resolution = default_resolution(), time_point origin = Clock::now()) noexcept
+	    : _resolution(resolution.count() > 0 ? resolution : duration{ 1 }), _origin(origin)
+	{}
+	Timer_wheel(const Timer_wheel& copy) = delete;
+	/// Cancels all timers.
+	~Timer_wheel() noexcept
+	{
+		for (auto& level : _slots) {
+			for (auto& slot : level) {
+				_cancel_all(slot);
+			}
+		}
+		_cancel_all(_overflow);
+		_cancel_all(_expired);
+		_cancel_all(_firing);
+	}
+	/**
+	 * Schedules the timer or moves it to a new deadline. A deadline that already passed fires on the next
+	 * expire().
+	 *
+	 * @param[in] timer The timer. Canceled first if it belongs to another wheel.
+	 * @param deadline The deadline.
+	 */
+	void schedule(Timer& timer, time_point deadline) noexcept
+	{
+		const auto tick = _tick(deadline);
+		timer._deadline = deadline;
+		if (timer._wheel == this && timer._tick == tick) {
+			return;
+		}
+
+		timer.cancel();
+		timer._wheel = this;
+		timer._tick  = tick;
+		++_size;
+		_insert(timer);
+	}
+	/**
+	 * Advances the wheel to `now` and calls `visitor(Timer&)` for every timer that is due. Timers are
+	 * unscheduled before their visit, so the visitor may schedule them again or cancel other timers. Timers
+	 * scheduled by the visitor for a deadline that already passed fire on the next call.
+	 *
+	 * @param now The current time.
+	 * @param visitor The visitor.
+	 * @returns The amount of fired timers.
+	 */
+	template<typename Visitor>
+	std::size_t expire(time_point now, Visitor&& visitor)
+	{
+		const auto target = now > _origin ? static_cast<std::uint64_t>((now - _origin) / _resolution) : 0;
+		while (_current < target) {
+			// skip the ticks without anything to do
+			const auto next = _next_event();
+			if (!next || next > target) {
+				_current = target;
+				break;
+			}
+
+			_current = next;
+			if (!(_current & _mask(levels))) {
+				_cascade(_overflow);
+			}
+			for (auto level = levels - 1; level > 0; --level) {
+				if (!(_current & _mask(level))) {
+					_cascade(level);
+				}
+			}
+			_expired.splice(_slots[0][_current & (slots - 1)]);
+			_occupied[0] &= ~(std::uint64_t{ 1 } << (_current & (slots - 1)));
+		}
+
+		std::size_t fired = 0;
+		_firing.splice(_expired);
+		while (!_firing.empty()) {
+			auto& timer = static_cast<Timer&>(*_firing.next);
+			timer.cancel();
+			++fired;
+			visitor(timer);
+		}
+		return fired;
+	}
+	/**
+	 * Returns when expire() has something to do next, so an event loop can sleep until then. This may be the
+	 * time timers move down a level instead of firing.
+	 *
+	 * @returns The deadline, the start of the current tick if timers are due or `time_point::max()` if no
+	 * timer is scheduled.
+	 */
+	time_point next_deadline() const noexcept
+	{
+		if (!_expired.empty() || !_firing.empty()) {
+			return _origin + static_cast<typename duration::rep>(_current) * _resolution;
+		}
+		const auto next = _next_event();
+		return next ? _origin + static_cast<typename duration::rep>(next) * _resolution : time_point::max();
+	}
+	static duration default_resolution() noexcept
+	{
+		return std::chrono::duration_cast<duration>(std::chrono::milliseconds{ 10 });
+	}
+	/// The amount of scheduled timers.
+	std::size_t size() const noexcept { return _size; }
+	bool empty() const noexcept { return !_size; }
+	duration resolution() const noexcept { return _resolution; }
+	Timer_wheel& operator=(const Timer_wheel& copy) = delete;
+
+private:
+	constexpr static unsigned levels    = 4;
+	constexpr static unsigned slot_bits = 6;
+	constexpr static unsigned slots     = 1 << slot_bits;
+
+	detail::Timer_link _slots[levels][slots];
+	/// Timers beyond the last level.
+	detail::Timer_link _overflow;
+	/// Timers whose tick has passed.
+	detail::Timer_link _expired;
+	/// Timers being visited by expire().
+	detail::Timer_link _firing;
+	/// Timers being moved to a lower level.
+	detail::Timer_link _cascading;
+	/// One bit per slot that may contain timers.
+	std::uint64_t _occupied[levels]{};
+	std::size_t _size = 0;
+	duration _resolution;
+	time_point _origin;
+	/// Every tick up to and including this one has been processed.
+	std::uint64_t _current = 0;
+
+	/// The bits of the ticks below `level`.
+	static std::uint64_t _mask(unsigned level) noexcept
+	{
+		return (std::uint64_t{ 1 } << level * slot_bits) - 1;
+	}
+	static void _cancel_all(detail::Timer_link& list) noexcept
+	{
+		while (!list.empty()) {
+			static_cast<Timer&>(*list.next).cancel();
+		}
+	}
+	/// The first tick starting at or after the deadline.
+	std::uint64_t _tick(time_point deadline) const noexcept
+	{
+		if (deadline <= _origin) {
+			return 0;
+		}
+		const auto ticks = (deadline - _origin) / _resolution;
+		return static_cast<std::uint64_t>(_origin + ticks * _resolution < deadline ? ticks + 1 : ticks);
+	}
+	/// Links the timer into the slot of the highest tick bits differing from the current tick.
+	void _insert(Timer& timer) noexcept
+	{
+		if (timer._tick <= _current) {
+			_expired.push_back(timer);
+			return;
+		}
+
+		const auto level = detail::highest_bit(timer._tick ^ _current) / slot_bits;
+		if (level >= levels) {
+			_overflow.push_back(timer);
+		} else {
+			const auto index = timer._tick >> level * slot_bits & (slots - 1);
+			_slots[level][index].push_back(timer);
+			_occupied[level] |= std::uint64_t{ 1 } << index;
+		}
+	}
+	/**
+	 * Finds the next tick at which a slot of level `0` fires or a slot of a higher level moves down. Every
+	 * slot ahead of the current tick belongs to the current lap of its level.
+	 *
+	 * @returns The tick or `0` if there is none.
+	 */
+	std::uint64_t _next_event() const noexcept
+	{
+		std::uint64_t next = 0;
+		for (unsigned level = 0; level < levels; ++level) {
+			const auto shift = level * slot_bits;
+			const auto index = _current >> shift & (slots - 1);
+			if (index + 1 < slots) {
+				const auto ahead = _occupied[level] & ~std::uint64_t{ 0 } << (index + 1);
+				if (ahead) {
+					const auto tick = (_current & ~_mask(level + 1)) |
+					                  std::uint64_t{ detail::lowest_bit(ahead) } << shift;
+					if (!next || tick < next) {
+						next = tick;
+					}
+				}
+			}
+		}
+		if (!_overflow.empty()) {
+			const auto tick = (_current | _mask(levels)) + 1;
+			if (!next || tick < next) {
+				next = tick;
+			}
+		}
+		return next;
+	}
+	void _cascade(unsigned level) noexcept
+	{
+		const auto index = _current >> level * slot_bits & (slots - 1);
+		_occupied[level] &= ~(std::uint64_t{ 1 } << index);
+		_cascade(_slots[level][index]);
+	}
+	void _cascade(detail::Timer_link& slot) noexcept
+	{
+		_cascading.splice(slot);
+		while (!_cascading.empty()) {
+			auto& timer = static_cast<Timer&>(*_cascading.next);
+			timer.unlink();
+			_insert(timer);
+		}
+	}
+};
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef TERRAQTT_TOPIC_ROUTER_HPP_
+#define TERRAQTT_TOPIC_ROUTER_HPP_
+
+#include "error.hpp"
+#include "protocol/publishing.hpp"
+#include "protocol/subscription.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace terraqtt {
+
+/**
+ * Dispatches topics to the handlers of all matching topic filters including the wildcards `+` and `#`. The
+ * filters are stored in a trie split at the level separators, so matching a topic costs O(topic levels)
+ * independent of the amount of filters.
+ *
+ * The trie is stored in flat vectors: nodes, a single open addressing table for the edges of all nodes and
+ * one string holding all level names. Removing a handler does not shrink the trie; the path is reused if the
+ * filter is added again. Handlers must not modify the router while they are being dispatched.
+ *
+ * @code{.cpp}
+ * Topic_router<std::function<void(const std::string&)>> router;
+ * router.add(Subscribe_topic<String_view>{ "sensors/+/temperature", QoS::at_most_once },
+ *            [](const std::string& topic) { ... });
+ * router.dispatch(header.topic, topic);
+ * @endcode
+ *
+ * @tparam Handler The handler type. Must be callable with the arguments given to dispatch().
+ */
+template<typename Handler>
+class Topic_router {
+public:
+	/// Identifies an added handler.
+	typedef std::uint32_t Id;
+
+	constexpr static Id npos = std::numeric_limits<Id>::max();
+
+	Topic_router() : _nodes(1), _edges(16) {}
+#if defined(__cpp_exceptions)
+	template<typename Filter>
+	Id add(const Filter& filter, Handler handler)
+	{
+		std::error_code ec;
+		const auto id = add(ec, filter, std::move(handler));
+		return ec ? throw std::system_error{ ec } : id;
+	}
+#endif
+	/**
+	 * Adds a handler for the filter of a subscription.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param topic The subscription.
+	 * @param handler The handler.
+	 * @returns The id of the handler or `npos` on error.
+	 */
+	template<typename String>
+	Id add(std::error_code& ec, const Subscribe_topic<String>& topic, Handler handler)
+	{
+		return add(ec, topic.filter, std::move(handler));
+	}
+	/**
+	 * Adds a handler for a topic filter.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param filter The topic filter. Must meet the requirements of a `Container` of characters.
+	 * @param handler The handler.
+	 * @returns The id of the handler or `npos` on error.
+	 */
+	template<typename Filter>
+	Id add(std::error_code& ec, const Filter& filter, Handler handler)
+	{
+		const auto first = std::begin(filter);
+		const auto last  = std::end(filter);
+		if (!_is_valid_filter(first, last)) {
+			ec = Error::bad_topic_filter;
+			return npos;
+		}
+
+		std::uint32_t node = 0;
+		_for_each_level(first, last, [&](decltype(first) level_first, decltype(first) level_last) {
+			const auto size = std::distance(level_first, level_last);
+			if (size == 1 && *level_first == '+') {
+				node = _plus_child(node);
+			} else if (size == 1 && *level_first == '#') {
+				node = _hash_child(node);
+			} else {
+				node = _literal_child(node, level_first, level_last);
+			}
+			return true;
+		});
+
+		// link the new entry
+		Id id;
+		if (_free != npos) {
+			id                   = _free;
+			_free                = _entries[id].next;
+			_entries[id].handler = std::move(handler);
+			_entries[id].used    = true;
+		} else {
+			id = static_cast<Id>(_entries.size());
+			_entries.push_back(Entry{ std::move(handler), node, npos, true });
+		}
+		_entries[id].node    = node;
+		_entries[id].next    = _nodes[node].entries;
+		_nodes[node].entries = id;
+		++_size;
+		return id;
+	}
+	/**
+	 * Removes a handler.
+	 *
+	 * @param id The id returned by add().
+	 * @returns `true` if the handler was removed, otherwise `false` if there is no such handler.
+	 */
+	bool remove(Id id)
+	{
+		if (id >= _entries.size() || !_entries[id].used) {
+			return false;
+		}
+
+		// unlink from the node
+		auto* link = &_nodes[_entries[id].node].entries;
+		while (*link != id) {
+			link = &_entries[*link].next;
+		}
+		*link = _entries[id].next;
+
+		_entries[id].used = false;
+		_entries[id].next = _free;
+		_free             = id;
+		--_size;
+		return true;
+	}
+	/**
+	 * Calls the handlers of all filters matching the topic.
+	 *
+	 * @param topic The topic name. Must meet the requirements of a `Container` of characters.
+	 * @param args The arguments passed to every handler.
+	 * @returns How many handlers were called.
+	 */
+	template<typename Topic, typename... Args>
+	std::size_t dispatch(const Topic& topic, Args&&... args)
+	{
+		_match(std::begin(topic), std::end(topic));
+		for (const auto id : _matches) {
+			_entries[id].handler(args...);
+		}
+		return _matches.size();
+	}
+	/**
+	 * Calls the handlers of all filters matching the topic of a received publish header. The header is passed
+	 * as first argument to the handlers.
+	 *
+	 * @param header The received header.
+	 * @param args The additional arguments passed to every handler.
+	 * @returns How many handlers were called.
+	 */
+	template<typename String, typename... Args>
+	std::size_t dispatch(const protocol::Publish_header<String>& header, Args&&... args)
+	{
+		return dispatch(header.topic, header, std::forward<Args>(args)...);
+	}
+	/// Returns how many handlers are registered.
+	std::size_t size() const noexcept { return _size; }
+	bool empty() const noexcept { return !_size; }
+
+private:
+	struct Node {
+		/// The first handler entry of this node.
+		Id entries = npos;
+		/// The child for `+`.
+		std::uint32_t plus = npos;
+		/// The child for `#`.
+		std::uint32_t hash = npos;
+	};
+	struct Edge {
+		std::uint32_t parent;
+		std::uint32_t child = npos;
+		std::uint32_t hash;
+		/// The level name in `_levels`.
+		std::uint32_t offset;
+		std::uint32_t size;
+	};
+	struct Entry {
+		Handler handler;
+		std::uint32_t node;
+		/// The next entry of the same node or the next free entry.
+		Id next;
+		bool used;
+	};
+
+	std::vector<Node> _nodes;
+	/// All edges with a level name stored in an open addressing table. The size is a power of two.
+	std::vector<Edge> _edges;
+	std::size_t _edge_count = 0;
+	std::string _levels;
+	std::vector<Entry> _entries;
+	Id _free          = npos;
+	std::size_t _size = 0;
+	/// Scratch space for matching.
+	std::vector<std::uint32_t> _active;
+	std::vector<std::uint32_t> _next;
+	std::vector<Id> _matches;
+
+	/// Calls `f(level_first, level_last)` for every level until it returns `false`.
+	template<typename Iterator, typename Function>
+	static void _for_each_level(Iterator first, Iterator last, Function&& f)
+	{
+		while (true) {
+			const auto separator = std::find(first, last, '/');
+			if (!f(first, separator) || separator == last) {
+				return;
+			}
+			first = std::next(separator);
+		}
+	}
+	template<typename Iterator>
+	static bool _is_valid_filter(Iterator first, Iterator last)
+	{
+		if (first == last) {
+			return false;
+		}
+
+		bool valid = true;
+		_for_each_level(first, last, [&](Iterator level_first, Iterator level_last) {
+			const auto size = std::distance(level_first, level_last);
+			for (auto i = level_first; i != level_last; ++i) {
+				// wildcards must occupy the whole level and # must be the last level
+				if ((*i == '+' || *i == '#') && size != 1) {
+					valid = false;
+				} else if (*i == '#' && level_last != last) {
+					valid = false;
+				}
+			}
+			return valid;
+		});
+		return valid;
+	}
+	template<typename Iterator>
+	static std::uint32_t _hash(Iterator first, Iterator last) noexcept
+	{
+		// FNV-1a
+		std::uint32_t hash = 2166136261u;
+		for (; first != last; ++first) {
+			hash = (hash ^ static_cast<unsigned char>(*first)) * 16777619u;
+		}
+		return hash;
+	}
+	/// Combines the hash of a level name with its parent node.
+	static std::uint32_t _hash(std::uint32_t parent, std::uint32_t level_hash) noexcept
+	{
+		return level_hash ^ (parent * 2654435761u);
+	}
+	/// Returns the slot of the edge or the empty slot where it would be inserted.
+	template<typename Iterator>
+	std::size_t _find_edge(std::uint32_t parent, std::uint32_t hash, Iterator first, Iterator last) const
+	{
+		const auto mask = _edges.size() - 1;
+		const auto size = static_cast<std::uint32_t>(std::distance(first, last));
+		for (auto i = hash & mask;; i = (i + 1) & mask) {
+			const auto& edge = _edges[i];
+			if (edge.child == npos || (edge.hash == hash && edge.parent == parent && edge.size == size &&
+			                           std::equal(first, last, _levels.begin() + edge.offset))) {
+				return i;
+			}
+		}
+	}
+	void _grow_edges()
+	{
+		std::vector<Edge> edges(_edges.size() * 2);
+		const auto mask = edges.size() - 1;
+		for (const auto& edge : _edges) {
+			if (edge.child != npos) {
+				auto i = edge.hash & mask;
+				while (edges[i].child != npos) {
+					i = (i + 1) & mask;
+				}
+				edges[i] = edge;
+			}
+		}
+		_edges = std::move(edges);
+	}
+	std::uint32_t _new_node()
+	{
+		_nodes.emplace_back();
+		return static_cast<std::uint32_t>(_nodes.size() - 1);
+	}
+	std::uint32_t _plus_child(std::uint32_t node)
+	{
+		if (_nodes[node].plus == npos) {
+			const auto child  = _new_node();
+			_nodes[node].plus = child;
+		}
+		return _nodes[node].plus;
+	}
+	std::uint32_t _hash_child(std::uint32_t node)
+	{
+		if (_nodes[node].hash == npos) {
+			const auto child  = _new_node();
+			_nodes[node].hash = child;
+		}
+		return _nodes[node].hash;
+	}
+	template<typename Iterator>
+	std::uint32_t _literal_child(std::uint32_t node, Iterator first, Iterator last)
+	{
+		const auto hash = _hash(node, _hash(first, last));
+		auto index      = _find_edge(node, hash, first, last);
+		if (_edges[index].child != npos) {
+			return _edges[index].child;
+		}
+
+		// keep the load factor at most 1/2
+		if ((_edge_count + 1) * 2 > _edges.size()) {
+			_grow_edges();
+			index = _find_edge(node, hash, first, last);
+		}
+
+		auto& edge  = _edges[index];
+		edge.parent = node;
+		edge.hash   = hash;
+		edge.offset = static_cast<std::uint32_t>(_levels.size());
+		edge.size   = static_cast<std::uint32_t>(std::distance(first, last));
+		_levels.append(first, last);
+		edge.child = _new_node();
+		++_edge_count;
+		return edge.child;
+	}
+	void _collect(std::uint32_t node)
+	{
+		for (auto id = _nodes[node].entries; id != npos; id = _entries[id].next) {
+			_matches.push_back(id);
+		}
+	}
+	template<typename Iterator>
+	void _match(Iterator first, Iterator last)
+	{
+		_matches.clear();
+		_active.assign(1, 0);
+
+		// topics starting with $ are not matched by wildcards on the first level
+		const bool system = first != last && *first == '$';
+		_for_each_level(first, last, [&](Iterator level_first, Iterator level_last) {
+			const auto level_hash = _hash(level_first, level_last);
+			_next.clear();
+			for (const auto node : _active) {
+				const auto& n = _nodes[node];
+				if (!system || node != 0) {
+					if (n.hash != npos) {
+						_collect(n.hash);
+					}
+					if (n.plus != npos) {
+						_next.push_back(n.plus);
+					}
+				}
+
+				const auto& edge = _edges[_find_edge(node, _hash(node, level_hash), level_first, level_last)];
+				if (edge.child != npos) {
+					_next.push_back(edge.child);
+				}
+			}
+			_active.swap(_next);
+			return !_active.empty();
+		});
+
+		for (const auto node : _active) {
+			_collect(node);
+			if (_nodes[node].hash != npos) {
+				_collect(_nodes[node].hash);
+			}
+		}
+	}
+};
+
+template<typename Handler>
+constexpr typename Topic_router<Handler>::Id Topic_router<Handler>::npos;
+
+} // namespace terraqtt
+
+#endif
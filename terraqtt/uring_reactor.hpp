@@ -0,0 +1,773 @@
+#ifndef TERRAQTT_URING_REACTOR_HPP_
+#define TERRAQTT_URING_REACTOR_HPP_
+
+#include "detail/system.hpp"
+#include "epoll_reactor.hpp"
+#include "socket.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace terraqtt {
+namespace detail {
+
+/**
+ * An io_uring instance set up with the raw system calls, so liburing is not needed.
+ *
+ * @private
+ */
+class Uring {
+public:
+	Uring() = default;
+	Uring(const Uring& copy) = delete;
+	~Uring() noexcept { close(); }
+	/**
+	 * Sets up the rings.
+	 *
+	 * @param[out] ec The error of the system call or std::errc::function_not_supported if the kernel lacks
+	 * `IORING_FEAT_NODROP` or `IORING_FEAT_EXT_ARG` (Linux 5.11).
+	 * @param entries The size of the submission queue. The completion queue is four times as large.
+	 */
+	void open(std::error_code& ec, unsigned entries)
+	{
+		close();
+		io_uring_params params{};
+		params.flags      = IORING_SETUP_CQSIZE;
+		params.cq_entries = entries * 4;
+		if ((_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params))) < 0) {
+			ec = last_system_error();
+			return;
+		} else if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+			ec = std::make_error_code(std::errc::function_not_supported);
+			close();
+			return;
+		}
+
+		const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		_sq_size          = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+		_cq_size          = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (single) {
+			_sq_size = _cq_size = std::max(_sq_size, _cq_size);
+		}
+		_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		_sq        = _map(_sq_size, IORING_OFF_SQ_RING);
+		_cq        = single ? _sq : _map(_cq_size, IORING_OFF_CQ_RING);
+		_sqes      = static_cast<io_uring_sqe*>(_map(_sqes_size, IORING_OFF_SQES));
+		if (!_sq || !_cq || !_sqes) {
+			ec = last_system_error();
+			close();
+			return;
+		}
+
+		_sq_head  = _field(_sq, params.sq_off.head);
+		_sq_tail  = _field(_sq, params.sq_off.tail);
+		_sq_mask  = *_field(_sq, params.sq_off.ring_mask);
+		_sq_count = params.sq_entries;
+		_cq_head  = _field(_cq, params.cq_off.head);
+		_cq_tail  = _field(_cq, params.cq_off.tail);
+		_cq_mask  = *_field(_cq, params.cq_off.ring_mask);
+		_cqes     = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(_cq) + params.cq_off.cqes);
+		_tail     = *_sq_tail;
+		// every slot of the submission queue maps to the entry with the same index
+		const auto array = _field(_sq, params.sq_off.array);
+		for (unsigned i = 0; i < params.sq_entries; ++i) {
+			array[i] = i;
+		}
+	}
+	void close() noexcept
+	{
+		if (_sqes) {
+			::munmap(_sqes, _sqes_size);
+		}
+		if (_cq && _cq != _sq) {
+			::munmap(_cq, _cq_size);
+		}
+		if (_sq) {
+			::munmap(_sq, _sq_size);
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+		}
+		_sq = _cq = nullptr;
+		_sqes     = nullptr;
+		_fd       = -1;
+		_pending  = 0;
+	}
+	bool is_open() const noexcept { return _fd >= 0; }
+	/**
+	 * Returns a cleared submission queue entry. The entry is submitted by the next enter().
+	 *
+	 * @returns The entry or `nullptr` if the submission queue is full.
+	 */
+	io_uring_sqe* next() noexcept
+	{
+		if (_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_count) {
+			return nullptr;
+		}
+		const auto sqe = &_sqes[_tail++ & _sq_mask];
+		std::memset(sqe, 0, sizeof(io_uring_sqe));
+		++_pending;
+		return sqe;
+	}
+	/**
+	 * Submits the new entries and waits for completions with a single system call.
+	 *
+	 * @param wait Whether to wait for at least one completion.
+	 * @param timeout Waits at most this long if not `nullptr`.
+	 * @returns `0` or the negative error of the system call. Timeouts and interruptions are no errors.
+	 */
+	int enter(bool wait, const __kernel_timespec* timeout) noexcept
+	{
+		__atomic_store_n(_sq_tail, _tail, __ATOMIC_RELEASE);
+		io_uring_getevents_arg argument{};
+		argument.sigmask_sz = _NSIG / 8;
+		argument.ts         = reinterpret_cast<std::uintptr_t>(timeout);
+		const auto submitted =
+		  ::syscall(__NR_io_uring_enter, _fd, _pending, wait ? 1 : 0,
+		            (wait ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &argument, sizeof(argument));
+		if (submitted >= 0) {
+			_pending -= static_cast<unsigned>(submitted);
+		} else if (errno != ETIME && errno != EINTR) {
+			return -errno;
+		}
+		return 0;
+	}
+	/**
+	 * Consumes the next completion.
+	 *
+	 * @param[out] cqe The completion.
+	 * @returns Whether there was one.
+	 */
+	bool complete(io_uring_cqe& cqe) noexcept
+	{
+		const auto head = *_cq_head;
+		if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+		cqe = _cqes[head & _cq_mask];
+		__atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+	Uring& operator=(const Uring& copy) = delete;
+
+private:
+	int _fd                = -1;
+	void* _sq              = nullptr;
+	void* _cq              = nullptr;
+	io_uring_sqe* _sqes    = nullptr;
+	std::size_t _sq_size   = 0;
+	std::size_t _cq_size   = 0;
+	std::size_t _sqes_size = 0;
+	unsigned* _sq_head     = nullptr;
+	unsigned* _sq_tail     = nullptr;
+	unsigned _sq_mask      = 0;
+	unsigned _sq_count     = 0;
+	unsigned* _cq_head     = nullptr;
+	unsigned* _cq_tail     = nullptr;
+	unsigned _cq_mask      = 0;
+	io_uring_cqe* _cqes    = nullptr;
+	/// The tail including the entries that are not submitted yet.
+	unsigned _tail = 0;
+	/// How many entries wait for submission.
+	unsigned _pending = 0;
+
+	void* _map(std::size_t size, off_t offset) noexcept
+	{
+		const auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, offset);
+		return memory == MAP_FAILED ? nullptr : memory;
+	}
+	static unsigned* _field(void* ring, std::uint32_t offset) noexcept
+	{
+		return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+	}
+};
+
+} // namespace detail
+
+/// The mechanism an Uring_reactor runs on.
+enum class Reactor_backend {
+	io_uring,
+	epoll,
+};
+
+/**
+ * A single threaded, completion based event loop over io_uring with a Timer_wheel for the deadlines. Handlers
+ * start receives and sends on their sockets and are called when these completed. All operations started
+ * during one run_once() are submitted together with the wait for the next completions, so the whole loop
+ * iteration costs a single system call regardless of the number of connections. Uring_client connects a
+ * client to the reactor.
+ *
+ * If io_uring is not available at runtime, because the kernel is older than 5.11 or it is disabled, open()
+ * falls back to `epoll` and performs the operations with `recv()` and `send()` once the socket is ready.
+ * Handlers do not notice the difference.
+ *
+ * @code{.cpp}
+ * Uring_reactor<std::chrono::steady_clock> reactor;
+ * reactor.open(ec);
+ * Uring_client<Advanced_client<Socket_input, Socket_output, ...>> client{ socket };
+ * client.start(ec, reactor);
+ * client.connect(ec, "id", true, std::chrono::seconds{ 30 });
+ * client.flush(ec);
+ * while (!ec) {
+ * 	reactor.run_once(ec);
+ * }
+ * @endcode
+ *
+ * @tparam Clock The clock of the deadlines.
+ */
+template<typename Clock>
+class Uring_reactor {
+public:
+	typedef typename Clock::time_point time_point;
+	typedef Timer_wheel<Clock> Wheel;
+
+	/// Something with a socket waiting for operations or timers of a reactor.
+	class Handler {
+	public:
+		Handler(const Handler& copy) = delete;
+		Handler& operator=(const Handler& copy) = delete;
+
+	protected:
+		Handler() = default;
+		virtual ~Handler() = default;
+
+	private:
+		friend Uring_reactor;
+
+		/// An operation of the handler.
+		struct Operation {
+			void* data       = nullptr;
+			std::size_t size = 0;
+			/// Whether the kernel may still access the data.
+			bool pending = false;
+		};
+
+		int _fd = -1;
+		Operation _receive;
+		Operation _send;
+
+		/**
+		 * Called when a receive completed.
+		 *
+		 * @param result The amount of received bytes, `0` if the peer closed the connection or the negative
+		 * error.
+		 */
+		virtual void on_received(int result) = 0;
+		/**
+		 * Called when a send completed.
+		 *
+		 * @param result The amount of sent bytes or the negative error.
+		 */
+		virtual void on_sent(int result) = 0;
+		/// Called when a timer of the wheel with this handler as context fired.
+		virtual void on_timer() = 0;
+	};
+
+	/**
+	 * Constructor. The reactor must be opened before use.
+	 *
+	 * @param resolution The resolution of the timer wheel.
+	 */
+	explicit Uring_reactor(typename Clock::duration resolution = Wheel::default_resolution())
+	    : _wheel(resolution)
+	{}
+	Uring_reactor(const Uring_reactor& copy) = delete;
+	~Uring_reactor() noexcept { close(); }
+	/**
+	 * Sets up io_uring or falls back to `epoll` if io_uring is not available.
+	 *
+	 * @param[out] ec The error of the system call if the fallback failed as well.
+	 * @param preferred Reactor_backend::epoll skips io_uring.
+	 * @param entries The size of the submission queue. Operations beyond this are submitted early.
+	 */
+	void open(std::error_code& ec, Reactor_backend preferred = Reactor_backend::io_uring,
+	          unsigned entries = 256)
+	{
+		close();
+		if (preferred == Reactor_backend::io_uring) {
+			std::error_code uring_ec;
+			if (_ring.open(uring_ec, entries), !uring_ec) {
+				_backend = Reactor_backend::io_uring;
+				return;
+			}
+		}
+		if ((_epoll = ::epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			ec = detail::last_system_error();
+		}
+		_backend = Reactor_backend::epoll;
+	}
+	/// Closes the reactor. All handlers must have been removed.
+	void close() noexcept
+	{
+		_ring.close();
+		if (_epoll >= 0) {
+			::close(_epoll);
+			_epoll = -1;
+		}
+		_deferred.clear();
+		_deferred_next = 0;
+	}
+	bool is_open() const noexcept { return _ring.is_open() || _epoll >= 0; }
+	/// The backend chosen by open().
+	Reactor_backend backend() const noexcept { return _backend; }
+	/**
+	 * Registers a socket.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param fd The socket. A socket can only be registered once.
+	 * @param[in] handler The handler to call. Must stay alive until it is removed.
+	 */
+	void add(std::error_code& ec, int fd, Handler& handler)
+	{
+		handler._fd = fd;
+		if (_backend == Reactor_backend::epoll) {
+			epoll_event event{};
+			event.events   = EPOLLONESHOT;
+			event.data.ptr = &handler;
+			if (::epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event)) {
+				ec = detail::last_system_error();
+			}
+		}
+	}
+	/**
+	 * Unregisters the socket of the handler. Operations in progress are canceled and this waits until the
+	 * kernel released their buffers without calling the handler. Afterwards the handler may be destroyed,
+	 * even while the reactor calls other handlers.
+	 *
+	 * @param[in] handler The handler.
+	 */
+	void remove(Handler& handler) noexcept
+	{
+		if (_backend == Reactor_backend::io_uring) {
+			_cancel(handler, handler._receive, 0);
+			_cancel(handler, handler._send, 1);
+			for (auto i = _deferred_next; i < _deferred.size(); ++i) {
+				if (_settle(handler, _deferred[i])) {
+					_deferred[i].user_data = 0;
+				}
+			}
+			io_uring_cqe cqe;
+			while (true) {
+				while (_ring.complete(cqe)) {
+					if (!_settle(handler, cqe)) {
+						_deferred.push_back(cqe);
+					}
+				}
+				if ((!handler._receive.pending && !handler._send.pending) || _ring.enter(true, nullptr)) {
+					break;
+				}
+			}
+		} else if (_epoll >= 0) {
+			epoll_event event{};
+			::epoll_ctl(_epoll, EPOLL_CTL_DEL, handler._fd, &event);
+			if (_dispatching == &handler) {
+				_dispatching = nullptr;
+			}
+			for (auto i = _next; i < _count; ++i) {
+				if (_events[i].data.ptr == &handler) {
+					_events[i].data.ptr = nullptr;
+				}
+			}
+		}
+		handler._receive.pending = false;
+		handler._send.pending    = false;
+		handler._fd              = -1;
+	}
+	/**
+	 * Starts receiving into the buffer. At most one receive per handler may be in progress.
+	 *
+	 * @param[in] handler The handler.
+	 * @param[out] buffer The buffer. Must stay valid until Handler::on_received() or remove().
+	 * @param size The size of the buffer.
+	 */
+	void receive(Handler& handler, void* buffer, std::size_t size) noexcept
+	{
+		_start(handler, handler._receive, buffer, size, IORING_OP_RECV, 0);
+	}
+	/**
+	 * Starts sending the data. At most one send per handler may be in progress.
+	 *
+	 * @param[in] handler The handler.
+	 * @param data The data. Must stay valid until Handler::on_sent() or remove().
+	 * @param size The size of the data.
+	 */
+	void send(Handler& handler, const void* data, std::size_t size) noexcept
+	{
+		_start(handler, handler._send, const_cast<void*>(data), size, IORING_OP_SEND, 1);
+	}
+	/**
+	 * Submits the started operations, waits until an operation completed, the next timer is due or the deadline
+	 * passed and calls the handlers. Timers that are due are fired afterwards.
+	 *
+	 * @param[out] ec The error of the system call.
+	 * @param deadline Returns at the latest at this time.
+	 * @returns The amount of completed operations and fired timers.
+	 */
+	std::size_t run_once(std::error_code& ec, time_point deadline = time_point::max())
+	{
+		deadline               = std::min(deadline, _wheel.next_deadline());
+		std::size_t dispatched = _backend == Reactor_backend::io_uring ? _run_uring(ec, deadline)
+		                                                               : _run_epoll(ec, deadline);
+		return dispatched + _wheel.expire(Clock::now(), [](typename Wheel::Timer& timer) {
+			       static_cast<Handler*>(timer.context())->on_timer();
+		       });
+	}
+	/// The wheel of the deadlines. The context of its timers must be the Handler to call.
+	Wheel& wheel() noexcept { return _wheel; }
+	Uring_reactor& operator=(const Uring_reactor& copy) = delete;
+
+private:
+	constexpr static std::size_t max_events = 64;
+
+	detail::Uring _ring;
+	Reactor_backend _backend = Reactor_backend::io_uring;
+	Wheel _wheel;
+	/// Completions collected by remove() for later dispatching.
+	std::vector<io_uring_cqe> _deferred;
+	/// The next deferred completion run_once() dispatches.
+	std::size_t _deferred_next = 0;
+	int _epoll = -1;
+	epoll_event _events[max_events];
+	/// The amount of events of the current run of the `epoll` backend.
+	std::size_t _count = 0;
+	/// The next event the `epoll` backend dispatches.
+	std::size_t _next = 0;
+	/// The handler the `epoll` backend is calling; its socket is armed once afterwards.
+	Handler* _dispatching = nullptr;
+
+	/// The user data of an operation: the handler with the lowest bit set for sends.
+	static std::uint64_t _user_data(Handler& handler, unsigned operation) noexcept
+	{
+		return reinterpret_cast<std::uintptr_t>(&handler) | operation;
+	}
+	void _start(Handler& handler, typename Handler::Operation& operation, void* data, std::size_t size,
+	            std::uint8_t opcode, unsigned tag) noexcept
+	{
+		operation.data    = data;
+		operation.size    = size;
+		operation.pending = true;
+		if (_backend == Reactor_backend::epoll) {
+			if (_dispatching != &handler) {
+				_arm(handler);
+			}
+			return;
+		}
+
+		const auto sqe = _sqe();
+		sqe->opcode    = opcode;
+		sqe->fd        = handler._fd;
+		sqe->addr      = reinterpret_cast<std::uintptr_t>(data);
+		sqe->len       = static_cast<std::uint32_t>(std::min<std::size_t>(size, 0x7fffffff));
+		sqe->msg_flags = tag ? MSG_NOSIGNAL : 0;
+		sqe->user_data = _user_data(handler, tag);
+	}
+	/// Returns the next submission queue entry and submits the queue early if it is full.
+	io_uring_sqe* _sqe() noexcept
+	{
+		io_uring_sqe* sqe;
+		while (!(sqe = _ring.next())) {
+			_ring.enter(false, nullptr);
+		}
+		return sqe;
+	}
+	void _cancel(Handler& handler, typename Handler::Operation& operation, unsigned tag) noexcept
+	{
+		if (operation.pending) {
+			const auto sqe = _sqe();
+			sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+			sqe->fd        = -1;
+			sqe->addr      = _user_data(handler, tag);
+			sqe->user_data = 0;
+		}
+	}
+	/// Marks the operation of the completion as done if it belongs to the handler.
+	static bool _settle(Handler& handler, const io_uring_cqe& cqe) noexcept
+	{
+		if ((cqe.user_data & ~std::uint64_t{ 1 }) != reinterpret_cast<std::uintptr_t>(&handler)) {
+			return false;
+		}
+		(cqe.user_data & 1 ? handler._send : handler._receive).pending = false;
+		return true;
+	}
+	void _dispatch(const io_uring_cqe& cqe)
+	{
+		if (const auto handler = reinterpret_cast<Handler*>(cqe.user_data & ~std::uint64_t{ 1 })) {
+			if (cqe.user_data & 1) {
+				handler->_send.pending = false;
+				handler->on_sent(cqe.res);
+			} else {
+				handler->_receive.pending = false;
+				handler->on_received(cqe.res);
+			}
+		}
+	}
+	std::size_t _run_uring(std::error_code& ec, time_point deadline)
+	{
+		const auto now  = Clock::now();
+		const bool wait = _deferred.empty() && deadline > now;
+		__kernel_timespec timeout{};
+		if (wait && deadline != time_point::max()) {
+			const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+			timeout.tv_sec  = left / 1000000000;
+			timeout.tv_nsec = left % 1000000000;
+		}
+		if (const auto error = _ring.enter(wait, deadline == time_point::max() ? nullptr : &timeout)) {
+			ec = { -error, std::system_category() };
+			return 0;
+		}
+
+		// completions collected by remove() first, including those collected while dispatching
+		std::size_t dispatched = 0;
+		io_uring_cqe cqe;
+		while (true) {
+			if (_deferred_next < _deferred.size()) {
+				cqe = _deferred[_deferred_next++];
+			} else if (!_ring.complete(cqe)) {
+				break;
+			}
+			dispatched += cqe.user_data != 0;
+			_dispatch(cqe);
+		}
+		_deferred.clear();
+		_deferred_next = 0;
+		return dispatched;
+	}
+	/// Waits for the pending operations of the handler with `EPOLLONESHOT`.
+	void _arm(Handler& handler) noexcept
+	{
+		epoll_event event{};
+		event.events = EPOLLONESHOT;
+		if (handler._receive.pending) {
+			event.events |= EPOLLIN;
+		}
+		if (handler._send.pending) {
+			event.events |= EPOLLOUT;
+		}
+		event.data.ptr = &handler;
+		::epoll_ctl(_epoll, EPOLL_CTL_MOD, handler._fd, &event);
+	}
+	std::size_t _run_epoll(std::error_code& ec, time_point deadline)
+	{
+		const int wait = ::epoll_wait(_epoll, _events, max_events, detail::wait_timeout<Clock>(deadline));
+		if (wait < 0) {
+			if (errno != EINTR) {
+				ec = detail::last_system_error();
+			}
+			return 0;
+		}
+
+		std::size_t dispatched = 0;
+		_count                 = static_cast<std::size_t>(wait);
+		for (_next = 0; _next < _count;) {
+			const auto events = _events[_next].events;
+			_dispatching      = static_cast<Handler*>(_events[_next++].data.ptr);
+			if (_dispatching && _dispatching->_receive.pending && events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				dispatched += _perform(*_dispatching, _dispatching->_receive, false);
+			}
+			if (_dispatching && _dispatching->_send.pending && events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				dispatched += _perform(*_dispatching, _dispatching->_send, true);
+			}
+			// without pending operations the socket stays disarmed until the next one starts
+			if (_dispatching && (_dispatching->_receive.pending || _dispatching->_send.pending)) {
+				_arm(*_dispatching);
+			}
+		}
+		_count       = 0;
+		_dispatching = nullptr;
+		return dispatched;
+	}
+	/// Performs the operation of the ready socket and calls the handler unless it would block.
+	static bool _perform(Handler& handler, typename Handler::Operation& operation, bool send)
+	{
+		ssize_t result;
+		do {
+			result = send ? ::send(handler._fd, operation.data, operation.size, MSG_DONTWAIT | MSG_NOSIGNAL)
+			              : ::recv(handler._fd, operation.data, operation.size, MSG_DONTWAIT);
+		} while (result < 0 && errno == EINTR);
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return false;
+		}
+
+		const int value   = result < 0 ? -errno : static_cast<int>(result);
+		operation.pending = false;
+		send ? handler.on_sent(value) : handler.on_received(value);
+		return true;
+	}
+};
+
+/**
+ * Runs a client over a socket on an Uring_reactor. The client reads from a Socket_input and writes to a
+ * Socket_output like with Reactor_client, but a receive directly into the buffer of the input is always in
+ * progress and the output is sent asynchronously with Socket_output::begin_send(). Received bytes are
+ * processed with Basic_client::process_all() and after every completion the written packets are sent as one
+ * contiguous send while the next packets are collected behind it.
+ *
+ * Packets written outside of the callbacks of the client are sent by flush().
+ *
+ * @tparam Client The client type, like Advanced_client or Persistent_client, with Socket_input and
+ * Socket_output as input and output.
+ */
+template<typename Client>
+class Uring_client : private detail::Socket_streams,
+                     public Client,
+                     private Uring_reactor<typename Client::Clock_type>::Handler {
+public:
+	typedef Uring_reactor<typename Client::Clock_type> Reactor;
+
+	/**
+	 * Constructor.
+	 *
+	 * @param socket The connected socket. It is not owned.
+	 * @param args The arguments for the client before its input and output.
+	 */
+	template<typename... Args>
+	explicit Uring_client(int socket, Args&&... args)
+	    : detail::Socket_streams{ socket, 16 * 1024, 16 * 1024 },
+	      Client{ std::forward<Args>(args)..., socket_input, socket_output }
+	{}
+	/// Stops and disconnects. The DISCONNECT packet is only sent if the socket takes it right away.
+	~Uring_client() noexcept
+	{
+		stop();
+		std::error_code ec;
+		this->disconnect(ec);
+		socket_output.flush();
+	}
+	/**
+	 * Registers the socket and the timers with the reactor and starts receiving.
+	 *
+	 * @param[out] ec The error code if any.
+	 * @param[in] reactor The reactor. Must outlive the client or the client must be stopped.
+	 */
+	void start(std::error_code& ec, Reactor& reactor)
+	{
+		stop();
+		if (reactor.add(ec, socket_input.socket(), _handler()), !ec) {
+			_reactor = &reactor;
+			socket_output.defer(true);
+			this->attach(&reactor.wheel(), &_handler());
+			_receive(ec);
+		}
+	}
+	/// Unregisters from the reactor. Packets that were not sent yet stay in the output.
+	void stop() noexcept
+	{
+		if (_reactor) {
+			_reactor->remove(_handler());
+			_reactor = nullptr;
+			this->attach(nullptr, nullptr);
+			if (socket_output.sending()) {
+				socket_output.end_send(0);
+			}
+			socket_output.defer(false);
+		}
+	}
+#if defined(__cpp_exceptions)
+	void flush()
+	{
+		std::error_code ec;
+		if (flush(ec), ec) {
+			throw std::system_error{ ec };
+		}
+	}
+#endif
+	/**
+	 * Starts sending the written packets unless a send is already in progress; the packets written in the
+	 * meantime follow once it completed.
+	 *
+	 * @param[out] ec The error code if any.
+	 */
+	void flush(std::error_code& ec)
+	{
+		if (Client::flush(ec), !ec && _reactor) {
+			if (const auto size = socket_output.begin_send()) {
+				_reactor->send(_handler(), socket_output.sending_data(), size);
+			}
+		}
+	}
+	bool is_started() const noexcept { return _reactor; }
+
+protected:
+	/**
+	 * Called when receiving, processing, sending or updating the state failed from within the reactor. The
+	 * client is already stopped and may be destroyed in here.
+	 *
+	 * @param ec The error.
+	 */
+	virtual void on_error(const std::error_code& ec) {}
+
+private:
+	Reactor* _reactor = nullptr;
+
+	typename Reactor::Handler& _handler() noexcept { return *this; }
+	void on_received(int result) override
+	{
+		std::error_code ec;
+		if (result > 0) {
+			socket_input.commit(static_cast<std::size_t>(result));
+			if (this->process_all(ec, socket_input.available()), !ec) {
+				_receive(ec);
+			}
+		} else {
+			ec = result ? std::error_code{ -result, std::system_category() } : Error::connection_closed;
+		}
+		_after(ec);
+	}
+	void on_sent(int result) override
+	{
+		std::error_code ec;
+		socket_output.end_send(result > 0 ? static_cast<std::size_t>(result) : 0);
+		if (result < 0) {
+			ec = { -result, std::system_category() };
+			socket_output.fail(ec);
+		}
+		_after(ec);
+	}
+	void on_timer() override
+	{
+		std::error_code ec;
+		this->update_state(ec);
+		_after(ec);
+	}
+	void _receive(std::error_code& ec)
+	{
+		std::size_t size;
+		const auto buffer = socket_input.prepare(size);
+		if (!_reactor) {
+			return;
+		} else if (!size) {
+			ec = std::make_error_code(std::errc::no_buffer_space);
+		} else {
+			_reactor->receive(_handler(), buffer, size);
+		}
+	}
+	void _after(std::error_code& ec)
+	{
+		if (!ec) {
+			flush(ec);
+		}
+		if (ec) {
+			stop();
+			on_error(ec);
+		}
+	}
+};
+
+} // namespace terraqtt
+
+#endif
@@ -0,0 +1,302 @@
+#include "common.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <malloc.h>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/packet_identifier_set.hpp>
+#include <terraqtt/string_view.hpp>
+#include <vector>
+
+using namespace terraqtt;
+using test::ack;
+using test::Manual_clock;
+using test::Null_output;
+
+namespace {
+
+typedef Advanced_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+                        Manual_clock>
+  Base;
+
+class Client : public Base {
+public:
+	using Base::Base;
+
+	std::vector<std::uint16_t> delivered;
+
+	/// Feeds the packet to the client.
+	void receive(const std::string& packet)
+	{
+		auto& input = static_cast<std::stringstream&>(*this->input());
+		input.clear();
+		input.str(packet);
+		std::error_code ec;
+		process_all(ec, packet.size());
+		REQUIRE(!ec);
+	}
+
+protected:
+	void on_delivered(std::error_code& ec, std::uint16_t packet_id) override { delivered.push_back(packet_id); }
+};
+
+/// Takes everything written so far.
+inline std::string take(std::stringstream& output)
+{
+	auto data = output.str();
+	output.str({});
+	return data;
+}
+
+} // namespace
+
+TEST_CASE("packet identifier set")
+{
+	Packet_identifier_set set;
+	std::set<std::uint16_t> ids;
+	for (std::size_t i = 0; i < 65535; ++i) {
+		ids.insert(set.acquire());
+	}
+	REQUIRE(ids.size() == 65535);
+	REQUIRE(!ids.count(0));
+	REQUIRE(set.full());
+	REQUIRE(!set.acquire());
+
+	// released identifiers are handed out again
+	set.release(4711);
+	set.release(12);
+	REQUIRE(set.acquire() == 12);
+	REQUIRE(set.acquire() == 4711);
+
+	// round robin
+	Packet_identifier_set small{ 100 };
+	REQUIRE(small.capacity() == 100);
+	REQUIRE(small.acquire() == 1);
+	REQUIRE(small.acquire() == 2);
+	small.release(1);
+	REQUIRE(small.acquire() == 3);
+	REQUIRE(small.acquire(1));
+	REQUIRE(!small.acquire(1));
+	REQUIRE(!small.acquire(101));
+	while (small.acquire()) {}
+	REQUIRE(small.size() == 100);
+	REQUIRE(!small.contains(101));
+}
+
+TEST_CASE("deliver at least once")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+
+	std::error_code ec;
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }) == 0);
+	REQUIRE(client.in_flight() == 0);
+	take(output);
+
+	const auto id = client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	REQUIRE(!ec);
+	REQUIRE(id == 1);
+	REQUIRE(client.is_in_flight(id));
+	REQUIRE(take(output) == std::string("\x32\x06\x00\x01" "a\x00\x01x", 8));
+
+	// unknown identifiers are ignored
+	client.receive(ack(0x40, 2));
+	REQUIRE(client.in_flight() == 1);
+
+	client.receive(ack(0x40, id));
+	REQUIRE(client.in_flight() == 0);
+	REQUIRE(client.delivered == std::vector<std::uint16_t>{ id });
+}
+
+TEST_CASE("deliver exactly once")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+
+	std::error_code ec;
+	const auto id = client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::exactly_once, true);
+	REQUIRE(take(output) == std::string("\x35\x06\x00\x01" "a\x00\x01x", 8));
+
+	// a PUBACK does not complete the flow
+	client.receive(ack(0x40, id));
+	REQUIRE(client.in_flight() == 1);
+
+	client.receive(ack(0x50, id));
+	REQUIRE(take(output) == ack(0x62, id));
+	REQUIRE(client.delivered.empty());
+
+	client.receive(ack(0x70, id));
+	REQUIRE(client.in_flight() == 0);
+	REQUIRE(client.delivered == std::vector<std::uint16_t>{ id });
+}
+
+TEST_CASE("retransmit unacknowledged messages")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+	client.retransmit_timeout(std::chrono::seconds{ 5 });
+
+	std::error_code ec;
+	const auto first = client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	Manual_clock::current += std::chrono::seconds{ 2 };
+	const auto second = client.publish(ec, String_view{ "b" }, String_view{ "y" }, QoS::exactly_once);
+	client.receive(ack(0x50, second));
+	take(output);
+
+	Manual_clock::current += std::chrono::seconds{ 3 };
+	client.update_state(ec);
+	REQUIRE(!ec);
+	REQUIRE(take(output) == std::string("\x3a\x06\x00\x01" "a\x00\x01x", 8));
+
+	// the PUBREL is sent again without DUP
+	Manual_clock::current += std::chrono::seconds{ 2 };
+	client.update_state(ec);
+	REQUIRE(take(output) == ack(0x62, second));
+
+	client.retransmit_all(ec);
+	REQUIRE(take(output) == std::string("\x3a\x06\x00\x01" "a\x00\x01x", 8) + ack(0x62, second));
+	REQUIRE(client.in_flight() == 2);
+	REQUIRE(first == 1);
+}
+
+TEST_CASE("next retransmission deadline")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+	client.retransmit_timeout(std::chrono::seconds{ 5 });
+	REQUIRE(client.next_deadline() == Manual_clock::time_point::max());
+
+	std::error_code ec;
+	client.connect(ec, String_view{ "id" }, true, Seconds{ 60 });
+	const auto first = client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 5 });
+	Manual_clock::current += std::chrono::seconds{ 2 };
+	client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 3 });
+
+	client.receive(ack(0x40, first));
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 5 });
+}
+
+TEST_CASE("exhaust packet identifiers")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output, 2 };
+
+	std::error_code ec;
+	REQUIRE(client.acquire_packet_identifier(ec) == 1);
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 2);
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 0);
+	REQUIRE(ec == Error::packet_identifiers_exhausted);
+
+	// acknowledgements for reserved identifiers are ignored
+	client.receive(ack(0x40, 1));
+	client.release_packet_identifier(1);
+	ec.clear();
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 1);
+	REQUIRE(client.in_flight() == 2);
+}
+
+TEST_CASE("limit the messages in flight")
+{
+	class Limited_client : public Client {
+	public:
+		using Client::Client;
+
+		std::size_t writable = 0;
+
+	protected:
+		void on_writable(std::error_code& ec) override { ++writable; }
+	};
+
+	std::stringstream input;
+	std::stringstream output;
+	Limited_client client{ input, output };
+	Flow_limits limits;
+	limits.max_in_flight = 2;
+	client.flow_limits(limits);
+
+	std::error_code ec;
+	client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::exactly_once);
+	REQUIRE(!ec);
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 0);
+	REQUIRE(ec == Error::would_block);
+	REQUIRE(client.window().in_flight == 2);
+
+	// messages without acknowledgement are not limited
+	ec.clear();
+	client.publish(ec, String_view{ "a" }, String_view{ "x" });
+	REQUIRE(!ec);
+
+	client.receive(ack(0x40, 1));
+	REQUIRE(client.writable == 1);
+	REQUIRE(client.window().in_flight == 1);
+	REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 3);
+}
+
+TEST_CASE("bound the memory of the in-flight table")
+{
+	std::stringstream input;
+	std::stringstream output;
+	const auto before = ::mallinfo2().uordblks;
+	std::unique_ptr<Client> client{ new Client{ input, output } };
+	const auto per_client = ::mallinfo2().uordblks - before;
+	CAPTURE(sizeof(Client), per_client);
+	REQUIRE(per_client < 16 * 1024);
+
+	// the identifiers rotate but the stored messages are reused
+	const std::string payload(1024, 'x');
+	const auto publish = [&] {
+		std::error_code ec;
+		const auto id = client->publish(ec, String_view{ "a" }, payload, QoS::at_least_once);
+		REQUIRE(id);
+		client->receive(ack(0x40, id));
+		take(output);
+	};
+	publish();
+	const auto settled = ::mallinfo2().uordblks;
+	for (int i = 0; i < 1000; ++i) {
+		publish();
+	}
+	CAPTURE(::mallinfo2().uordblks - settled);
+	REQUIRE(::mallinfo2().uordblks < settled + 16 * 1024);
+}
+
+TEST_CASE("in-flight table", "[.benchmark]")
+{
+	constexpr std::size_t messages = 65535;
+	std::string acks;
+	for (std::size_t i = 1; i <= messages; ++i) {
+		acks += ack(0x40, static_cast<std::uint16_t>(i));
+	}
+
+	std::istringstream input;
+	Null_output output;
+	Advanced_client<std::istream, Null_output, std::string, std::vector<protocol::Suback_return_code>,
+	                std::chrono::steady_clock>
+	  client{ input, output, Packet_identifier_set::max_capacity };
+	const std::string payload(32, 'x');
+
+	BENCHMARK("64k outstanding messages")
+	{
+		std::error_code ec;
+		for (std::size_t i = 0; i < messages; ++i) {
+			client.publish(ec, String_view{ "telemetry" }, payload, QoS::at_least_once);
+		}
+		const auto outstanding = client.in_flight();
+		input.clear();
+		input.str(acks);
+		client.process_all(ec, acks.size());
+		return outstanding - client.in_flight();
+	};
+}
@@ -1,12 +1,19 @@
 #define CATCH_CONFIG_MAIN
 
+#include "common.hpp"
+
+#include <algorithm>
 #include <catch2/catch.hpp>
+#include <chrono>
 #include <sstream>
+#include <string>
 #include <terraqtt/client.hpp>
 #include <terraqtt/static_container.hpp>
 #include <terraqtt/string_view.hpp>
+#include <vector>
 
 using namespace terraqtt;
+using test::Manual_clock;
 
 using Parent = Basic_client<std::istream, std::ostream, Static_container<64, char>,
                             Static_container<1, protocol::Suback_return_code>, std::chrono::steady_clock>;
@@ -37,3 +44,245 @@ TEST_CASE("connect")
 	client.connect(ec, String_view{ "name" }, true, Seconds{ 30 });
 	compare(output.str(), "\x10\x10\x00\x04MQTT\x04\x02\x00\x1e\x00\x04name");
 }
+
+TEST_CASE("publish with template")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Parent client{ input, output };
+
+	const protocol::Publish_template<Static_container<8, char>> publish{ String_view{ "a/b" },
+		                                                                   QoS::at_least_once };
+	std::error_code ec;
+	client.publish(ec, publish, String_view{ "hi" }, 7);
+	REQUIRE(!ec);
+	compare(output.str(), "\x32\x09\x00\x03\x61/b\x00\x07hi");
+}
+
+TEST_CASE("publish payload in place")
+{
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+		std::string payload;
+		bool streamed = false;
+
+	protected:
+		void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+		                std::istream& payload, std::size_t payload_size) override
+		{
+			streamed = true;
+		}
+		void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+		                const char* payload, std::size_t payload_size) override
+		{
+			this->payload.assign(payload, payload_size);
+		}
+	};
+
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+	input.write("\x30\x0c\x00\x05" "a/b/c" "hello" "\xd0\x00", 16);
+
+	std::error_code ec;
+	REQUIRE(client.process_one(ec, 16) == 14);
+	REQUIRE(!ec);
+	REQUIRE(!client.streamed);
+	REQUIRE(client.payload == "hello");
+	REQUIRE(input.peek() == 0xd0);
+}
+
+TEST_CASE("acknowledge automatically")
+{
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+		std::vector<std::uint16_t> received;
+
+	protected:
+		void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+		                const char* payload, std::size_t payload_size) override
+		{
+			received.push_back(header.packet_identifier);
+		}
+	};
+
+	/// Counts the calls to write().
+	class Counting_buffer : public std::stringbuf {
+	public:
+		std::size_t writes = 0;
+
+	protected:
+		std::streamsize xsputn(const char_type* data, std::streamsize size) override
+		{
+			++writes;
+			return std::stringbuf::xsputn(data, size);
+		}
+	};
+
+	std::stringstream input;
+	Counting_buffer buffer;
+	std::ostream output{ &buffer };
+	Client client{ input, output };
+	client.auto_acknowledge(true);
+
+	// QoS 1, QoS 2, redelivered QoS 2, PUBREL and QoS 2 with the released identifier
+	input.write("\x32\x06\x00\x01" "a\x00\x05x" "\x34\x06\x00\x01" "a\x00\x06x" "\x3c\x06\x00\x01" "a\x00\x06x"
+	            "\x62\x02\x00\x06" "\x34\x06\x00\x01" "a\x00\x06x",
+	            36);
+
+	std::error_code ec;
+	const auto stats = client.process_all(ec, 36);
+	REQUIRE(!ec);
+	REQUIRE(stats.packets == 5);
+	REQUIRE(client.received == std::vector<std::uint16_t>{ 5, 6, 6 });
+	REQUIRE(buffer.writes == 1);
+	compare(buffer.str(), "\x40\x02\x00\x05\x50\x02\x00\x06\x50\x02\x00\x06\x70\x02\x00\x06\x50\x02\x00\x06");
+
+	client.auto_acknowledge(false);
+	input.write("\x32\x06\x00\x01" "a\x00\x07x", 8);
+	client.process_all(ec, 8);
+	REQUIRE(buffer.writes == 1);
+}
+
+TEST_CASE("write pending acknowledgements when disabled")
+{
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+	protected:
+		void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+		                const char* payload, std::size_t payload_size) override
+		{
+			if (header.packet_identifier == 2) {
+				auto_acknowledge(ec, false);
+			}
+		}
+	};
+
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+	std::error_code ec;
+	client.auto_acknowledge(ec, true);
+
+	// the PUBACK of the first message is still collected when the second one disables it
+	input.write("\x32\x06\x00\x01" "a\x00\x01x" "\x32\x06\x00\x01" "a\x00\x02x", 16);
+	client.process_all(ec, 16);
+	REQUIRE(!ec);
+	REQUIRE(!client.auto_acknowledge());
+	compare(output.str(), "\x40\x02\x00\x01");
+}
+
+TEST_CASE("process all buffered packets")
+{
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+		std::vector<std::string> topics;
+
+	protected:
+		void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+		                const char* payload, std::size_t payload_size) override
+		{
+			topics.emplace_back(header.topic.begin(), header.topic.end());
+		}
+	};
+
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ input, output };
+	for (int i = 0; i < 3; ++i) {
+		input.write("\x30\x06\x00\x01", 4);
+		input.put(static_cast<char>('a' + i));
+		input.write("xyz", 3);
+	}
+	input.write("\xd0\x00\x40\x02\x00", 5);
+
+	std::error_code ec;
+	auto stats = client.process_until(ec, 29, 2);
+	REQUIRE(!ec);
+	REQUIRE(stats.packets == 2);
+	REQUIRE(stats.bytes == 16);
+
+	stats = client.process_all(ec, 13);
+	REQUIRE(!ec);
+	REQUIRE(stats.packets == 2);
+	REQUIRE(stats.bytes == 13);
+	REQUIRE(client.topics == std::vector<std::string>{ "a", "b", "c" });
+
+	// complete the partial PUBACK
+	input.put('\x01');
+	stats = client.process_all(ec, 1);
+	REQUIRE(!ec);
+	REQUIRE(stats.packets == 1);
+	REQUIRE(stats.bytes == 1);
+}
+
+TEST_CASE("keep alive with traffic")
+{
+	typedef Manual_clock Clock;
+	std::stringstream input;
+	std::stringstream output;
+	Basic_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>, Clock>
+	  client{ input, output };
+	client.ping_timeout(std::chrono::seconds{ 3 });
+	const auto start = Clock::now();
+	const auto pings = [&] {
+		const auto data = output.str();
+		return std::count(data.begin(), data.end(), '\xc0');
+	};
+	const auto receive = [&](const std::string& packet) {
+		input.clear();
+		input.str(packet);
+		std::error_code ec;
+		client.process_all(ec, packet.size());
+		REQUIRE(!ec);
+	};
+
+	std::error_code ec;
+	client.connect(ec, String_view{ "id" }, true, Seconds{ 10 });
+
+	// publishing keeps the connection alive
+	Clock::current = start + std::chrono::seconds{ 6 };
+	client.publish(ec, String_view{ "a" }, String_view{ "x" });
+	Clock::current = start + std::chrono::seconds{ 12 };
+	client.update_state(ec);
+	REQUIRE(pings() == 0);
+	REQUIRE(client.next_deadline() == start + std::chrono::seconds{ 16 });
+
+	Clock::current = start + std::chrono::seconds{ 16 };
+	client.update_state(ec);
+	REQUIRE(pings() == 1);
+	REQUIRE(client.next_deadline() == start + std::chrono::seconds{ 19 });
+	Clock::current = start + std::chrono::seconds{ 17 };
+	receive(std::string("\xd0\x00", 2));
+	REQUIRE(client.round_trip_time() == std::chrono::seconds{ 1 });
+
+	// any packet ends the ping timeout
+	Clock::current = start + std::chrono::seconds{ 27 };
+	client.update_state(ec);
+	REQUIRE(pings() == 2);
+	Clock::current = start + std::chrono::seconds{ 29 };
+	receive(std::string("\x40\x02\x00\x01", 4));
+	Clock::current = start + std::chrono::seconds{ 31 };
+	client.update_state(ec);
+	REQUIRE(!ec);
+
+	// the late PINGRESP still counts as sample
+	receive(std::string("\xd0\x00", 2));
+	REQUIRE(client.round_trip_time() == std::chrono::milliseconds{ 1375 });
+
+	// no answer
+	Clock::current = start + std::chrono::seconds{ 41 };
+	client.update_state(ec);
+	REQUIRE(pings() == 3);
+	Clock::current = start + std::chrono::milliseconds{ 44001 };
+	client.update_state(ec);
+	REQUIRE(ec == Error::connection_timed_out);
+}
@@ -0,0 +1,216 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <string>
+#include <terraqtt/buffer_input.hpp>
+#include <terraqtt/client.hpp>
+#include <terraqtt/static_container.hpp>
+
+using namespace terraqtt;
+using namespace terraqtt::protocol;
+
+namespace {
+
+typedef Static_container<64, char> Topic;
+typedef Static_container<1, Suback_return_code> Return_codes;
+
+template<std::size_t Size>
+inline std::string packet(const char (&data)[Size])
+{
+	return { data, Size - 1 };
+}
+
+template<typename Header>
+struct Decoder {
+	Header header{};
+
+	template<typename Input>
+	bool operator()(Input& input, std::error_code& ec, Read_context& context)
+	{
+		return read_packet(input, ec, context, header);
+	}
+};
+
+template<>
+struct Decoder<Publish_header<Topic>> {
+	Publish_header<Topic> header{};
+	Variable_integer_type payload_size = 0;
+
+	template<typename Input>
+	bool operator()(Input& input, std::error_code& ec, Read_context& context)
+	{
+		if (!read_packet(input, ec, context, header, payload_size)) {
+			return false;
+		}
+		char payload[64];
+		input.read(payload, payload_size);
+		context.available -= payload_size;
+		return true;
+	}
+};
+
+/// Decodes all packets of `count` bytes and returns how many were decoded.
+template<typename Header, typename Input>
+inline std::size_t decode_all(Input& input, std::size_t count)
+{
+	std::error_code ec;
+	Read_context context{};
+	context.available = count;
+	std::size_t decoded = 0;
+	while (context.available && !ec) {
+		Decoder<Header> decoder;
+		context.clear();
+		decoded += decoder(input, ec, context);
+	}
+	return decoded;
+}
+
+template<typename Header>
+inline void benchmark_packet(const char* name, const std::string& packet)
+{
+	constexpr std::size_t repeat = 1000;
+	std::string data;
+	for (std::size_t i = 0; i < repeat; ++i) {
+		data += packet;
+	}
+
+	std::istringstream stream{ data };
+	BENCHMARK(std::string{ "stream " } + name)
+	{
+		stream.clear();
+		stream.seekg(0);
+		return decode_all<Header>(stream, data.size());
+	};
+
+	Buffer_input buffer;
+	BENCHMARK(std::string{ "buffer " } + name)
+	{
+		buffer.assign(data.data(), data.size());
+		return decode_all<Header>(buffer, data.size());
+	};
+}
+
+} // namespace
+
+TEST_CASE("buffer input reads like a stream")
+{
+	const char data[] = "\x01\x02\x03";
+	Buffer_input input{ data, 3 };
+
+	REQUIRE(input.peek() == 1);
+	REQUIRE(input.get() == 1);
+	REQUIRE(input.consumed() == 1);
+	REQUIRE(input.available() == 2);
+
+	char buffer[4]{};
+	REQUIRE(input.read(buffer, 2));
+	REQUIRE(buffer[0] == 2);
+	REQUIRE(buffer[1] == 3);
+	REQUIRE(input.good());
+
+	REQUIRE(input.peek() == std::char_traits<char>::eof());
+	REQUIRE(input);
+	REQUIRE(!input.read(buffer, 1));
+	REQUIRE(input.consumed() == 3);
+}
+
+TEST_CASE("decode packets from a buffer")
+{
+	std::error_code ec;
+	Buffer_input input;
+	Read_context context{};
+
+	const auto suback = packet("\x90\x03\x00\x81\x01");
+	input.assign(suback.data(), suback.size());
+	context.available = suback.size();
+	Suback_header<Return_codes> header{};
+	REQUIRE(read_packet(input, ec, context, header));
+	REQUIRE(!ec);
+	REQUIRE(header.packet_identifier == 0x81);
+	REQUIRE(header.return_codes.size() == 1);
+	REQUIRE(*header.return_codes.begin() == Suback_return_code::success1);
+	REQUIRE(input.consumed() == suback.size());
+	REQUIRE(context.available == 0);
+}
+
+TEST_CASE("resume decoding across buffers")
+{
+	std::error_code ec;
+	Buffer_input input;
+	Read_context context{};
+	Puback_header header{};
+
+	const auto puback = packet("\x40\x02\x12\x34");
+	for (std::size_t i = 0; i < puback.size(); ++i) {
+		input.assign(puback.data() + i, 1);
+		context.available = 1;
+		REQUIRE(read_packet(input, ec, context, header) == (i + 1 == puback.size()));
+		REQUIRE(!ec);
+		REQUIRE(input.consumed() == 1);
+	}
+	REQUIRE(header.packet_identifier == 0x1234);
+
+	const auto publish = packet("\x32\x0e\x00\x05" "a/b/c" "\x00\x01" "hello");
+	Publish_header<std::string> publish_header{};
+	Variable_integer_type payload_size = 0;
+	context.clear();
+	for (std::size_t i = 0; i < 11; ++i) {
+		input.assign(publish.data() + i, 1);
+		context.available = 1;
+		REQUIRE(read_packet(input, ec, context, publish_header, payload_size) == (i == 10));
+		REQUIRE(!ec);
+	}
+	REQUIRE(publish_header.topic == "a/b/c");
+	REQUIRE(publish_header.qos == QoS::at_least_once);
+	REQUIRE(publish_header.packet_identifier == 1);
+	REQUIRE(payload_size == 5);
+}
+
+TEST_CASE("client processes a buffer")
+{
+	typedef Basic_client<Buffer_input, std::ostream, Topic, Return_codes, std::chrono::steady_clock> Parent;
+
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+		std::string topic;
+		std::string payload;
+
+	protected:
+		void on_publish(std::error_code& ec, const Publish_header<String_type>& header, std::istream& payload,
+		                std::size_t payload_size) override
+		{
+			topic.assign(header.topic.begin(), header.topic.end());
+			this->payload.resize(payload_size);
+			payload.read(&this->payload[0], payload_size);
+		}
+	};
+
+	const auto data = packet("\x30\x0c\x00\x05" "a/b/c" "hello" "\xd0\x00");
+	Buffer_input input{ data.data(), data.size() };
+	std::ostringstream output;
+	Client client{ input, output };
+
+	std::error_code ec;
+	REQUIRE(client.process_one(ec, input.available()) == 14);
+	REQUIRE(!ec);
+	REQUIRE(client.topic == "a/b/c");
+	REQUIRE(client.payload == "hello");
+	REQUIRE(client.process_one(ec, input.available()) == 2);
+	REQUIRE(!ec);
+	REQUIRE(input.consumed() == data.size());
+}
+
+TEST_CASE("buffer and stream decoding", "[.benchmark]")
+{
+	benchmark_packet<Connack_header>("CONNACK", packet("\x20\x02\x00\x00"));
+	benchmark_packet<Publish_header<Topic>>("PUBLISH",
+	                                        packet("\x32\x0e\x00\x05" "a/b/c" "\x00\x01" "hello"));
+	benchmark_packet<Puback_header>("PUBACK", packet("\x40\x02\x00\x01"));
+	benchmark_packet<Pubrec_header>("PUBREC", packet("\x50\x02\x00\x01"));
+	benchmark_packet<pubrel_header>("PUBREL", packet("\x62\x02\x00\x01"));
+	benchmark_packet<Pubcomp_header>("PUBCOMP", packet("\x70\x02\x00\x01"));
+	benchmark_packet<Suback_header<Return_codes>>("SUBACK", packet("\x90\x03\x00\x01\x00"));
+	benchmark_packet<Unsuback_header>("UNSUBACK", packet("\xb0\x02\x00\x01"));
+	benchmark_packet<Pingresp_header>("PINGRESP", packet("\xd0\x00"));
+}
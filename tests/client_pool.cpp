@@ -0,0 +1,311 @@
+#include "loopback.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <malloc.h>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/client_pool.hpp>
+#include <terraqtt/string_view.hpp>
+#include <thread>
+#include <vector>
+
+using namespace terraqtt;
+using test::publish_packet;
+using test::run_until;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef Client_pool<Clock> Pool;
+typedef Basic_client<Buffer_input, Pool::Connection, std::string, std::vector<protocol::Suback_return_code>,
+                     Clock>
+  Pooled_client;
+
+class Test_client : public Pool_client<Pooled_client> {
+public:
+	using Pool_client<Pooled_client>::Pool_client;
+
+	std::vector<std::string> messages;
+	std::size_t received = 0;
+	/// Incremented for every message if set.
+	std::size_t* total = nullptr;
+	/// Every message is forwarded to it if set.
+	Test_client* forward = nullptr;
+	/// Removed from the pool by the next publish.
+	Test_client* victim = nullptr;
+	/// Set on error.
+	std::error_code* error = nullptr;
+
+protected:
+	void on_publish(std::error_code& ec, const protocol::Publish_header<std::string>& header,
+	                std::istream& payload, std::size_t payload_size) override
+	{
+		++received;
+		messages.push_back(header.topic + " streamed");
+	}
+	void on_publish(std::error_code& ec, const protocol::Publish_header<std::string>& header,
+	                const char* payload, std::size_t payload_size) override
+	{
+		++received;
+		if (total) {
+			++*total;
+		}
+		if (forward) {
+			forward->publish(ec, header.topic, String_view{ payload, payload_size });
+		}
+		if (victim) {
+			pool().remove(*victim);
+			victim = nullptr;
+		}
+		if (messages.size() < 16) {
+			messages.push_back(header.topic + '=' + std::string(payload, payload_size));
+		}
+	}
+	void on_error(const std::error_code& ec) override
+	{
+		if (error) {
+			*error = ec;
+		}
+	}
+};
+
+/// A client without any state of its own.
+class Idle_client : public Pool_client<Pooled_client> {
+public:
+	using Pool_client<Pooled_client>::Pool_client;
+
+protected:
+	void on_publish(std::error_code& ec, const protocol::Publish_header<std::string>& header,
+	                std::istream& payload, std::size_t payload_size) override
+	{}
+};
+
+/// A socket pair whose first socket is handed to a pool.
+struct Socket_pair {
+	int sockets[2]{ -1, -1 };
+
+	Socket_pair() { REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0); }
+	~Socket_pair()
+	{
+		if (sockets[1] >= 0) {
+			::close(sockets[1]);
+		}
+	}
+};
+
+} // namespace
+
+TEST_CASE("find complete packets in received data")
+{
+	const auto packets =
+	  publish_packet("a", "first") + std::string("\xc0\x00", 2) + publish_packet("b", "second");
+	std::uint32_t rest = 0;
+	REQUIRE(detail::complete_packets(packets.data(), packets.size(), 64, rest) == packets.size());
+	REQUIRE(detail::complete_packets(packets.data(), packets.size() - 1, 64, rest) == 12);
+	REQUIRE(detail::complete_packets(packets.data(), 11, 64, rest) == 10);
+	REQUIRE(detail::complete_packets(packets.data(), 1, 64, rest) == 0);
+	REQUIRE(rest == 0);
+
+	// too large for the buffer
+	const auto large = publish_packet("c", std::string(100, 'x'));
+	REQUIRE(detail::complete_packets(large.data(), 50, 64, rest) == 50);
+	REQUIRE(rest == large.size() - 50);
+	const auto next = large.substr(50) + packets;
+	REQUIRE(detail::complete_packets(next.data(), next.size() - 1, 64, rest) == next.size() - 11);
+	REQUIRE(rest == 0);
+
+	// the remaining length has more than four bytes
+	const std::string malformed("\x30\xff\xff\xff\xff\x01", 6);
+	REQUIRE(detail::complete_packets(malformed.data(), malformed.size(), 64, rest) == malformed.size());
+}
+
+TEST_CASE("run clients in a pool")
+{
+	test::Loopback first_loopback;
+	test::Loopback second_loopback;
+	Pool pool;
+	std::error_code ec;
+	pool.open(ec);
+	REQUIRE(!ec);
+
+	const auto first  = pool.add<Test_client>(ec, ::dup(first_loopback.client()));
+	const auto second = pool.add<Test_client>(ec, ::dup(second_loopback.client()));
+	REQUIRE(!ec);
+	REQUIRE(pool.size() == 2);
+	first->auto_acknowledge(true);
+	first->connect(ec, String_view{ "first" });
+	second->connect(ec, String_view{ "second" });
+	REQUIRE(first->buffered() > 0);
+	REQUIRE(pool.lent() == 2);
+	pool.flush();
+	REQUIRE(pool.lent() == 0);
+	REQUIRE(first_loopback.read(19).substr(0, 2) == std::string("\x10\x11", 2));
+	REQUIRE(second_loopback.read(20).substr(0, 2) == std::string("\x10\x12", 2));
+
+	// messages to the first client are forwarded to the second one
+	first->forward = second;
+	const std::string packets =
+	  std::string("\x32\x0a\x00\x01" "a\x00\x01hello", 12) + publish_packet("b", "world");
+	::send(first_loopback.server(), packets.data(), packets.size(), 0);
+	REQUIRE(run_until(pool, [&] { return first->messages.size() == 2; }));
+	REQUIRE(first->messages == std::vector<std::string>{ "a=hello", "b=world" });
+	REQUIRE(first_loopback.read(4) == std::string("\x40\x02\x00\x01", 4));
+	REQUIRE(second_loopback.read(20) == publish_packet("a", "hello") + publish_packet("b", "world"));
+	REQUIRE(pool.lent() == 0);
+
+	// the broker goes away
+	std::error_code error;
+	first->error = &error;
+	::shutdown(first_loopback.server(), SHUT_WR);
+	REQUIRE(run_until(pool, [&] { return static_cast<bool>(error); }));
+	REQUIRE(error == Error::connection_closed);
+	REQUIRE(pool.size() == 1);
+}
+
+TEST_CASE("receive packets in parts in a pool")
+{
+	test::Loopback loopback;
+	Pool pool{ 64 };
+	std::error_code ec;
+	pool.open(ec);
+	const auto client = pool.add<Test_client>(ec, ::dup(loopback.client()));
+
+	// the payload is still handed out in place
+	const auto packet = publish_packet("a", std::string(30, 'x'));
+	::send(loopback.server(), packet.data(), 20, 0);
+	REQUIRE(run_until(pool, [&] { return pool.lent() == 1; }));
+	REQUIRE(client->received == 0);
+	::send(loopback.server(), packet.data() + 20, packet.size() - 20, 0);
+	REQUIRE(run_until(pool, [&] { return client->received == 1; }));
+	REQUIRE(client->messages.back() == "a=" + std::string(30, 'x'));
+	REQUIRE(pool.lent() == 0);
+
+	// larger than the receive buffer
+	const auto packets = publish_packet("b", std::string(100, 'x')) + publish_packet("c", "small");
+	::send(loopback.server(), packets.data(), packets.size(), 0);
+	REQUIRE(run_until(pool, [&] { return client->received == 3; }));
+	REQUIRE(client->messages[1] == "b streamed");
+	REQUIRE(client->messages[2] == "c=small");
+	REQUIRE(pool.lent() == 0);
+}
+
+TEST_CASE("send to a blocked socket in a pool")
+{
+	test::Loopback loopback;
+	Pool pool;
+	std::error_code ec;
+	pool.open(ec);
+	const auto client = pool.add<Test_client>(ec, ::dup(loopback.client()));
+
+	// more than the socket takes while nobody reads
+	const std::string payload(60 * 1024, 'x');
+	std::size_t total = 0;
+	for (int i = 0; i < 256; ++i) {
+		client->publish(ec, String_view{ "a" }, payload);
+		total += 7 + payload.size();
+	}
+	pool.flush();
+	REQUIRE(!ec);
+	REQUIRE(client->buffered() > 0);
+	REQUIRE(client->window().buffered == client->buffered());
+
+	loopback.start_draining();
+	REQUIRE(run_until(pool, [&] { return !client->buffered(); }));
+	REQUIRE(pool.lent() == 0);
+	::shutdown(loopback.client(), SHUT_WR);
+	while (loopback.drained() < total) {
+		std::this_thread::yield();
+	}
+	REQUIRE(loopback.drained() == total);
+}
+
+TEST_CASE("remove clients from a pool")
+{
+	test::Loopback first_loopback;
+	test::Loopback second_loopback;
+	Pool pool;
+	std::error_code ec;
+	pool.open(ec);
+
+	// whichever client receives first removes the other one
+	const auto first  = pool.add<Test_client>(ec, ::dup(first_loopback.client()));
+	const auto second = pool.add<Test_client>(ec, ::dup(second_loopback.client()));
+	first->victim     = second;
+	second->victim    = first;
+	const auto packet = publish_packet("a", "x");
+	::send(first_loopback.server(), packet.data(), packet.size(), 0);
+	::send(second_loopback.server(), packet.data(), packet.size(), 0);
+	REQUIRE(run_until(pool, [&] { return pool.size() == 1; }));
+	REQUIRE(!ec);
+
+	pool.clear();
+	REQUIRE(pool.empty());
+	REQUIRE(first_loopback.read(2) == std::string("\xe0\x00", 2));
+	REQUIRE(second_loopback.read(2) == std::string("\xe0\x00", 2));
+
+	// the socket is closed with its client
+	Socket_pair pair;
+	pool.add<Test_client>(ec, pair.sockets[0]);
+	pool.clear();
+	char buffer[4];
+	REQUIRE(::recv(pair.sockets[1], buffer, sizeof(buffer), 0) == 2);
+	REQUIRE(::recv(pair.sockets[1], buffer, sizeof(buffer), 0) == 0);
+}
+
+TEST_CASE("measure the memory of idle pooled clients")
+{
+	// stays well below the usual limit of 1024 open files
+	constexpr std::size_t count = 200;
+	std::vector<std::unique_ptr<Socket_pair>> pairs;
+	for (std::size_t i = 0; i < count; ++i) {
+		pairs.emplace_back(new Socket_pair{});
+	}
+	Pool pool;
+	std::error_code ec;
+	pool.open(ec);
+	pool.add<Idle_client>(ec, pairs[0]->sockets[0]);
+	pool.clear();
+
+	// the client, its allocation and the slot in the pool
+	const auto before = ::mallinfo2().uordblks;
+	for (std::size_t i = 1; i < count; ++i) {
+		pool.add<Idle_client>(ec, pairs[i]->sockets[0]);
+	}
+	const auto per_client = (::mallinfo2().uordblks - before) / (count - 1);
+	REQUIRE(!ec);
+	CAPTURE(sizeof(Idle_client), sizeof(Pooled_client), per_client);
+	REQUIRE(per_client < 512);
+	REQUIRE(pool.lent() == 0);
+}
+
+TEST_CASE("pool with many connections", "[.benchmark]")
+{
+	std::vector<std::unique_ptr<test::Loopback>> loopbacks;
+	for (int i = 0; i < 100; ++i) {
+		loopbacks.emplace_back(new test::Loopback{});
+	}
+
+	Pool pool;
+	std::error_code ec;
+	pool.open(ec);
+	std::size_t total = 0;
+	for (auto& loopback : loopbacks) {
+		pool.add<Test_client>(ec, ::dup(loopback->client()))->total = &total;
+	}
+
+	const auto packet = publish_packet("telemetry", std::string(40, 'x'));
+	BENCHMARK("client pool")
+	{
+		for (auto& loopback : loopbacks) {
+			::send(loopback->server(), packet.data(), packet.size(), 0);
+		}
+		const auto target = total + loopbacks.size();
+		while (total < target && !ec) {
+			pool.run_once(ec);
+		}
+		return ec;
+	};
+}
@@ -0,0 +1,314 @@
+#include "common.hpp"
+#include "loopback.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <terraqtt/client.hpp>
+#include <terraqtt/coalescing_output.hpp>
+#include <terraqtt/string_view.hpp>
+#include <vector>
+
+using namespace terraqtt;
+using test::Manual_clock;
+
+namespace {
+
+/// Records every write and flush.
+struct Recording_output {
+	typedef char char_type;
+
+	std::string data;
+	std::vector<std::size_t> writes;
+	std::size_t flushes = 0;
+	bool good           = true;
+
+	Recording_output& write(const char_type* first, std::size_t size)
+	{
+		data.append(first, size);
+		writes.push_back(size);
+		return *this;
+	}
+	void flush() { ++flushes; }
+	explicit operator bool() const noexcept { return good; }
+};
+
+template<typename Output>
+inline void publish(Output& output, std::size_t payload_size = 20)
+{
+	std::error_code ec;
+	protocol::write_packet(output, ec, protocol::Publish_header<String_view>{ "telemetry" },
+	                       std::string(payload_size, 'x'));
+	REQUIRE(!ec);
+}
+
+/// The size of a publish packet written by publish().
+inline std::size_t publish_size(std::size_t payload_size = 20)
+{
+	std::ostringstream stream;
+	publish(stream, payload_size);
+	return stream.str().size();
+}
+
+} // namespace
+
+TEST_CASE("coalesce by packet count")
+{
+	Recording_output recording;
+	Flush_policy policy;
+	policy.packets = 3;
+	Coalescing_output<Recording_output, Manual_clock> output{ recording, policy };
+
+	publish(output);
+	publish(output);
+	REQUIRE(recording.writes.empty());
+	REQUIRE(output.buffered_packets() == 2);
+	publish(output);
+	REQUIRE(recording.writes == std::vector<std::size_t>{ 3 * publish_size() });
+	REQUIRE(recording.flushes == 1);
+	REQUIRE(output.buffered() == 0);
+}
+
+TEST_CASE("coalesce by bytes and capacity")
+{
+	Recording_output recording;
+	Flush_policy policy;
+	policy.bytes = 2 * publish_size();
+	Coalescing_output<Recording_output, Manual_clock, 128> output{ recording, policy };
+
+	publish(output);
+	REQUIRE(recording.writes.empty());
+	publish(output);
+	REQUIRE(recording.writes == std::vector<std::size_t>{ 2 * publish_size() });
+
+	// larger than the capacity: the header is flushed and the payload written through
+	policy.bytes = std::numeric_limits<std::size_t>::max();
+	output.policy(policy);
+	publish(output);
+	publish(output, 200);
+	REQUIRE(recording.writes.size() == 3);
+	REQUIRE(recording.writes[2] == 200);
+	REQUIRE(output.buffered() == 0);
+
+	std::ostringstream expected;
+	for (const auto size : { 20, 20, 20, 200 }) {
+		publish(expected, size);
+	}
+	REQUIRE(recording.data == expected.str());
+}
+
+TEST_CASE("coalesce until the delay expires")
+{
+	Recording_output recording;
+	Flush_policy policy;
+	policy.max_delay = std::chrono::milliseconds{ 5 };
+	Coalescing_output<Recording_output, Manual_clock> output{ recording, policy };
+
+	publish(output);
+	Manual_clock::current += std::chrono::milliseconds{ 4 };
+	publish(output);
+	output.update();
+	REQUIRE(recording.writes.empty());
+	REQUIRE(output.deadline() == Manual_clock::current + std::chrono::milliseconds{ 1 });
+
+	Manual_clock::current += std::chrono::milliseconds{ 1 };
+	output.update();
+	REQUIRE(recording.writes == std::vector<std::size_t>{ 2 * publish_size() });
+}
+
+TEST_CASE("flush control packets immediately")
+{
+	Recording_output recording;
+	Flush_policy policy;
+	policy.immediate_types |= Flush_policy::type_bit(protocol::Control_packet_type::puback);
+	Coalescing_output<Recording_output, Manual_clock> output{ recording, policy };
+
+	publish(output);
+	std::error_code ec;
+	protocol::write_packet(output, ec, protocol::Puback_header{ 1 });
+	REQUIRE(recording.writes == std::vector<std::size_t>{ publish_size() + 4 });
+
+	publish(output);
+	protocol::write_packet(output, ec, protocol::Pingreq_header{});
+	REQUIRE(recording.writes.size() == 2);
+	REQUIRE(recording.writes[1] == publish_size() + 2);
+}
+
+TEST_CASE("client flushes the coalescing output")
+{
+	typedef Coalescing_output<Recording_output, Manual_clock> Output;
+	Recording_output recording;
+	Output output{ recording };
+	std::istringstream input;
+	{
+		Basic_client<std::istream, Output, std::string, std::vector<protocol::Suback_return_code>, Manual_clock>
+		  client{ input, output };
+
+		std::error_code ec;
+		client.publish(ec, String_view{ "a" }, String_view{ "b" });
+		client.publish(ec, String_view{ "a" }, String_view{ "b" });
+		REQUIRE(recording.writes.empty());
+		client.flush(ec);
+		REQUIRE(!ec);
+		REQUIRE(recording.writes == std::vector<std::size_t>{ 12 });
+	}
+
+	// the disconnect of the destructor is flushed immediately
+	REQUIRE(recording.writes.size() == 2);
+	REQUIRE(recording.data.substr(12) == std::string("\xe0\x00", 2));
+}
+
+TEST_CASE("next deadline of the client")
+{
+	typedef Coalescing_output<Recording_output, Manual_clock> Output;
+	Recording_output recording;
+	Flush_policy policy;
+	policy.max_delay = std::chrono::milliseconds{ 5 };
+	Output output{ recording, policy };
+	std::istringstream input;
+	Basic_client<std::istream, Output, std::string, std::vector<protocol::Suback_return_code>, Manual_clock>
+	  client{ input, output };
+	REQUIRE(client.next_deadline() == Manual_clock::time_point::max());
+
+	std::error_code ec;
+	client.connect(ec, String_view{ "id" }, true, Seconds{ 30 });
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 30 });
+
+	client.publish(ec, String_view{ "a" }, String_view{ "b" });
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::milliseconds{ 5 });
+	client.flush(ec);
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 30 });
+
+	// the ping timeout
+	client.ping(ec);
+	REQUIRE(client.next_deadline() == Manual_clock::current + std::chrono::seconds{ 15 });
+}
+
+TEST_CASE("report a failed flush of the delay")
+{
+	typedef Coalescing_output<Recording_output, Manual_clock> Output;
+	Recording_output recording;
+	Flush_policy policy;
+	policy.max_delay = std::chrono::milliseconds{ 5 };
+	Output output{ recording, policy };
+	std::istringstream input;
+	Basic_client<std::istream, Output, std::string, std::vector<protocol::Suback_return_code>, Manual_clock>
+	  client{ input, output };
+
+	std::error_code ec;
+	client.publish(ec, String_view{ "a" }, String_view{ "b" });
+	client.update_state(ec);
+	REQUIRE(!ec);
+
+	recording.good = false;
+	Manual_clock::current += std::chrono::milliseconds{ 5 };
+	client.update_state(ec);
+	REQUIRE(recording.writes.size() == 1);
+	REQUIRE(ec == std::errc::io_error);
+}
+
+TEST_CASE("limit the buffered bytes")
+{
+	typedef Coalescing_output<Recording_output, Manual_clock> Output;
+	typedef Basic_client<std::istream, Output, std::string, std::vector<protocol::Suback_return_code>,
+	                     Manual_clock>
+	  Parent;
+
+	class Client : public Parent {
+	public:
+		using Parent::Parent;
+
+		std::size_t writable = 0;
+
+	protected:
+		void on_writable(std::error_code& ec) override { ++writable; }
+	};
+
+	Recording_output recording;
+	Output output{ recording };
+	std::istringstream input;
+	Client client{ input, output };
+	Flow_limits limits;
+	limits.max_buffered = 29;
+	client.flow_limits(limits);
+
+	// a packet always fits into an empty output
+	std::error_code ec;
+	const std::string payload(40, 'x');
+	client.publish(ec, String_view{ "a" }, payload);
+	REQUIRE(!ec);
+	client.flush(ec);
+	REQUIRE(recording.data.size() == 45);
+
+	client.publish(ec, String_view{ "a" }, String_view{ "1234567890" });
+	REQUIRE(client.window().buffered == 15);
+	client.publish(ec, String_view{ "a" }, String_view{ "1234567890" });
+	REQUIRE(ec == Error::would_block);
+	REQUIRE(client.window().buffered == 15);
+	REQUIRE(client.writable == 0);
+
+	ec.clear();
+	client.flush(ec);
+	REQUIRE(!ec);
+	REQUIRE(client.writable == 1);
+	REQUIRE(client.window().buffered == 0);
+	client.publish(ec, String_view{ "a" }, String_view{ "1234567890" });
+	REQUIRE(!ec);
+}
+
+TEST_CASE("coalescing over loopback", "[.benchmark]")
+{
+	constexpr std::size_t messages = 1000;
+	const std::string payload(40, 'x');
+
+	{
+		test::Loopback loopback;
+		loopback.start_draining();
+		test::Socket_output socket{ loopback.client() };
+		BENCHMARK("throughput direct")
+		{
+			for (std::size_t i = 0; i < messages; ++i) {
+				publish(socket, payload.size());
+			}
+			return socket.calls();
+		};
+	}
+	{
+		test::Loopback loopback;
+		loopback.start_draining();
+		test::Socket_output socket{ loopback.client() };
+		Coalescing_output<test::Socket_output, std::chrono::steady_clock> output{ socket };
+		BENCHMARK("throughput coalesced")
+		{
+			for (std::size_t i = 0; i < messages; ++i) {
+				publish(output, payload.size());
+			}
+			output.flush();
+			return socket.calls();
+		};
+	}
+
+	// the time until a single message arrives
+	{
+		test::Loopback loopback;
+		test::Socket_output socket{ loopback.client() };
+		BENCHMARK("latency direct")
+		{
+			publish(socket, payload.size());
+			loopback.receive(publish_size(payload.size()));
+		};
+	}
+	{
+		test::Loopback loopback;
+		test::Socket_output socket{ loopback.client() };
+		Flush_policy policy;
+		policy.packets = 1;
+		Coalescing_output<test::Socket_output, std::chrono::steady_clock> output{ socket, policy };
+		BENCHMARK("latency coalesced with one packet")
+		{
+			publish(output, payload.size());
+			loopback.receive(publish_size(payload.size()));
+		};
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef TERRAQTT_TESTS_COMMON_HPP_
+#define TERRAQTT_TESTS_COMMON_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace test {
+
+/// A clock that only moves when told to. The template only allows defining `current` in this header.
+template<typename Tag = void>
+struct Basic_manual_clock {
+	typedef std::chrono::microseconds duration;
+	typedef duration::rep rep;
+	typedef duration::period period;
+	typedef std::chrono::time_point<Basic_manual_clock> time_point;
+
+	constexpr static bool is_steady = true;
+	static time_point current;
+
+	static time_point now() noexcept { return current; }
+};
+
+template<typename Tag>
+typename Basic_manual_clock<Tag>::time_point Basic_manual_clock<Tag>::current;
+
+typedef Basic_manual_clock<> Manual_clock;
+
+/// A PUBACK, PUBREC, PUBREL or PUBCOMP packet depending on the first byte `type`.
+inline std::string ack(char type, std::uint16_t packet_id)
+{
+	return { type, 0x02, static_cast<char>(packet_id >> 8), static_cast<char>(packet_id & 0xff) };
+}
+
+/// Discards everything written to it.
+struct Null_output {
+	typedef char char_type;
+
+	Null_output& write(const char_type* data, std::size_t size) noexcept { return *this; }
+	explicit operator bool() const noexcept { return true; }
+};
+
+} // namespace test
+
+#endif
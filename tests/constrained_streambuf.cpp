@@ -0,0 +1,177 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <string>
+#include <terraqtt/client.hpp>
+#include <terraqtt/detail/constrained_streambuf.hpp>
+#include <vector>
+
+using namespace terraqtt;
+
+namespace {
+
+/// A stream buffer without a get area.
+class Unbuffered : public std::streambuf {
+public:
+	Unbuffered(const std::string& data) : _first(data.data()), _last(data.data() + data.size()) {}
+
+protected:
+	int_type underflow() override
+	{
+		return _first == _last ? traits_type::eof() : traits_type::to_int_type(*_first);
+	}
+	int_type uflow() override
+	{
+		return _first == _last ? traits_type::eof() : traits_type::to_int_type(*_first++);
+	}
+
+private:
+	const char* _first;
+	const char* _last;
+};
+
+/// Counts the bytes written to it.
+class Counting_sink : public std::streambuf {
+public:
+	std::size_t count = 0;
+
+protected:
+	std::streamsize xsputn(const char_type* buffer, std::streamsize n) override
+	{
+		count += static_cast<std::size_t>(n);
+		return n;
+	}
+	int_type overflow(int_type c) override
+	{
+		++count;
+		return c;
+	}
+};
+
+typedef Basic_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+                     std::chrono::steady_clock>
+  Parent;
+
+class Client : public Parent {
+public:
+	using Parent::Parent;
+
+	enum class Mode { read, rdbuf, partial } mode = Mode::read;
+	std::vector<char> buffer;
+	std::size_t received = 0;
+
+protected:
+	void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+	                std::istream& payload, std::size_t payload_size) override
+	{
+		switch (mode) {
+		case Mode::read:
+			buffer.resize(payload_size);
+			received += payload.read(buffer.data(), payload_size).gcount();
+			break;
+		case Mode::rdbuf: {
+			Counting_sink sink;
+			std::ostream{ &sink } << payload.rdbuf();
+			received += sink.count;
+			break;
+		}
+		case Mode::partial: received += payload.ignore(4).gcount(); break;
+		}
+	}
+};
+
+inline std::string publish_packet(const std::string& topic, std::size_t payload_size)
+{
+	std::ostringstream output;
+	std::error_code ec;
+	protocol::write_packet(output, ec, protocol::Publish_header<const std::string&>{ topic },
+	                       std::string(payload_size, 'x'));
+	REQUIRE(!ec);
+	return output.str();
+}
+
+} // namespace
+
+TEST_CASE("constrained reading from a buffered parent")
+{
+	std::stringstream parent{ "0123456789abc" };
+
+	detail::Constrained_streambuf buf{ *parent.rdbuf(), 10 };
+	std::istream payload{ &buf };
+	REQUIRE(payload.get() == '0');
+	char buffer[16]{};
+	REQUIRE(payload.read(buffer, 3).gcount() == 3);
+	REQUIRE(std::string{ buffer } == "123");
+	REQUIRE(buf.remaining() == 6);
+	REQUIRE(buf.release() == 6);
+	REQUIRE(parent.get() == '4');
+
+	detail::Constrained_streambuf rest{ *parent.rdbuf(), 5 };
+	payload.rdbuf(&rest);
+	REQUIRE(payload.read(buffer, 16).gcount() == 5);
+	REQUIRE(rest.release() == 0);
+	REQUIRE(parent.get() == 'a');
+}
+
+TEST_CASE("constrained reading from an unbuffered parent")
+{
+	const std::string data = "0123456789";
+	Unbuffered parent{ data };
+
+	detail::Constrained_streambuf buf{ parent, 8 };
+	std::istream payload{ &buf };
+	REQUIRE(payload.get() == '0');
+	REQUIRE(payload.get() == '1');
+	char buffer[4]{};
+	REQUIRE(payload.read(buffer, 3).gcount() == 3);
+	REQUIRE(buf.release() == 3);
+	REQUIRE(parent.sgetc() == '5');
+}
+
+TEST_CASE("unread payload is skipped")
+{
+	// the payload is never fully buffered
+	const auto data = publish_packet("a", 10) + publish_packet("b", 10);
+	Unbuffered parent{ data };
+	std::istream input{ &parent };
+	std::ostringstream output;
+	Client client{ input, output };
+	client.mode = Client::Mode::partial;
+
+	// the handler reads more than available; the stream also looks one byte ahead
+	std::error_code ec;
+	REQUIRE(client.process_one(ec, 6) == 10);
+	REQUIRE(!ec);
+	REQUIRE(client.process_one(ec, 8) == 8);
+	REQUIRE(!ec);
+	REQUIRE(client.process_one(ec, 12) == 12);
+	REQUIRE(!ec);
+	REQUIRE(client.received == 8);
+	REQUIRE(parent.sgetc() == std::char_traits<char>::eof());
+}
+
+TEST_CASE("payload throughput", "[.benchmark]")
+{
+	const std::pair<const char*, std::size_t> sizes[] = {
+		{ "1 KiB", 1024 },
+		{ "64 KiB", 64 * 1024 },
+		{ "1 MiB", 1024 * 1024 },
+	};
+
+	for (const auto& size : sizes) {
+		const auto data = publish_packet("some/topic", size.second);
+		std::stringstream input{ data };
+		std::ostringstream output;
+		Client client{ input, output };
+
+		for (const auto mode : { Client::Mode::read, Client::Mode::rdbuf }) {
+			client.mode = mode;
+			BENCHMARK(std::string{ mode == Client::Mode::read ? "read() " : "rdbuf() " } + size.first)
+			{
+				std::error_code ec;
+				input.clear();
+				input.seekg(0);
+				return client.process_one(ec, data.size());
+			};
+		}
+	}
+}
@@ -0,0 +1,249 @@
+#include "loopback.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <terraqtt/client.hpp>
+#include <terraqtt/file_payload.hpp>
+#include <terraqtt/string_view.hpp>
+#include <vector>
+
+using namespace terraqtt;
+
+namespace {
+
+/// A temporary file that is removed on destruction.
+class Temporary_file {
+public:
+	explicit Temporary_file(const std::string& content)
+	{
+		char path[] = "/tmp/terraqtt-XXXXXX";
+		_fd         = ::mkstemp(path);
+		if (_fd < 0 || ::write(_fd, content.data(), content.size()) != static_cast<ssize_t>(content.size())) {
+			throw std::runtime_error{ "failed to create temporary file" };
+		}
+		_path = path;
+	}
+	Temporary_file(const Temporary_file& copy) = delete;
+	~Temporary_file()
+	{
+		::close(_fd);
+		::unlink(_path.c_str());
+	}
+	int fd() const noexcept { return _fd; }
+	const std::string& path() const noexcept { return _path; }
+
+private:
+	int _fd;
+	std::string _path;
+};
+
+inline std::string make_content(std::size_t size)
+{
+	std::string content(size, 0);
+	for (std::size_t i = 0; i < size; ++i) {
+		content[i] = static_cast<char>(i * 31 + i / 256);
+	}
+	return content;
+}
+
+template<typename Payload>
+inline std::string encode(const Payload& payload)
+{
+	std::ostringstream stream;
+	std::error_code ec;
+	protocol::write_packet(stream, ec, protocol::Publish_header<String_view>{ "ota/image" }, payload);
+	REQUIRE(!ec);
+	return stream.str();
+}
+
+/// An output with a socket that buffers everything written to it.
+struct Holding_output {
+	typedef char char_type;
+
+	int socket;
+	std::string data;
+
+	Holding_output& write(const char_type* data, std::size_t size)
+	{
+		this->data.append(data, size);
+		return *this;
+	}
+	std::size_t buffered() const noexcept { return data.size(); }
+	int native_handle() const noexcept { return socket; }
+	explicit operator bool() const noexcept { return true; }
+};
+
+typedef Basic_client<std::istream, test::Socket_output, std::string,
+                     std::vector<protocol::Suback_return_code>, std::chrono::steady_clock>
+  Socket_client;
+
+} // namespace
+
+TEST_CASE("publish file regions")
+{
+	const auto content = make_content(100000);
+	Temporary_file file{ content };
+
+	std::error_code ec;
+	const File_payload whole{ ec, file.fd() };
+	REQUIRE(!ec);
+	REQUIRE(whole.size() == content.size());
+	REQUIRE(encode(whole) == encode(content));
+
+	// the file position is not used
+	const File_payload region{ file.fd(), 5000, 70000 };
+	REQUIRE(encode(region) == encode(content.substr(70000, 5000)));
+	REQUIRE(encode(region) == encode(content.substr(70000, 5000)));
+
+	// the region exceeds the file
+	std::ostringstream stream;
+	protocol::write_packet(stream, ec, protocol::Publish_header<String_view>{ "ota/image" },
+	                       File_payload{ file.fd(), 1000, 99500 });
+	REQUIRE(ec == Error::payload_size_mismatch);
+}
+
+TEST_CASE("publish mapped files")
+{
+	const auto content = make_content(100000);
+	Temporary_file file{ content };
+
+	std::error_code ec;
+	const Mapped_file mapped{ ec, file.fd() };
+	REQUIRE(!ec);
+	REQUIRE(mapped.size() == content.size());
+	REQUIRE(encode(mapped) == encode(content));
+
+	Temporary_file empty{ "" };
+	const Mapped_file nothing{ ec, empty.fd() };
+	REQUIRE(!ec);
+	REQUIRE(encode(nothing) == encode(std::string{}));
+}
+
+TEST_CASE("send files to sockets")
+{
+	const auto content = make_content(3 * 1024 * 1024);
+	Temporary_file file{ content };
+	test::Loopback loopback;
+	test::Socket_output output{ loopback.client() };
+	std::istringstream input;
+	Socket_client client{ input, output };
+
+	std::error_code ec;
+	const File_payload payload{ ec, file.fd() };
+	const auto expected = encode(content);
+	std::thread publisher{ [&] { client.publish(ec, String_view{ "ota/image" }, payload); } };
+	const auto received = loopback.read(expected.size());
+	publisher.join();
+	REQUIRE(!ec);
+	// only the header passes through write()
+	REQUIRE(output.calls() == 1);
+	REQUIRE(received == expected);
+}
+
+TEST_CASE("give up sending files to stalled sockets")
+{
+	// more than the socket buffers take while nobody reads
+	Temporary_file file{ make_content(32 * 1024 * 1024) };
+	test::Loopback loopback;
+	REQUIRE(::fcntl(loopback.client(), F_SETFL, ::fcntl(loopback.client(), F_GETFL) | O_NONBLOCK) == 0);
+	test::Socket_output output{ loopback.client() };
+	std::istringstream input;
+	Socket_client client{ input, output };
+
+	std::error_code ec;
+	File_payload payload{ ec, file.fd() };
+	payload.send_timeout(std::chrono::milliseconds{ 50 });
+	const auto start = std::chrono::steady_clock::now();
+	client.publish(ec, String_view{ "ota/image" }, payload);
+	REQUIRE(ec == Error::connection_timed_out);
+	REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds{ 5 });
+}
+
+TEST_CASE("send files after buffered headers")
+{
+	const auto content = make_content(100000);
+	Temporary_file file{ content };
+	int sockets[2];
+	REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+	// the header cannot be flushed, so the payload must not overtake it
+	Holding_output output{ sockets[0], {} };
+	std::error_code ec;
+	protocol::write_packet(output, ec, protocol::Publish_header<String_view>{ "ota/image" },
+	                       File_payload{ ec, file.fd() });
+	REQUIRE(!ec);
+	REQUIRE(output.data == encode(content));
+	char buffer[1];
+	REQUIRE(::recv(sockets[1], buffer, sizeof(buffer), MSG_DONTWAIT) < 0);
+	::close(sockets[0]);
+	::close(sockets[1]);
+}
+
+TEST_CASE("send files to closed sockets")
+{
+	Temporary_file file{ make_content(100000) };
+	int sockets[2];
+	REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+	::close(sockets[1]);
+
+	// without header chunks the payload goes straight to sendfile(); a SIGPIPE would end the test
+	Holding_output output{ sockets[0], {} };
+	std::error_code ec;
+	File_payload{ ec, file.fd() }.write(output, ec, nullptr, 0);
+	REQUIRE(ec == std::errc::broken_pipe);
+	::close(sockets[0]);
+}
+
+TEST_CASE("file publishing over loopback", "[.benchmark]")
+{
+	const auto content = make_content(8 * 1024 * 1024);
+	Temporary_file file{ content };
+	test::Loopback loopback;
+	loopback.start_draining();
+	test::Socket_output output{ loopback.client() };
+	std::istringstream input;
+	Socket_client client{ input, output };
+	const String_view topic{ "ota/image" };
+
+	BENCHMARK("already in memory")
+	{
+		std::error_code ec;
+		client.publish(ec, topic, content);
+		return ec;
+	};
+	BENCHMARK("read into memory")
+	{
+		std::ifstream stream{ file.path(), std::ios::binary };
+		std::string loaded(content.size(), 0);
+		stream.read(&loaded[0], static_cast<std::streamsize>(loaded.size()));
+		std::error_code ec;
+		client.publish(ec, topic, loaded);
+		return ec;
+	};
+	BENCHMARK("stream payload")
+	{
+		std::ifstream stream{ file.path(), std::ios::binary };
+		std::error_code ec;
+		client.publish(ec, topic, stream_payload<64 * 1024>(content.size(), stream));
+		return ec;
+	};
+	BENCHMARK("mapped file")
+	{
+		std::error_code ec;
+		const Mapped_file mapped{ ec, file.fd() };
+		client.publish(ec, topic, mapped);
+		return ec;
+	};
+	BENCHMARK("sendfile")
+	{
+		std::error_code ec;
+		client.publish(ec, topic, File_payload{ file.fd(), content.size() });
+		return ec;
+	};
+}
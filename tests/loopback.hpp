@@ -0,0 +1,155 @@
+#ifndef TERRAQTT_TESTS_LOOPBACK_HPP_
+#define TERRAQTT_TESTS_LOOPBACK_HPP_
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace test {
+
+/// A connected TCP socket pair on the loopback interface.
+class Loopback {
+public:
+	Loopback()
+	{
+		const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family      = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t size          = sizeof(address);
+		if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&address), size) ||
+		    ::listen(listener, 1) || ::getsockname(listener, reinterpret_cast<sockaddr*>(&address), &size)) {
+			throw std::runtime_error{ "failed to listen on loopback" };
+		}
+
+		_client = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (_client < 0 || ::connect(_client, reinterpret_cast<sockaddr*>(&address), size)) {
+			throw std::runtime_error{ "failed to connect to loopback" };
+		}
+		_server = ::accept(listener, nullptr, nullptr);
+		::close(listener);
+
+		// every write should become a segment like on a real connection
+		const int enable = 1;
+		::setsockopt(_client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	}
+	Loopback(const Loopback& copy) = delete;
+	~Loopback()
+	{
+		::shutdown(_client, SHUT_WR);
+		if (_drain.joinable()) {
+			_drain.join();
+		}
+		::close(_client);
+		::close(_server);
+	}
+	int client() const noexcept { return _client; }
+	int server() const noexcept { return _server; }
+	/// Discards everything arriving at the server in a background thread.
+	void start_draining()
+	{
+		_drain = std::thread{ [this] {
+			char buffer[64 * 1024];
+			ssize_t n;
+			while ((n = ::recv(_server, buffer, sizeof(buffer), 0)) > 0) {
+				_drained += static_cast<std::size_t>(n);
+			}
+		} };
+	}
+	std::size_t drained() const noexcept { return _drained; }
+	/// Blocks until `size` bytes arrived at the server and returns them.
+	std::string read(std::size_t size)
+	{
+		std::string data(size, 0);
+		for (std::size_t i = 0; i < size;) {
+			const auto n = ::recv(_server, &data[i], size - i, 0);
+			if (n <= 0) {
+				throw std::runtime_error{ "failed to receive" };
+			}
+			i += static_cast<std::size_t>(n);
+		}
+		return data;
+	}
+	/// Blocks until `size` bytes arrived at the server.
+	void receive(std::size_t size)
+	{
+		char buffer[4096];
+		while (size) {
+			const auto n = ::recv(_server, buffer, std::min(size, sizeof(buffer)), 0);
+			if (n <= 0) {
+				throw std::runtime_error{ "failed to receive" };
+			}
+			size -= static_cast<std::size_t>(n);
+		}
+	}
+
+private:
+	int _client;
+	int _server;
+	std::thread _drain;
+	std::atomic<std::size_t> _drained{ 0 };
+};
+
+/// Runs an event loop like a reactor or a pool until the condition holds or a second passed.
+template<typename Loop, typename Condition>
+inline bool run_until(Loop& loop, Condition&& condition)
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 1 };
+	std::error_code ec;
+	while (!condition() && !ec && std::chrono::steady_clock::now() < deadline) {
+		loop.run_once(ec, deadline);
+	}
+	return condition();
+}
+
+/// A PUBLISH packet with QoS::at_most_once for small topics and payloads.
+inline std::string publish_packet(const std::string& topic, const std::string& payload)
+{
+	const auto size = 2 + topic.size() + payload.size();
+	return std::string{ 0x30, static_cast<char>(size), 0, static_cast<char>(topic.size()) } + topic + payload;
+}
+
+/// An output writing directly to a socket with one system call per write.
+class Socket_output {
+public:
+	typedef char char_type;
+
+	explicit Socket_output(int fd) noexcept : _fd(fd) {}
+	Socket_output& write(const char_type* data, std::size_t size)
+	{
+		++_calls;
+		while (size && _good) {
+			const auto n = ::send(_fd, data, size, MSG_NOSIGNAL);
+			if (n <= 0) {
+				_good = false;
+			} else {
+				data += n;
+				size -= static_cast<std::size_t>(n);
+			}
+		}
+		return *this;
+	}
+	/// How many times write() was called.
+	std::size_t calls() const noexcept { return _calls; }
+	int native_handle() const noexcept { return _fd; }
+	explicit operator bool() const noexcept { return _good; }
+
+private:
+	int _fd;
+	bool _good         = true;
+	std::size_t _calls = 0;
+};
+
+} // namespace test
+
+#endif
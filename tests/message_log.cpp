@@ -0,0 +1,387 @@
+#include "common.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/message_log.hpp>
+#include <terraqtt/string_view.hpp>
+#include <unistd.h>
+#include <vector>
+
+using namespace terraqtt;
+using test::ack;
+using test::Manual_clock;
+
+namespace {
+
+typedef Message_log<Manual_clock> Log;
+
+/// A path for a log that is removed on destruction.
+class Temporary_path {
+public:
+	Temporary_path()
+	{
+		char path[] = "/tmp/terraqtt-log-XXXXXX";
+		const auto fd = ::mkstemp(path);
+		if (fd < 0) {
+			throw std::runtime_error{ "failed to create temporary file" };
+		}
+		::close(fd);
+		_path = path;
+	}
+	Temporary_path(const Temporary_path& copy) = delete;
+	~Temporary_path() { ::unlink(_path.c_str()); }
+	const char* c_str() const noexcept { return _path.c_str(); }
+
+private:
+	std::string _path;
+};
+
+struct Entry {
+	std::uint16_t packet_id;
+	bool released;
+	std::string topic;
+	std::string payload;
+};
+
+inline std::vector<Entry> entries(const Log& log)
+{
+	std::vector<Entry> result;
+	log.replay([&](const Log_record& record) {
+		result.push_back({ record.packet_id, record.released, { record.topic.begin(), record.topic.end() },
+		                   { record.payload.begin(), record.payload.end() } });
+	});
+	return result;
+}
+
+typedef Persistent_client<Advanced_client<std::istream, std::ostream, std::string,
+                                          std::vector<protocol::Suback_return_code>, Manual_clock>>
+  Client;
+
+inline void receive(Client& client, std::stringstream& input, const std::string& packet)
+{
+	input.clear();
+	input.str(packet);
+	std::error_code ec;
+	client.process_all(ec, packet.size());
+	REQUIRE(!ec);
+}
+
+} // namespace
+
+TEST_CASE("log messages")
+{
+	Temporary_path path;
+	std::error_code ec;
+	{
+		Log log;
+		log.open(ec, path.c_str(), 4096);
+		REQUIRE(!ec);
+		log.append(ec, 1, QoS::at_least_once, false, String_view{ "a" }, String_view{ "first" });
+		log.append(ec, 2, QoS::exactly_once, true, String_view{ "b" }, String_view{ "second" });
+		log.append(ec, 3, QoS::at_least_once, false, String_view{ "c" }, std::string{});
+		REQUIRE(!ec);
+		REQUIRE(log.size() == 3);
+
+		log.acknowledge(1);
+		log.release(2);
+		REQUIRE(!log.contains(1));
+		REQUIRE(log.contains(2));
+		// the head only moves on commit
+		REQUIRE(log.used() == 3 * 24);
+	}
+
+	// everything is restored
+	Log log;
+	log.open(ec, path.c_str(), 0);
+	REQUIRE(!ec);
+	REQUIRE(log.capacity() == 4096);
+	REQUIRE(log.size() == 2);
+	REQUIRE(log.used() == 2 * 24);
+	const auto restored = entries(log);
+	REQUIRE(restored.size() == 2);
+	REQUIRE(restored[0].packet_id == 2);
+	REQUIRE(restored[0].released);
+	REQUIRE(restored[0].topic == "b");
+	REQUIRE(restored[0].payload == "second");
+	REQUIRE(restored[1].packet_id == 3);
+	REQUIRE(!restored[1].released);
+	REQUIRE(restored[1].payload.empty());
+
+	log.replay([](const Log_record& record) {
+		if (record.packet_id == 2) {
+			REQUIRE(record.qos == QoS::exactly_once);
+			REQUIRE(record.retain);
+		}
+	});
+}
+
+TEST_CASE("wrap the log around")
+{
+	Temporary_path path;
+	std::error_code ec;
+	Log log;
+	log.open(ec, path.c_str(), 100);
+	REQUIRE(log.capacity() == 104);
+
+	// 40 bytes per record, the remaining 24 bytes at the end are padded
+	const std::string payload(20, 'x');
+	log.append(ec, 1, QoS::at_least_once, false, String_view{ "abc" }, payload);
+	log.append(ec, 2, QoS::at_least_once, false, String_view{ "abc" }, payload);
+	REQUIRE(!ec);
+	log.append(ec, 3, QoS::at_least_once, false, String_view{ "abc" }, payload);
+	REQUIRE(ec == std::errc::no_buffer_space);
+
+	// acknowledged records are reclaimed when the space is needed
+	ec.clear();
+	log.acknowledge(1);
+	log.append(ec, 3, QoS::at_least_once, false, String_view{ "abc" }, payload);
+	REQUIRE(!ec);
+	REQUIRE(log.used() == 40 + 24 + 40);
+	log.acknowledge(2);
+	log.append(ec, 4, QoS::at_least_once, false, String_view{ "abc" }, payload);
+	REQUIRE(!ec);
+
+	// too large for the ring
+	log.append(ec, 5, QoS::at_least_once, false, String_view{ "abc" }, std::string(100, 'x'));
+	REQUIRE(ec == std::errc::no_buffer_space);
+
+	log.close();
+	log.open(ec = {}, path.c_str(), 0);
+	REQUIRE(!ec);
+	const auto restored = entries(log);
+	REQUIRE(restored.size() == 2);
+	REQUIRE(restored[0].packet_id == 3);
+	REQUIRE(restored[1].packet_id == 4);
+	REQUIRE(restored[1].payload == payload);
+}
+
+TEST_CASE("ignore torn records")
+{
+	Temporary_path path;
+	std::error_code ec;
+	Log log;
+	log.open(ec, path.c_str(), 4096);
+	log.append(ec, 1, QoS::at_least_once, false, String_view{ "a" }, String_view{ "first" });
+	log.append(ec, 2, QoS::at_least_once, false, String_view{ "a" }, String_view{ "second" });
+	log.close();
+
+	// corrupt the payload of the second record
+	FILE* file = std::fopen(path.c_str(), "r+b");
+	std::fseek(file, 64 + 24 + 17, SEEK_SET);
+	std::fputc('X', file);
+	std::fclose(file);
+
+	log.open(ec, path.c_str(), 0);
+	REQUIRE(!ec);
+	REQUIRE(log.size() == 1);
+	REQUIRE(log.contains(1));
+	REQUIRE(log.used() == 24);
+
+	// not a log
+	Temporary_path other;
+	file = std::fopen(other.c_str(), "wb");
+	std::fputs("something else entirely, but long enough to hold the header of a log file......", file);
+	std::fclose(file);
+	Log invalid;
+	invalid.open(ec, other.c_str(), 4096);
+	REQUIRE(ec == std::errc::invalid_argument);
+	REQUIRE(!invalid.is_open());
+}
+
+TEST_CASE("commit in groups")
+{
+	Temporary_path path;
+	std::error_code ec;
+	Commit_policy policy;
+	policy.max_bytes = 64;
+	policy.max_delay = std::chrono::milliseconds{ 5 };
+	Log log;
+	log.open(ec, path.c_str(), 4096, policy);
+
+	log.append(ec, 1, QoS::at_least_once, false, String_view{ "a" }, String_view{ "x" });
+	REQUIRE(log.dirty());
+	REQUIRE(log.deadline() == Manual_clock::current + std::chrono::milliseconds{ 5 });
+	Manual_clock::current += std::chrono::milliseconds{ 4 };
+	log.update(ec);
+	REQUIRE(log.dirty());
+	Manual_clock::current += std::chrono::milliseconds{ 1 };
+	log.update(ec);
+	REQUIRE(!ec);
+	REQUIRE(!log.dirty());
+
+	// the byte limit
+	log.append(ec, 2, QoS::at_least_once, false, String_view{ "a" }, std::string(30, 'x'));
+	REQUIRE(log.dirty());
+	log.append(ec, 3, QoS::at_least_once, false, String_view{ "a" }, std::string(30, 'x'));
+	REQUIRE(!log.dirty());
+}
+
+TEST_CASE("resume logged messages")
+{
+	Temporary_path path;
+	std::error_code ec;
+	{
+		Log log;
+		log.open(ec, path.c_str(), 4096);
+		std::stringstream input;
+		std::stringstream output;
+		Client client{ log, input, output };
+		const auto first  = client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+		const auto second = client.publish(ec, String_view{ "b" }, String_view{ "y" }, QoS::exactly_once);
+		const auto third  = client.publish(ec, String_view{ "c" }, String_view{ "z" }, QoS::exactly_once);
+		client.publish(ec, String_view{ "d" }, String_view{ "w" });
+		REQUIRE(!ec);
+		REQUIRE(log.size() == 3);
+
+		receive(client, input, ack(0x40, first) + ack(0x50, second) + ack(0x50, third) + ack(0x70, third));
+		REQUIRE(log.size() == 1);
+	}
+
+	// a new process
+	Log log;
+	log.open(ec, path.c_str(), 4096);
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ log, input, output };
+	const auto id = client.publish(ec, String_view{ "e" }, String_view{ "v" }, QoS::at_least_once);
+	output.str({});
+	client.restore(ec);
+	REQUIRE(!ec);
+	REQUIRE(output.str() == ack(0x62, 2));
+	REQUIRE(client.in_flight() == 2);
+
+	// nothing is sent twice
+	output.str({});
+	client.restore(ec);
+	REQUIRE(output.str().empty());
+
+	receive(client, input, ack(0x70, 2) + ack(0x40, id));
+	REQUIRE(client.in_flight() == 0);
+	REQUIRE(log.size() == 0);
+}
+
+TEST_CASE("publish before restoring")
+{
+	Temporary_path path;
+	std::error_code ec;
+	{
+		Log log;
+		log.open(ec, path.c_str(), 4096);
+		std::stringstream input;
+		std::stringstream output;
+		Client client{ log, input, output };
+		REQUIRE(client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once) == 1);
+		REQUIRE(!ec);
+
+		// the identifier is still pending
+		log.append(ec, 1, QoS::at_least_once, false, String_view{ "b" }, String_view{ "y" });
+		REQUIRE(ec == std::errc::file_exists);
+		REQUIRE(log.size() == 1);
+	}
+
+	// a new process publishes before it restores
+	Log log;
+	log.open(ec = {}, path.c_str(), 4096);
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ log, input, output };
+	const auto id = client.publish(ec, String_view{ "b" }, String_view{ "y" }, QoS::at_least_once);
+	REQUIRE(!ec);
+	REQUIRE(id == 2);
+	REQUIRE(log.size() == 2);
+	REQUIRE(entries(log)[0].topic == "a");
+
+	output.str({});
+	client.restore(ec);
+	REQUIRE(!ec);
+	REQUIRE(output.str() == std::string("\x3a\x06\x00\x01" "a\x00\x01x", 8));
+	REQUIRE(client.in_flight() == 2);
+}
+
+TEST_CASE("publish nothing the log cannot take")
+{
+	Temporary_path path;
+	Log log;
+	std::error_code ec;
+	log.open(ec, path.c_str(), 64);
+	std::stringstream input;
+	std::stringstream output;
+	Client client{ log, input, output };
+	const auto first = client.publish(ec, String_view{ "a" }, std::string(30, 'x'), QoS::at_least_once);
+	REQUIRE(!ec);
+	REQUIRE(log.contains(first));
+	const auto sent = output.str();
+
+	// the log is full
+	REQUIRE(client.publish(ec, String_view{ "b" }, std::string(30, 'y'), QoS::at_least_once) == 0);
+	REQUIRE(ec == std::errc::no_buffer_space);
+	REQUIRE(output.str() == sent);
+	REQUIRE(client.in_flight() == 1);
+	REQUIRE(log.size() == 1);
+
+	// there is room again once the first message was delivered
+	receive(client, input, ack(0x40, first));
+	ec.clear();
+	const auto second = client.publish(ec, String_view{ "b" }, std::string(30, 'y'), QoS::at_least_once);
+	REQUIRE(!ec);
+	REQUIRE(log.contains(second));
+	REQUIRE(output.str().size() > sent.size());
+}
+
+TEST_CASE("resume messages")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Advanced_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+	                Manual_clock>
+	  client{ input, output };
+
+	std::error_code ec;
+	client.resume(ec, 7, String_view{ "a" }, String_view{ "x" }, QoS::exactly_once, true, false);
+	REQUIRE(!ec);
+	REQUIRE(output.str() == std::string("\x3d\x06\x00\x01" "a\x00\x07x", 8));
+	REQUIRE(client.is_in_flight(7));
+
+	client.resume(ec, 7, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once, false, false);
+	REQUIRE(ec == std::errc::invalid_argument);
+	ec.clear();
+	client.resume(ec, 8, String_view{ "a" }, String_view{ "x" }, QoS::at_most_once, false, false);
+	REQUIRE(ec == std::errc::invalid_argument);
+}
+
+TEST_CASE("message log", "[.benchmark]")
+{
+	Temporary_path path;
+	const std::string payload(64, 'x');
+	std::error_code ec;
+
+	BENCHMARK_ADVANCED("commit every message")(Catch::Benchmark::Chronometer meter)
+	{
+		Commit_policy policy;
+		policy.max_bytes = 1;
+		Log log;
+		log.open(ec, path.c_str(), 1024 * 1024, policy);
+		meter.measure([&](int i) {
+			const auto id = static_cast<std::uint16_t>(i % 60000 + 1);
+			log.append(ec, id, QoS::at_least_once, false, String_view{ "telemetry" }, payload);
+			log.acknowledge(id);
+			return ec;
+		});
+	};
+	BENCHMARK_ADVANCED("group commit")(Catch::Benchmark::Chronometer meter)
+	{
+		Log log;
+		log.open(ec, path.c_str(), 1024 * 1024);
+		meter.measure([&](int i) {
+			const auto id = static_cast<std::uint16_t>(i % 60000 + 1);
+			log.append(ec, id, QoS::at_least_once, false, String_view{ "telemetry" }, payload);
+			log.acknowledge(id);
+			log.update(ec);
+			return ec;
+		});
+	};
+}
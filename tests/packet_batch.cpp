@@ -0,0 +1,168 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <string>
+#include <terraqtt/client.hpp>
+#include <terraqtt/packet_batch.hpp>
+#include <terraqtt/static_container.hpp>
+#include <terraqtt/string_view.hpp>
+#include <vector>
+
+using namespace terraqtt;
+
+namespace {
+
+/// Accepts everything but stops after `limit` bytes like a full socket buffer.
+struct Partial_output {
+	typedef char char_type;
+
+	std::string data;
+	std::size_t limit;
+	std::size_t writes = 0;
+
+	Partial_output& write(const char_type* first, std::size_t size)
+	{
+		++writes;
+		data.append(first, std::min(size, limit - data.size()));
+		return *this;
+	}
+	explicit operator bool() const noexcept { return true; }
+};
+
+/// Appends a mix of packets to the batch and writes the same packets to the stream.
+template<typename Batch>
+inline void append_mixed(Batch& batch, std::ostream& expected)
+{
+	const protocol::Publish_header<String_view> publish{ "a/b", false, false, QoS::at_least_once, 1 };
+	const Subscribe_topic<String_view> topics[] = { { "x/#", QoS::at_most_once } };
+	const protocol::Subscribe_header<const Subscribe_topic<String_view>(&)[1]> subscribe{ topics, 2 };
+
+	std::error_code ec;
+	batch.append(ec, publish, String_view{ "hello" });
+	batch.append(ec, protocol::Puback_header{ 7 });
+	batch.append(ec, subscribe);
+	batch.append(ec, protocol::Pingreq_header{});
+	REQUIRE(!ec);
+
+	protocol::write_packet(expected, ec, publish, String_view{ "hello" });
+	protocol::write_packet(expected, ec, protocol::Puback_header{ 7 });
+	protocol::write_packet(expected, ec, subscribe);
+	protocol::write_packet(expected, ec, protocol::Pingreq_header{});
+	REQUIRE(!ec);
+}
+
+} // namespace
+
+TEST_CASE("batch packets into a vector")
+{
+	std::vector<char> buffer{ 'z' };
+	Packet_batch<std::vector<char>> batch{ buffer };
+	std::ostringstream expected;
+	append_mixed(batch, expected);
+
+	const auto bytes = expected.str();
+	REQUIRE(batch.size() == 4);
+	REQUIRE(batch.bytes() == bytes.size());
+	REQUIRE(buffer.size() == bytes.size() + 1);
+	REQUIRE(std::string(batch.data(), batch.bytes()) == bytes);
+	REQUIRE(batch.offset(0) == 0);
+	REQUIRE(batch.offset(1) == 14);
+	REQUIRE(batch.offset(2) == 18);
+	REQUIRE(batch.offset(3) == bytes.size() - 2);
+	REQUIRE(batch.offset(4) == bytes.size());
+
+	std::ostringstream output;
+	std::error_code ec;
+	write_batch(output, ec, batch);
+	REQUIRE(!ec);
+	REQUIRE(output.str() == bytes);
+
+	batch.clear();
+	REQUIRE(batch.empty());
+	REQUIRE(buffer == std::vector<char>{ 'z' });
+}
+
+TEST_CASE("batch packets without allocating")
+{
+	Static_container<32, char> buffer;
+	Packet_batch<Static_container<32, char>, Static_container<4, std::size_t>> batch{ buffer };
+	std::ostringstream expected;
+	append_mixed(batch, expected);
+	REQUIRE(std::string(batch.data(), batch.bytes()) == expected.str());
+
+	// out of offsets
+	std::error_code ec;
+	batch.append(ec, protocol::Pingreq_header{});
+	REQUIRE(ec == std::errc::not_enough_memory);
+	REQUIRE(batch.size() == 4);
+	REQUIRE(batch.bytes() == expected.str().size());
+
+	// out of buffer
+	Static_container<8, char> small;
+	Packet_batch<Static_container<8, char>> small_batch{ small };
+	ec.clear();
+	small_batch.append(ec, protocol::Puback_header{ 1 });
+	small_batch.append(ec, protocol::Puback_header{ 2 });
+	REQUIRE(!ec);
+	small_batch.append(ec, protocol::Pingreq_header{});
+	REQUIRE(ec == std::errc::not_enough_memory);
+	REQUIRE(small_batch.size() == 2);
+	REQUIRE(small.size() == 8);
+}
+
+TEST_CASE("resume a partial batch write")
+{
+	std::string buffer;
+	Packet_batch<std::string> batch{ buffer };
+	std::ostringstream expected;
+	append_mixed(batch, expected);
+
+	Partial_output output;
+	output.limit = 16;
+	std::error_code ec;
+	write_batch(output, ec, batch);
+	REQUIRE(output.writes == 1);
+	REQUIRE(batch.packet_index(output.data.size()) == 1);
+	REQUIRE(batch.packet_index(batch.offset(2)) == 2);
+	REQUIRE(batch.packet_index(batch.bytes()) == batch.size());
+
+	output.limit = std::numeric_limits<std::size_t>::max();
+	write_batch(output, ec, batch, output.data.size());
+	REQUIRE(!ec);
+	REQUIRE(output.writes == 2);
+	REQUIRE(output.data == expected.str());
+}
+
+TEST_CASE("batch encoding", "[.benchmark]")
+{
+	constexpr std::size_t messages = 1000;
+	const std::string payload(40, 'x');
+	std::istringstream input;
+	std::ostringstream output;
+	Basic_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+	             std::chrono::steady_clock>
+	  client{ input, output };
+
+	BENCHMARK("publish one by one")
+	{
+		output.str({});
+		std::error_code ec;
+		for (std::size_t i = 0; i < messages; ++i) {
+			client.publish(ec, String_view{ "telemetry" }, payload);
+		}
+		return output.tellp();
+	};
+
+	std::vector<char> buffer;
+	BENCHMARK("publish batched")
+	{
+		output.str({});
+		buffer.clear();
+		Packet_batch<std::vector<char>> batch{ buffer };
+		std::error_code ec;
+		for (std::size_t i = 0; i < messages; ++i) {
+			batch.append(ec, protocol::Publish_header<String_view>{ "telemetry" }, payload);
+		}
+		write_batch(output, ec, batch);
+		return output.tellp();
+	};
+}
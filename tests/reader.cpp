@@ -1,7 +1,11 @@
 #include <catch2/catch.hpp>
+#include <list>
 #include <sstream>
+#include <string>
 #include <terraqtt/protocol/reader.hpp>
+#include <terraqtt/static_container.hpp>
 #include <utility>
+#include <vector>
 
 using namespace terraqtt::protocol;
 
@@ -52,3 +56,64 @@ TEST_CASE("read variable integer")
 	REQUIRE(static_cast<int>(value) == 268435455);
 	REQUIRE(!ec);
 }
+
+template<typename Blob>
+inline void test_blob()
+{
+	const char data[] = "\x00\x05hello\x00\x00";
+	std::error_code ec;
+
+	// all at once
+	{
+		std::stringstream ss;
+		Read_context ctx;
+		Blob blob{};
+		std::tie(ss, ctx) = create(data);
+		REQUIRE(read_blob(ss, ec, ctx, blob));
+		REQUIRE(!ec);
+		REQUIRE(std::string(blob.begin(), blob.end()) == "hello");
+		REQUIRE(ctx.sequence == 1);
+		REQUIRE(ctx.available == 2);
+
+		Blob empty{};
+		REQUIRE(read_blob(ss, ec, ctx, empty));
+		REQUIRE(!ec);
+		REQUIRE(empty.size() == 0);
+		REQUIRE(ctx.available == 0);
+	}
+
+	// byte by byte
+	{
+		std::stringstream ss;
+		Read_context ctx;
+		Blob blob{};
+		std::tie(ss, ctx) = create(data);
+		for (int i = 0; i < 6; ++i) {
+			ctx.available = 1;
+			REQUIRE(!read_blob(ss, ec, ctx, blob));
+			REQUIRE(!ec);
+		}
+		ctx.available = 1;
+		REQUIRE(read_blob(ss, ec, ctx, blob));
+		REQUIRE(!ec);
+		REQUIRE(std::string(blob.begin(), blob.end()) == "hello");
+		REQUIRE(ctx.sequence == 1);
+	}
+}
+
+TEST_CASE("read blob")
+{
+	test_blob<std::string>();
+	test_blob<std::vector<char>>();
+	test_blob<std::list<char>>();
+	test_blob<terraqtt::Static_container<8, char>>();
+
+	// too large
+	std::stringstream ss;
+	Read_context ctx;
+	std::error_code ec;
+	terraqtt::Static_container<4, char> blob;
+	std::tie(ss, ctx) = create("\x00\x05hello");
+	REQUIRE(!read_blob(ss, ec, ctx, blob));
+	REQUIRE(ec == std::errc::not_enough_memory);
+}
@@ -0,0 +1,257 @@
+#include "loopback.hpp"
+
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/epoll_reactor.hpp>
+#include <terraqtt/socket.hpp>
+#include <terraqtt/string_view.hpp>
+#include <thread>
+#include <vector>
+
+using namespace terraqtt;
+using test::publish_packet;
+using test::run_until;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef Epoll_reactor<Clock> Reactor;
+typedef Advanced_client<Socket_input, Socket_output, std::string, std::vector<protocol::Suback_return_code>,
+                        Clock>
+  Socket_client;
+
+class Test_client : public Reactor_client<Socket_client> {
+public:
+	using Reactor_client<Socket_client>::Reactor_client;
+
+	std::vector<std::string> messages;
+	std::size_t payload_bytes = 0;
+	std::error_code error;
+
+protected:
+	void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+	                std::istream& payload, std::size_t payload_size) override
+	{
+		std::string message(payload_size, 0);
+		payload.read(&message[0], payload_size);
+		messages.push_back(header.topic + '=' + message);
+	}
+	void on_publish(std::error_code& ec, const protocol::Publish_header<String_type>& header,
+	                const char* payload, std::size_t payload_size) override
+	{
+		payload_bytes += payload_size;
+		if (messages.size() < 1000) {
+			messages.push_back(header.topic + '=' + std::string(payload, payload_size));
+		}
+	}
+	void on_error(const std::error_code& ec) override { error = ec; }
+};
+
+} // namespace
+
+TEST_CASE("receive from a socket")
+{
+	test::Loopback loopback;
+	Socket_input input{ loopback.client(), 64 };
+	std::error_code ec;
+	REQUIRE(input.receive(ec) == 0);
+	REQUIRE(!ec);
+
+	const auto packets = publish_packet("a", "first") + publish_packet("b", std::string(40, 'x'));
+	::send(loopback.server(), packets.data(), 20, 0);
+	while (input.available() < 20) {
+		input.receive(ec);
+	}
+	REQUIRE(input.get() == 0x30);
+	REQUIRE(input.get() == 8);
+
+	// the unread bytes move to the front to make room
+	::send(loopback.server(), packets.data() + 20, packets.size() - 20, 0);
+	while (input.available() < packets.size() - 2) {
+		REQUIRE(!ec);
+		input.receive(ec);
+	}
+	REQUIRE(input.data()[0] == 0);
+	REQUIRE(input.available() == packets.size() - 2);
+
+	::shutdown(loopback.server(), SHUT_WR);
+	while (!ec) {
+		input.receive(ec);
+	}
+	REQUIRE(ec == Error::connection_closed);
+}
+
+TEST_CASE("send to a socket without blocking")
+{
+	test::Loopback loopback;
+	Socket_output output{ loopback.client(), 1024 };
+	const std::string data(64 * 1024, 'x');
+
+	output.write(data.data(), 100);
+	REQUIRE(output.buffered() == 100);
+	output.flush();
+	REQUIRE(output.buffered() == 0);
+
+	// far more than the socket takes while nobody reads
+	for (int i = 0; i < 256; ++i) {
+		output.write(data.data(), data.size());
+	}
+	REQUIRE(output);
+	REQUIRE(output.buffered() > 0);
+
+	const auto total = 100 + 256 * data.size();
+	loopback.start_draining();
+	while (output.buffered()) {
+		output.flush();
+	}
+	REQUIRE(output);
+	::shutdown(loopback.client(), SHUT_WR);
+	while (loopback.drained() < total) {
+		std::this_thread::yield();
+	}
+	REQUIRE(loopback.drained() == total);
+}
+
+TEST_CASE("run a client on the reactor")
+{
+	test::Loopback loopback;
+	Reactor reactor;
+	std::error_code ec;
+	reactor.open(ec);
+	REQUIRE(!ec);
+
+	Test_client client{ loopback.client() };
+	client.auto_acknowledge(true);
+	client.start(ec, reactor);
+	client.connect(ec, String_view{ "id" });
+	client.flush(ec);
+	REQUIRE(!ec);
+	REQUIRE(loopback.read(16).substr(0, 2) == std::string("\x10\x0e", 2));
+
+	const std::string packets = std::string("\x20\x02\x00\x00" "\x32\x0a\x00\x01" "a\x00\x01hello", 16) +
+	                            publish_packet("b", "world");
+	::send(loopback.server(), packets.data(), packets.size(), 0);
+	REQUIRE(run_until(reactor, [&] { return client.messages.size() == 2; }));
+	REQUIRE(client.messages == std::vector<std::string>{ "a=hello", "b=world" });
+	REQUIRE(loopback.read(4) == std::string("\x40\x02\x00\x01", 4));
+
+	// the broker goes away
+	::shutdown(loopback.server(), SHUT_WR);
+	REQUIRE(run_until(reactor, [&] { return static_cast<bool>(client.error); }));
+	REQUIRE(client.error == Error::connection_closed);
+	REQUIRE(!client.is_started());
+}
+
+TEST_CASE("wait for writability on the reactor")
+{
+	test::Loopback loopback;
+	Reactor reactor;
+	std::error_code ec;
+	reactor.open(ec);
+	Test_client client{ loopback.client() };
+	client.start(ec, reactor);
+
+	// more than the socket takes while nobody reads
+	const std::string payload(60 * 1024, 'x');
+	std::size_t total = 0;
+	for (int i = 0; i < 256; ++i) {
+		client.publish(ec, String_view{ "a" }, payload);
+		total += 7 + payload.size();
+	}
+	client.flush(ec);
+	REQUIRE(!ec);
+	REQUIRE(client.output()->buffered() > 0);
+
+	loopback.start_draining();
+	REQUIRE(run_until(reactor, [&] { return !client.output()->buffered(); }));
+	REQUIRE(!client.error);
+	::shutdown(loopback.client(), SHUT_WR);
+	while (loopback.drained() < total) {
+		std::this_thread::yield();
+	}
+}
+
+TEST_CASE("keep alive on the reactor")
+{
+	test::Loopback loopback;
+	Reactor reactor{ std::chrono::milliseconds{ 1 } };
+	std::error_code ec;
+	reactor.open(ec);
+	Test_client client{ loopback.client() };
+	client.start(ec, reactor);
+	const auto start = Clock::now();
+	client.connect(ec, String_view{ "id" }, true, Seconds{ 1 });
+	client.flush(ec);
+	loopback.read(16);
+
+	// the reactor sleeps until the ping is due, waking up in between only to move the timer down the wheel
+	int wakeups = 0;
+	while (!reactor.run_once(ec) && !ec) {
+		REQUIRE(++wakeups < 10);
+	}
+	REQUIRE(Clock::now() - start >= std::chrono::seconds{ 1 });
+	REQUIRE(loopback.read(2) == std::string("\xc0\x00", 2));
+}
+
+TEST_CASE("reactor over loopback", "[.benchmark]")
+{
+	constexpr std::size_t messages = 1000;
+	const std::string payload(40, 'x');
+
+	{
+		test::Loopback loopback;
+		loopback.start_draining();
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec);
+		Test_client client{ loopback.client() };
+		client.start(ec, reactor);
+		BENCHMARK("publish throughput")
+		{
+			for (std::size_t i = 0; i < messages; ++i) {
+				client.publish(ec, String_view{ "telemetry" }, payload);
+			}
+			client.flush(ec);
+			while (client.output()->buffered() && !ec) {
+				reactor.run_once(ec);
+			}
+			return ec;
+		};
+	}
+
+	{
+		test::Loopback loopback;
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec);
+		Test_client client{ loopback.client() };
+		client.start(ec, reactor);
+
+		// the broker publishes as fast as it can
+		std::string block;
+		while (block.size() < 64 * 1024) {
+			block += publish_packet("telemetry", payload);
+		}
+		std::atomic<bool> stop{ false };
+		std::thread broker{ [&] {
+			while (!stop && ::send(loopback.server(), block.data(), block.size(), MSG_NOSIGNAL) > 0) {}
+		} };
+
+		BENCHMARK("receive throughput")
+		{
+			const auto target = client.payload_bytes + messages * payload.size();
+			while (client.payload_bytes < target && !ec) {
+				reactor.run_once(ec);
+			}
+			return ec;
+		};
+
+		stop = true;
+		::shutdown(loopback.server(), SHUT_RDWR);
+		broker.join();
+	}
+}
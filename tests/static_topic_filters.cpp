@@ -0,0 +1,107 @@
+#include <catch2/catch.hpp>
+#include <string>
+#include <terraqtt/static_container.hpp>
+#include <terraqtt/static_topic_filters.hpp>
+#include <terraqtt/topic_router.hpp>
+#include <vector>
+
+using namespace terraqtt;
+
+namespace {
+
+constexpr char exact[]    = "a/b/c";
+constexpr char plus[]     = "a/+/c";
+constexpr char a_hash[]   = "a/#";
+constexpr char hash[]     = "#";
+constexpr char two[]      = "+/+";
+constexpr char deep[]     = "a/b/c/#";
+constexpr char one[]      = "+";
+constexpr char empty[]    = "a//c";
+constexpr char sys_hash[] = "$SYS/#";
+
+typedef Static_topic_filters<exact, plus, a_hash, hash, two, deep, one, empty, sys_hash> Filters;
+
+static_assert(Filters::size() == 9, "wrong size");
+static_assert(detail::is_valid_filter("a/+/#"), "valid filter rejected");
+static_assert(!detail::is_valid_filter(""), "empty filter accepted");
+static_assert(!detail::is_valid_filter("a/#/b"), "hash not at the end accepted");
+static_assert(!detail::is_valid_filter("a/b#"), "hash inside a level accepted");
+static_assert(!detail::is_valid_filter("a/+b"), "plus inside a level accepted");
+static_assert(detail::filter_matches(plus, "a/x/c", "a/x/c" + 5), "constexpr match failed");
+static_assert(!detail::filter_matches(plus, "a/x/d", "a/x/d" + 5), "constexpr mismatch failed");
+
+struct Collector {
+	std::vector<int>& matches;
+
+	template<std::size_t Index>
+	void operator()(std::integral_constant<std::size_t, Index>)
+	{
+		matches.push_back(static_cast<int>(Index) + 1);
+	}
+};
+
+inline std::vector<int> match(const std::string& topic)
+{
+	std::vector<int> matches;
+	const auto count = Filters::dispatch(topic, Collector{ matches });
+	REQUIRE(count == matches.size());
+
+	// the mask agrees with the dispatched indices
+	std::uint64_t mask = 0;
+	for (const auto index : matches) {
+		mask |= std::uint64_t{ 1 } << (index - 1);
+	}
+	REQUIRE(Filters::match(topic) == mask);
+	return matches;
+}
+
+} // namespace
+
+TEST_CASE("match static topic filters")
+{
+	// same expectations as the runtime router
+	REQUIRE(match("a/b/c") == std::vector<int>{ 1, 2, 3, 4, 6 });
+	REQUIRE(match("a/x/c") == std::vector<int>{ 2, 3, 4 });
+	REQUIRE(match("a/b") == std::vector<int>{ 3, 4, 5 });
+	REQUIRE(match("a") == std::vector<int>{ 3, 4, 7 });
+	REQUIRE(match("a//c") == std::vector<int>{ 2, 3, 4, 8 });
+	REQUIRE(match("b/c/d") == std::vector<int>{ 4 });
+	REQUIRE(match("$SYS/x") == std::vector<int>{ 9 });
+	REQUIRE(match("a/b/cd") == std::vector<int>{ 3, 4 });
+
+	Static_container<16, char> topic;
+	for (const auto c : std::string{ "x/y" }) {
+		topic.push_back(c);
+	}
+	REQUIRE(Filters::match(topic) == (std::uint64_t{ 1 } << 3 | std::uint64_t{ 1 } << 4));
+}
+
+TEST_CASE("static topic filters", "[.benchmark]")
+{
+	std::vector<std::string> topics;
+	for (std::size_t i = 0; i < 1000; ++i) {
+		topics.push_back(i % 3 ? "a/" + std::to_string(i) + "/c" : "sensor/" + std::to_string(i));
+	}
+
+	BENCHMARK("static")
+	{
+		std::uint64_t mask = 0;
+		for (const auto& topic : topics) {
+			mask ^= Filters::match(topic);
+		}
+		return mask;
+	};
+
+	Topic_router<void (*)(std::size_t&)> router;
+	for (const auto filter : { exact, plus, a_hash, hash, two, deep, one, empty, sys_hash }) {
+		router.add(std::string{ filter }, [](std::size_t& count) { ++count; });
+	}
+	BENCHMARK("router")
+	{
+		std::size_t count = 0;
+		for (const auto& topic : topics) {
+			router.dispatch(topic, count);
+		}
+		return count;
+	};
+}
@@ -0,0 +1,295 @@
+#include "common.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/client.hpp>
+#include <terraqtt/string_view.hpp>
+#include <terraqtt/timer_wheel.hpp>
+#include <vector>
+
+using namespace terraqtt;
+using test::Manual_clock;
+using test::Null_output;
+
+namespace {
+
+typedef Timer_wheel<Manual_clock> Wheel;
+typedef std::chrono::milliseconds ms;
+
+typedef Basic_client<std::istream, Null_output, std::string, std::vector<protocol::Suback_return_code>,
+                     Manual_clock>
+  Null_client;
+
+/// Collects the contexts of the fired timers as integers.
+inline std::vector<std::size_t> expire(Wheel& wheel, Wheel::time_point now)
+{
+	std::vector<std::size_t> fired;
+	wheel.expire(now, [&](Wheel::Timer& timer) {
+		fired.push_back(reinterpret_cast<std::size_t>(timer.context()));
+	});
+	return fired;
+}
+
+inline void* context(std::size_t value) { return reinterpret_cast<void*>(value); }
+
+} // namespace
+
+TEST_CASE("expire timers")
+{
+	const Wheel::time_point origin{};
+	Wheel wheel{ ms{ 10 }, origin };
+	Wheel::Timer first{ context(1) };
+	Wheel::Timer second{ context(2) };
+	Wheel::Timer third{ context(3) };
+
+	wheel.schedule(first, origin + ms{ 25 });
+	wheel.schedule(second, origin + ms{ 30 });
+	wheel.schedule(third, origin + ms{ 5000 });
+	REQUIRE(wheel.size() == 3);
+
+	// never early
+	REQUIRE(expire(wheel, origin + ms{ 29 }).empty());
+	REQUIRE(expire(wheel, origin + ms{ 30 }) == std::vector<std::size_t>{ 1, 2 });
+	REQUIRE(!first.scheduled());
+	REQUIRE(wheel.size() == 1);
+
+	// moving and canceling
+	wheel.schedule(third, origin + ms{ 100 });
+	wheel.schedule(first, origin + ms{ 90 });
+	wheel.schedule(second, origin + ms{ 95 });
+	second.cancel();
+	REQUIRE(expire(wheel, origin + ms{ 200 }) == std::vector<std::size_t>{ 1, 3 });
+	REQUIRE(wheel.empty());
+
+	// passed deadlines fire immediately
+	wheel.schedule(first, origin);
+	REQUIRE(expire(wheel, origin + ms{ 200 }) == std::vector<std::size_t>{ 1 });
+
+	// destroyed timers are removed
+	{
+		Wheel::Timer temporary;
+		wheel.schedule(temporary, origin + ms{ 300 });
+		REQUIRE(wheel.size() == 1);
+	}
+	REQUIRE(wheel.empty());
+}
+
+TEST_CASE("next deadline of the wheel")
+{
+	const Wheel::time_point origin{};
+	Wheel wheel{ ms{ 10 }, origin };
+	Wheel::Timer first;
+	Wheel::Timer second;
+	REQUIRE(wheel.next_deadline() == Wheel::time_point::max());
+
+	wheel.schedule(first, origin + ms{ 25 });
+	REQUIRE(wheel.next_deadline() == origin + ms{ 30 });
+	wheel.schedule(second, origin + ms{ 3000 });
+	REQUIRE(wheel.next_deadline() == origin + ms{ 30 });
+	expire(wheel, origin + ms{ 30 });
+
+	// the timer moves down a level first
+	REQUIRE(wheel.next_deadline() == origin + ms{ 2560 });
+	expire(wheel, origin + ms{ 2560 });
+	REQUIRE(wheel.next_deadline() == origin + ms{ 3000 });
+
+	wheel.schedule(first, origin);
+	REQUIRE(wheel.next_deadline() == origin + ms{ 2560 });
+}
+
+TEST_CASE("reschedule timers while expiring")
+{
+	const Wheel::time_point origin{};
+	Wheel wheel{ ms{ 1 }, origin };
+	Wheel::Timer first{ context(1) };
+	Wheel::Timer second{ context(2) };
+	wheel.schedule(first, origin + ms{ 1 });
+	wheel.schedule(second, origin + ms{ 1 });
+
+	std::size_t fired = 0;
+	wheel.expire(origin + ms{ 1 }, [&](Wheel::Timer& timer) {
+		++fired;
+		// the other timer is canceled and this one fires on the next call
+		(&timer == &first ? second : first).cancel();
+		wheel.schedule(timer, origin);
+	});
+	REQUIRE(fired == 1);
+	REQUIRE(wheel.size() == 1);
+	REQUIRE(expire(wheel, origin + ms{ 1 }).size() == 1);
+}
+
+TEST_CASE("expire distant timers")
+{
+	const Wheel::time_point origin{};
+	Wheel wheel{ ms{ 1 }, origin };
+	std::vector<std::unique_ptr<Wheel::Timer>> timers;
+	std::mt19937 random{ 4711 };
+
+	// beyond the levels of the wheel
+	const std::int64_t distant[] = { (1 << 24) - 1, 1 << 24, (1 << 24) + 1, 1 << 25, (3 << 24) + 12345 };
+	for (auto deadline : distant) {
+		timers.emplace_back(new Wheel::Timer{ context(static_cast<std::size_t>(deadline)) });
+		wheel.schedule(*timers.back(), origin + ms{ deadline });
+	}
+
+	// random deadlines, steps and cancels compared with the expected result
+	std::vector<std::int64_t> deadlines(2000);
+	for (std::size_t i = 0; i < deadlines.size(); ++i) {
+		deadlines[i] = std::uniform_int_distribution<std::int64_t>{ 0, 1 << 20 }(random);
+		timers.emplace_back(new Wheel::Timer{ context(i) });
+		wheel.schedule(*timers.back(), origin + ms{ deadlines[i] });
+	}
+	for (std::size_t i = 0; i < deadlines.size(); i += 7) {
+		timers[i + 5]->cancel();
+		deadlines[i] = -1;
+	}
+
+	std::int64_t now   = 0;
+	std::size_t errors = 0;
+	while (now < (1 << 20)) {
+		now += std::uniform_int_distribution<std::int64_t>{ 0, 5000 }(random);
+		for (auto id : expire(wheel, origin + ms{ now })) {
+			if (deadlines[id] < 0 || deadlines[id] > now) {
+				++errors;
+			}
+			deadlines[id] = -1;
+		}
+		for (auto deadline : deadlines) {
+			if (deadline >= 0 && deadline <= now) {
+				++errors;
+			}
+		}
+	}
+	REQUIRE(errors == 0);
+	REQUIRE(wheel.size() == 5);
+
+	std::vector<std::size_t> fired;
+	for (now = 1 << 20; !wheel.empty(); now += 1000000) {
+		for (auto id : expire(wheel, origin + ms{ now })) {
+			REQUIRE(static_cast<std::int64_t>(id) <= now);
+			REQUIRE(static_cast<std::int64_t>(id) > now - 1000000);
+			fired.push_back(id);
+		}
+	}
+	REQUIRE(fired.size() == 5);
+}
+
+TEST_CASE("keep alive with a timer wheel")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Basic_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+	             Manual_clock>
+	  client{ input, output };
+	Wheel wheel{ ms{ 100 }, Manual_clock::now() };
+	const auto start = Manual_clock::now();
+	std::error_code ec;
+	client.attach(&wheel, &client);
+	client.connect(ec, String_view{ "id" }, true, Seconds{ 30 });
+	output.str({});
+
+	const auto update = [&](Wheel::time_point now) {
+		Manual_clock::current = now;
+		return wheel.expire(now, [&](Wheel::Timer& timer) {
+			REQUIRE(timer.context() == &client);
+			client.update_state(ec);
+		});
+	};
+
+	REQUIRE(update(start + std::chrono::seconds{ 29 }) == 0);
+	REQUIRE(update(start + std::chrono::seconds{ 30 }) == 1);
+	REQUIRE(output.str() == std::string("\xc0\x00", 2));
+
+	input.str(std::string("\xd0\x00", 2));
+	client.process_one(ec);
+	REQUIRE(!ec);
+
+	// the next ping is due 30 seconds after the last one
+	output.str({});
+	REQUIRE(update(start + std::chrono::seconds{ 59 }) == 0);
+	REQUIRE(update(start + std::chrono::seconds{ 60 }) == 1);
+	REQUIRE(output.str() == std::string("\xc0\x00", 2));
+
+	// the ping timeout
+	REQUIRE(update(start + std::chrono::seconds{ 74 }) == 0);
+	REQUIRE(!ec);
+	update(start + std::chrono::milliseconds{ 75100 });
+	REQUIRE(ec == Error::connection_timed_out);
+
+	client.attach(nullptr, nullptr);
+	REQUIRE(wheel.empty());
+}
+
+TEST_CASE("retransmit with a timer wheel")
+{
+	std::stringstream input;
+	std::stringstream output;
+	Advanced_client<std::istream, std::ostream, std::string, std::vector<protocol::Suback_return_code>,
+	                Manual_clock>
+	  client{ input, output };
+	Wheel wheel{ ms{ 100 }, Manual_clock::now() };
+	const auto start = Manual_clock::now();
+	client.retransmit_timeout(std::chrono::seconds{ 5 });
+	client.attach(&wheel, &client);
+	REQUIRE(wheel.empty());
+
+	std::error_code ec;
+	client.publish(ec, String_view{ "a" }, String_view{ "x" }, QoS::at_least_once);
+	REQUIRE(wheel.size() == 1);
+	output.str({});
+
+	Manual_clock::current = start + std::chrono::seconds{ 5 };
+	wheel.expire(Manual_clock::current, [&](Wheel::Timer& timer) { client.update_state(ec); });
+	REQUIRE(output.str() == std::string("\x3a\x06\x00\x01" "a\x00\x01x", 8));
+	REQUIRE(wheel.size() == 1);
+
+	input.str(std::string("\x40\x02\x00\x01", 4));
+	client.process_all(ec, 4);
+	REQUIRE(client.in_flight() == 0);
+	REQUIRE(wheel.empty());
+}
+
+TEST_CASE("timers of many clients", "[.benchmark]")
+{
+	constexpr std::size_t count = 20000;
+	std::istringstream input;
+	Null_output output;
+	Wheel wheel{ ms{ 10 }, Manual_clock::now() };
+	std::vector<std::unique_ptr<Null_client>> clients;
+	std::error_code ec;
+	// keep alive deadlines spread over a minute
+	for (std::size_t i = 0; i < count; ++i) {
+		Manual_clock::current += ms{ 3 };
+		clients.emplace_back(new Null_client{ input, output });
+		clients.back()->connect(ec, String_view{ "id" }, true, Seconds{ 60 });
+	}
+	// the broker never answers, so timed out clients reconnect
+	const auto update = [&](Null_client& client) {
+		std::error_code ec;
+		if (client.update_state(ec), ec) {
+			client.connect(ec, String_view{ "id" }, true, Seconds{ 60 });
+		}
+	};
+
+	BENCHMARK("poll every client")
+	{
+		Manual_clock::current += ms{ 10 };
+		for (auto& client : clients) {
+			update(*client);
+		}
+	};
+	for (auto& client : clients) {
+		client->attach(&wheel, client.get());
+	}
+	BENCHMARK("expire timer wheel")
+	{
+		Manual_clock::current += ms{ 10 };
+		return wheel.expire(Manual_clock::current,
+		                    [&](Wheel::Timer& timer) { update(*static_cast<Null_client*>(timer.context())); });
+	};
+}
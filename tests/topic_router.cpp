@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <functional>
+#include <string>
+#include <terraqtt/string_view.hpp>
+#include <terraqtt/topic_router.hpp>
+#include <vector>
+
+using namespace terraqtt;
+
+namespace {
+
+typedef Topic_router<std::function<void(std::vector<int>&)>> Router;
+
+inline std::function<void(std::vector<int>&)> push(int value)
+{
+	return [value](std::vector<int>& matches) { matches.push_back(value); };
+}
+
+inline std::vector<int> match(Router& router, const std::string& topic)
+{
+	std::vector<int> matches;
+	const auto count = router.dispatch(topic, matches);
+	REQUIRE(count == matches.size());
+	std::sort(matches.begin(), matches.end());
+	return matches;
+}
+
+inline void benchmark_router(std::size_t filters)
+{
+	Topic_router<void (*)(std::size_t&)> router;
+	const auto handler = [](std::size_t& count) { ++count; };
+	for (std::size_t i = 0; i < filters; ++i) {
+		const auto site   = std::to_string(i % 100);
+		const auto device = std::to_string(i);
+		switch (i % 4) {
+		case 0: router.add("site/" + site + "/device/" + device + "/temperature", handler); break;
+		case 1: router.add("site/" + site + "/device/" + device + "/+", handler); break;
+		case 2: router.add("site/+/device/" + device + "/#", handler); break;
+		case 3: router.add("site/" + site + "/+/" + device + "/humidity", handler); break;
+		}
+	}
+
+	std::vector<std::string> topics;
+	for (std::size_t i = 0; i < 1000; ++i) {
+		const auto device = (i * 7919) % filters;
+		topics.push_back("site/" + std::to_string(device % 100) + "/device/" + std::to_string(device) +
+		                 (i % 2 ? "/temperature" : "/humidity"));
+	}
+
+	BENCHMARK(std::to_string(filters) + " filters")
+	{
+		std::size_t count = 0;
+		for (const auto& topic : topics) {
+			router.dispatch(topic, count);
+		}
+		return count;
+	};
+}
+
+} // namespace
+
+TEST_CASE("route topics")
+{
+	Router router;
+	router.add(Subscribe_topic<String_view>{ "a/b/c", QoS::at_most_once }, push(1));
+	router.add(String_view{ "a/+/c" }, push(2));
+	router.add(String_view{ "a/#" }, push(3));
+	router.add(String_view{ "#" }, push(4));
+	router.add(String_view{ "+/+" }, push(5));
+	router.add(String_view{ "a/b/c/#" }, push(6));
+	router.add(String_view{ "+" }, push(7));
+	router.add(String_view{ "a//c" }, push(8));
+	REQUIRE(router.size() == 8);
+
+	REQUIRE(match(router, "a/b/c") == std::vector<int>{ 1, 2, 3, 4, 6 });
+	REQUIRE(match(router, "a/x/c") == std::vector<int>{ 2, 3, 4 });
+	REQUIRE(match(router, "a/b") == std::vector<int>{ 3, 4, 5 });
+	REQUIRE(match(router, "a") == std::vector<int>{ 3, 4, 7 });
+	REQUIRE(match(router, "a//c") == std::vector<int>{ 2, 3, 4, 8 });
+	REQUIRE(match(router, "b/c/d") == std::vector<int>{ 4 });
+
+	// wildcards on the first level do not match system topics
+	REQUIRE(match(router, "$SYS/x").empty());
+	router.add(String_view{ "$SYS/#" }, push(9));
+	REQUIRE(match(router, "$SYS/x") == std::vector<int>{ 9 });
+}
+
+TEST_CASE("remove routes")
+{
+	Router router;
+	const auto a = router.add(String_view{ "a/+" }, push(1));
+	const auto b = router.add(String_view{ "a/+" }, push(2));
+	REQUIRE(match(router, "a/b") == std::vector<int>{ 1, 2 });
+
+	REQUIRE(router.remove(a));
+	REQUIRE(!router.remove(a));
+	REQUIRE(match(router, "a/b") == std::vector<int>{ 2 });
+
+	// the slot is reused
+	REQUIRE(router.add(String_view{ "a/b" }, push(3)) == a);
+	REQUIRE(match(router, "a/b") == std::vector<int>{ 2, 3 });
+	REQUIRE(router.remove(b));
+	REQUIRE(router.size() == 1);
+}
+
+TEST_CASE("reject bad topic filters")
+{
+	Router router;
+	std::error_code ec;
+	for (const auto filter : { "", "a/#/b", "a/b#", "a/+b", "a+/b" }) {
+		ec.clear();
+		REQUIRE(router.add(ec, String_view{ filter }, push(1)) == Router::npos);
+		REQUIRE(ec == Error::bad_topic_filter);
+	}
+	REQUIRE(router.empty());
+}
+
+TEST_CASE("topic router", "[.benchmark]")
+{
+	benchmark_router(10000);
+	benchmark_router(100000);
+}
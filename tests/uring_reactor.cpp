@@ -0,0 +1,229 @@
+#include "loopback.hpp"
+
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <terraqtt/advanced_client.hpp>
+#include <terraqtt/epoll_reactor.hpp>
+#include <terraqtt/string_view.hpp>
+#include <terraqtt/uring_reactor.hpp>
+#include <thread>
+#include <vector>
+
+using namespace terraqtt;
+using test::publish_packet;
+using test::run_until;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef Uring_reactor<Clock> Reactor;
+typedef Advanced_client<Socket_input, Socket_output, std::string, std::vector<protocol::Suback_return_code>,
+                        Clock>
+  Socket_client;
+
+const Reactor_backend backends[] = { Reactor_backend::io_uring, Reactor_backend::epoll };
+
+template<template<typename> class Runner>
+class Counting_client : public Runner<Socket_client> {
+public:
+	using Runner<Socket_client>::Runner;
+
+	std::vector<std::string> messages;
+	std::size_t received = 0;
+	/// Incremented for every message if set.
+	std::size_t* total = nullptr;
+	std::error_code error;
+	/// Destroyed by the next publish.
+	std::unique_ptr<Counting_client> victim;
+
+protected:
+	void on_publish(std::error_code& ec, const protocol::Publish_header<std::string>& header,
+	                std::istream& payload, std::size_t payload_size) override
+	{}
+	void on_publish(std::error_code& ec, const protocol::Publish_header<std::string>& header,
+	                const char* payload, std::size_t payload_size) override
+	{
+		++received;
+		if (total) {
+			++*total;
+		}
+		victim.reset();
+		if (messages.size() < 16) {
+			messages.push_back(header.topic + '=' + std::string(payload, payload_size));
+		}
+	}
+	void on_error(const std::error_code& ec) override { error = ec; }
+};
+
+typedef Counting_client<Uring_client> Test_client;
+
+/// Measures rounds of one message to each connection from the broker.
+template<typename Client, typename Reactor>
+inline void benchmark_rounds(const char* name, Reactor& reactor,
+                             const std::vector<std::unique_ptr<test::Loopback>>& loopbacks)
+{
+	const auto packet = publish_packet("telemetry", std::string(40, 'x'));
+	std::vector<std::unique_ptr<Client>> clients;
+	std::size_t total = 0;
+	std::error_code ec;
+	for (auto& loopback : loopbacks) {
+		clients.emplace_back(new Client{ loopback->client() });
+		clients.back()->total = &total;
+		clients.back()->start(ec, reactor);
+	}
+
+	BENCHMARK(name)
+	{
+		for (auto& loopback : loopbacks) {
+			::send(loopback->server(), packet.data(), packet.size(), 0);
+		}
+		const auto target = total + loopbacks.size();
+		while (total < target && !ec) {
+			reactor.run_once(ec);
+		}
+		return ec;
+	};
+}
+
+inline const char* name(Reactor_backend backend)
+{
+	return backend == Reactor_backend::io_uring ? "io_uring" : "epoll";
+}
+
+} // namespace
+
+TEST_CASE("run a client on the uring reactor")
+{
+	for (const auto backend : backends) {
+		INFO(name(backend));
+		test::Loopback loopback;
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec, backend);
+		REQUIRE(!ec);
+		if (backend == Reactor_backend::epoll) {
+			REQUIRE(reactor.backend() == Reactor_backend::epoll);
+		}
+
+		Test_client client{ loopback.client() };
+		client.auto_acknowledge(true);
+		client.start(ec, reactor);
+		client.connect(ec, String_view{ "id" });
+		client.flush(ec);
+		REQUIRE(!ec);
+		REQUIRE(run_until(reactor, [&] { return !client.output()->buffered(); }));
+		REQUIRE(loopback.read(16).substr(0, 2) == std::string("\x10\x0e", 2));
+
+		const std::string packets = std::string("\x20\x02\x00\x00" "\x32\x0a\x00\x01" "a\x00\x01hello", 16) +
+		                            publish_packet("b", "world");
+		::send(loopback.server(), packets.data(), packets.size(), 0);
+		REQUIRE(run_until(reactor, [&] { return client.messages.size() == 2; }));
+		REQUIRE(client.messages == std::vector<std::string>{ "a=hello", "b=world" });
+		REQUIRE(run_until(reactor, [&] { return !client.output()->buffered(); }));
+		REQUIRE(loopback.read(4) == std::string("\x40\x02\x00\x01", 4));
+
+		// the broker goes away
+		::shutdown(loopback.server(), SHUT_WR);
+		REQUIRE(run_until(reactor, [&] { return static_cast<bool>(client.error); }));
+		REQUIRE(client.error == Error::connection_closed);
+		REQUIRE(!client.is_started());
+	}
+}
+
+TEST_CASE("send asynchronously on the uring reactor")
+{
+	for (const auto backend : backends) {
+		INFO(name(backend));
+		test::Loopback loopback;
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec, backend);
+		Test_client client{ loopback.client() };
+		client.start(ec, reactor);
+
+		// more than the socket takes while nobody reads, written while the first send is in progress
+		const std::string payload(60 * 1024, 'x');
+		std::size_t total = 0;
+		for (int i = 0; i < 256; ++i) {
+			client.publish(ec, String_view{ "a" }, payload);
+			total += 7 + payload.size();
+			if (i == 0) {
+				client.flush(ec);
+			}
+		}
+		client.flush(ec);
+		REQUIRE(!ec);
+		REQUIRE(client.output()->buffered() == total);
+
+		loopback.start_draining();
+		REQUIRE(run_until(reactor, [&] { return !client.output()->buffered(); }));
+		REQUIRE(!client.error);
+		::shutdown(loopback.client(), SHUT_WR);
+		while (loopback.drained() < total) {
+			std::this_thread::yield();
+		}
+		REQUIRE(loopback.drained() == total);
+	}
+}
+
+TEST_CASE("destroy clients with operations in progress")
+{
+	for (const auto backend : backends) {
+		INFO(name(backend));
+		test::Loopback first_loopback;
+		test::Loopback second_loopback;
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec, backend);
+
+		// whichever client receives first destroys the other one
+		std::unique_ptr<Test_client> first{ new Test_client{ first_loopback.client() } };
+		std::unique_ptr<Test_client> second{ new Test_client{ second_loopback.client() } };
+		first->start(ec, reactor);
+		second->start(ec, reactor);
+		const auto first_client  = first.get();
+		const auto second_client = second.get();
+		first->victim            = std::move(second);
+		second_client->victim.reset(new Test_client{ -1 });
+
+		const auto packet = publish_packet("a", "x");
+		::send(first_loopback.server(), packet.data(), packet.size(), 0);
+		::send(second_loopback.server(), packet.data(), packet.size(), 0);
+		REQUIRE(run_until(reactor, [&] { return first_client->received == 1; }));
+		REQUIRE(!first_client->victim);
+
+		// a client with a receive in progress
+		Test_client temporary{ second_loopback.client() };
+		temporary.start(ec, reactor);
+		reactor.run_once(ec, Clock::now());
+		REQUIRE(temporary.is_started());
+		temporary.stop();
+		REQUIRE(!ec);
+	}
+}
+
+TEST_CASE("reactors with many connections", "[.benchmark]")
+{
+	std::vector<std::unique_ptr<test::Loopback>> loopbacks;
+	for (int i = 0; i < 100; ++i) {
+		loopbacks.emplace_back(new test::Loopback{});
+	}
+
+	{
+		Epoll_reactor<Clock> reactor;
+		std::error_code ec;
+		reactor.open(ec);
+		benchmark_rounds<Counting_client<Reactor_client>>("epoll reactor", reactor, loopbacks);
+	}
+	for (const auto backend : backends) {
+		Reactor reactor;
+		std::error_code ec;
+		reactor.open(ec, backend);
+		benchmark_rounds<Test_client>(backend == Reactor_backend::io_uring ? "uring reactor"
+		                                                                   : "uring reactor with epoll fallback",
+		                              reactor, loopbacks);
+	}
+}
@@ -1,8 +1,20 @@
 #include <catch2/catch.hpp>
 #include <cstring>
+#include <deque>
+#include <list>
+#include <sstream>
+#include <string>
+#include <terraqtt/protocol/connection.hpp>
+#include <terraqtt/protocol/ping.hpp>
+#include <terraqtt/protocol/publishing.hpp>
+#include <terraqtt/protocol/subscription.hpp>
 #include <terraqtt/protocol/writer.hpp>
+#include <terraqtt/static_container.hpp>
+#include <terraqtt/string_view.hpp>
+#include <vector>
 
 using namespace terraqtt::protocol;
+using terraqtt::QoS;
 
 template<std::size_t Size>
 inline void test(const char (&data)[Size], Variable_integer value)
@@ -27,3 +39,381 @@ TEST_CASE("write variable integer")
 	test("\x80\x80\x80\x01", static_cast<Variable_integer>(2097152));
 	test("\xff\xff\xff\x7f", static_cast<Variable_integer>(268435455));
 }
+
+namespace {
+
+/// Records the chunks passed to writev() and write().
+struct Gather_output {
+	typedef char char_type;
+
+	std::string data;
+	std::size_t calls  = 0;
+	std::size_t chunks = 0;
+	std::size_t writes = 0;
+
+	void writev(const Chunk* first, std::size_t count)
+	{
+		++calls;
+		chunks += count;
+		for (std::size_t i = 0; i < count; ++i) {
+			data.append(static_cast<const char*>(first[i].data), first[i].size);
+		}
+	}
+	void write(const char_type* first, std::size_t size)
+	{
+		++writes;
+		data.append(first, size);
+	}
+	explicit operator bool() const noexcept { return true; }
+};
+
+/// Counts the calls to write().
+struct Counting_output {
+	typedef char char_type;
+
+	std::size_t calls = 0;
+	std::size_t bytes = 0;
+
+	void write(const char_type* data, std::size_t size)
+	{
+		++calls;
+		bytes += size;
+	}
+	explicit operator bool() const noexcept { return true; }
+};
+
+/// Only sums up the sizes of the gathered chunks.
+struct Sizing_output {
+	typedef char char_type;
+
+	std::size_t bytes = 0;
+
+	void writev(const Chunk* first, std::size_t count) noexcept
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			bytes += first[i].size;
+		}
+	}
+	explicit operator bool() const noexcept { return true; }
+};
+
+/// Discards everything written to it.
+class Null_buffer : public std::streambuf {
+protected:
+	std::streamsize xsputn(const char_type* buffer, std::streamsize n) override { return n; }
+	int_type overflow(int_type c) override { return c; }
+};
+
+template<typename Blob>
+inline void test_blob(const Blob& blob, std::size_t calls, std::size_t writes)
+{
+	std::error_code ec;
+	Gather_output output;
+	write_blob<true>(output, ec, blob);
+	REQUIRE(!ec);
+	REQUIRE(output.data == std::string("\x00\x05hello", 7));
+	REQUIRE(output.calls == calls);
+	REQUIRE(output.writes == writes);
+}
+
+inline std::string encode_publish(const std::string& topic, QoS qos, const std::string& payload)
+{
+	std::string packet(1, static_cast<char>(0x30 | static_cast<int>(qos) << 1));
+	const auto remaining = 2 + topic.size() + (qos != QoS::at_most_once ? 2 : 0) + payload.size();
+	std::error_code ec;
+	Byte buffer[4];
+	packet.append(reinterpret_cast<char*>(buffer),
+	              write_elements(buffer, ec, static_cast<Variable_integer>(remaining)) - buffer);
+	packet += static_cast<char>(topic.size() >> 8);
+	packet += static_cast<char>(topic.size() & 0xff);
+	packet += topic;
+	if (qos != QoS::at_most_once) {
+		packet += "\x12\x34";
+	}
+	return packet + payload;
+}
+
+template<typename Topic, typename Payload>
+inline void test_publish(const Topic& topic, QoS qos, const Payload& payload, std::size_t chunks)
+{
+	Publish_header<const Topic&> header{ topic, false, false, qos, 0x1234 };
+	const auto expected = encode_publish(std::string{ topic.begin(), topic.end() }, qos,
+	                                     std::string{ payload.begin(), payload.end() });
+
+	std::error_code ec;
+	Gather_output gather;
+	write_packet(gather, ec, header, payload);
+	REQUIRE(!ec);
+	REQUIRE(gather.data == expected);
+	REQUIRE(gather.chunks == chunks);
+
+	std::ostringstream stream;
+	write_packet(stream, ec, header, payload);
+	REQUIRE(!ec);
+	REQUIRE(stream.str() == expected);
+}
+
+} // namespace
+
+template<typename Header, typename... Payload>
+inline void test_packet_size(const Header& header, const Payload&... payload)
+{
+	std::error_code ec;
+	std::ostringstream output;
+	write_packet(output, ec, header, payload...);
+	REQUIRE(!ec);
+	REQUIRE(packet_size(ec, header, payload...) == output.str().size());
+	REQUIRE(!ec);
+}
+
+TEST_CASE("variable integer size")
+{
+	for (const Variable_integer_type value :
+	     { 0u, 127u, 128u, 16383u, 16384u, 2097151u, 2097152u, variable_integer_max }) {
+		Byte buffer[4];
+		std::error_code ec;
+		const auto end = write_elements(buffer, ec, static_cast<Variable_integer>(value));
+		REQUIRE(variable_integer_size(value) == static_cast<std::size_t>(end - buffer));
+	}
+}
+
+TEST_CASE("packet sizes")
+{
+	const std::string topic = "a/b";
+	for (const auto payload_size : { 0, 100, 200, 20000 }) {
+		const std::string payload(payload_size, 'x');
+		test_packet_size(Publish_header<const std::string&>{ topic }, payload);
+		test_packet_size(Publish_header<const std::string&>{ topic, false, false, QoS::at_least_once, 1 },
+		                 payload);
+		test_packet_size(Publish_template<std::string>{ topic, QoS::exactly_once }, payload);
+	}
+	test_packet_size(Puback_header{ 1 });
+	test_packet_size(Pubrec_header{ 1 });
+	test_packet_size(pubrel_header{ 1 });
+	test_packet_size(Pubcomp_header{ 1 });
+	test_packet_size(Pingreq_header{});
+	test_packet_size(Disconnect_header{});
+
+	typedef terraqtt::Subscribe_topic<std::string> Topic;
+	const auto topics = { Topic{ "a/+", QoS::at_most_once },
+	                      Topic{ std::string(300, 't'), QoS::at_least_once } };
+	test_packet_size(Subscribe_header<decltype(topics)>{ topics, 1 });
+	const auto filters = { std::string{ "a/+" }, std::string{ "b/#" } };
+	test_packet_size(Unsubscribe_header<decltype(filters)>{ filters, 1 });
+	Suback_header<std::vector<Suback_return_code>> suback{};
+	suback.return_codes = { Suback_return_code::success0, Suback_return_code::failure };
+	test_packet_size(suback);
+
+	std::string password = "secret";
+	std::string username = "user";
+	Connect_header<const std::string&, const std::string&, const std::string&> connect{ topic };
+	connect.username      = &username;
+	connect.password      = &password;
+	connect.clean_session = true;
+	test_packet_size(connect);
+
+	// invalid headers are reported without writing
+	std::error_code ec;
+	connect.username = nullptr;
+	REQUIRE(packet_size(ec, connect) == 0);
+	REQUIRE(ec == terraqtt::Error::bad_username_password);
+
+	struct Huge_payload {
+		std::size_t size() const noexcept { return variable_integer_max; }
+		const char* begin() const noexcept { return nullptr; }
+	};
+	ec.clear();
+	REQUIRE(packet_size(ec, Publish_header<const std::string&>{ topic }, Huge_payload{}) == 0);
+	REQUIRE(ec == terraqtt::Error::variable_integer_too_large);
+}
+
+TEST_CASE("write blobs")
+{
+	const std::string string = "hello";
+	test_blob(string, 1, 0);
+	test_blob(std::vector<char>(string.begin(), string.end()), 1, 0);
+	test_blob(terraqtt::String_view{ "hello" }, 1, 0);
+	terraqtt::Static_container<8, char> container;
+	for (const auto c : string) {
+		container.push_back(c);
+	}
+	test_blob(container, 1, 0);
+
+	// the size prefix and every element are written separately
+	test_blob(std::list<char>(string.begin(), string.end()), 0, 6);
+	test_blob(std::deque<char>(string.begin(), string.end()), 0, 6);
+}
+
+TEST_CASE("write publish packets")
+{
+	const std::string short_topic = "some/topic";
+	const std::string long_topic(300, 't');
+	const std::string payload(2048, 'p');
+	const std::list<char> list_payload(100, 'l');
+
+	test_publish(short_topic, QoS::at_most_once, payload, 2);
+	test_publish(short_topic, QoS::exactly_once, payload, 2);
+	test_publish(short_topic, QoS::at_least_once, std::string{}, 1);
+	test_publish(long_topic, QoS::at_most_once, payload, 3);
+	test_publish(long_topic, QoS::at_least_once, payload, 4);
+	test_publish(std::list<char>(long_topic.begin(), long_topic.end()), QoS::at_least_once, payload, 3);
+
+	// the payload is written element by element after the header
+	Gather_output gather;
+	std::error_code ec;
+	write_packet(gather, ec, Publish_header<const std::string&>{ short_topic }, list_payload);
+	REQUIRE(gather.calls == 1);
+	REQUIRE(gather.chunks == 1);
+	REQUIRE(gather.writes == list_payload.size());
+	REQUIRE(gather.data == encode_publish(short_topic, QoS::at_most_once, std::string(100, 'l')));
+}
+
+TEST_CASE("write publish templates")
+{
+	const std::string topic   = "sensors/kitchen/temperature";
+	const std::string payload = "21.5";
+
+	for (const auto qos : { QoS::at_most_once, QoS::at_least_once, QoS::exactly_once }) {
+		const Publish_template<std::string> publish{ topic, qos, true };
+		REQUIRE(publish.valid());
+		REQUIRE(publish.qos() == qos);
+		REQUIRE(publish.retain());
+
+		for (const bool duplicate : { false, true }) {
+			std::ostringstream expected;
+			std::error_code ec;
+			write_packet(expected, ec,
+			             Publish_header<const std::string&>{ topic, duplicate, true, qos, 0x1234 }, payload);
+
+			Gather_output output;
+			write_packet(output, ec, publish, payload, 0x1234, duplicate);
+			REQUIRE(!ec);
+			REQUIRE(output.data == expected.str());
+			REQUIRE(output.calls == 1);
+		}
+	}
+
+	std::error_code ec;
+	Publish_template<terraqtt::Static_container<8, char>> small;
+	small.assign(ec, topic);
+	REQUIRE(ec == std::errc::not_enough_memory);
+	REQUIRE(!small.valid());
+
+	ec.clear();
+	Gather_output output;
+	write_packet(output, ec, small, payload);
+	REQUIRE(ec == std::errc::invalid_argument);
+}
+
+TEST_CASE("write produced payloads")
+{
+	const std::string topic = "firmware";
+	std::string payload(10000, 0);
+	for (std::size_t i = 0; i < payload.size(); ++i) {
+		payload[i] = static_cast<char>(i * 7);
+	}
+	const auto expected = encode_publish(topic, QoS::at_least_once, payload);
+	const Publish_header<const std::string&> header{ topic, false, false, QoS::at_least_once, 0x1234 };
+
+	// the header is written with the first chunk
+	std::istringstream stream{ payload };
+	Gather_output output;
+	std::error_code ec;
+	write_packet(output, ec, header, terraqtt::stream_payload<1024>(payload.size(), stream));
+	REQUIRE(!ec);
+	REQUIRE(output.data == expected);
+	REQUIRE(output.calls == 10);
+	REQUIRE(output.chunks == 11);
+	REQUIRE(packet_size(ec, header, terraqtt::stream_payload(payload.size(), stream)) == expected.size());
+
+	// input iterators
+	stream.clear();
+	stream.str(payload);
+	std::ostringstream iterated;
+	write_packet(iterated, ec, Publish_template<std::string>{ topic, QoS::at_least_once },
+	             terraqtt::iterator_payload(payload.size(), std::istreambuf_iterator<char>{ stream },
+	                                        std::istreambuf_iterator<char>{}),
+	             0x1234);
+	REQUIRE(!ec);
+	REQUIRE(iterated.str() == expected);
+
+	// the producer ends early
+	std::size_t left    = 100;
+	const auto producer = [&left](char* buffer, std::size_t size) {
+		size = std::min(size, left);
+		std::memset(buffer, 'x', size);
+		left -= size;
+		return size;
+	};
+	output = Gather_output{};
+	write_packet(output, ec, header, terraqtt::produced_payload<64>(200, producer));
+	REQUIRE(ec == terraqtt::Error::payload_size_mismatch);
+	REQUIRE(output.calls == 2);
+}
+
+TEST_CASE("blob encoding", "[.benchmark]")
+{
+	Null_buffer buffer;
+	std::ostream output{ &buffer };
+
+	for (const auto size : { std::size_t{ 1024 }, std::size_t{ 1024 * 1024 } }) {
+		const std::string contiguous(size, 'x');
+		const std::deque<char> elements(size, 'x');
+		const auto name = std::to_string(size / 1024) + " KiB ";
+
+		BENCHMARK(name + "contiguous")
+		{
+			std::error_code ec;
+			write_blob<false>(output, ec, contiguous);
+			return ec;
+		};
+		BENCHMARK(name + "element wise")
+		{
+			std::error_code ec;
+			write_blob<false>(output, ec, elements);
+			return ec;
+		};
+	}
+}
+
+TEST_CASE("publish serialization", "[.benchmark]")
+{
+	const std::string topic = "sensors/kitchen/temperature";
+	const std::string payload(2048, 'p');
+	const Publish_header<const std::string&> header{ topic, false, false, QoS::at_least_once, 1 };
+
+	BENCHMARK("2 KiB to ostream")
+	{
+		std::ostringstream stream;
+		std::error_code ec;
+		write_packet(stream, ec, header, payload);
+		return stream.tellp();
+	};
+
+	Counting_output output;
+	std::error_code ec;
+	write_packet(output, ec, header, payload);
+	WARN("write() calls per 2 KiB publish: " << output.calls);
+}
+
+TEST_CASE("publish template", "[.benchmark]")
+{
+	const std::string topic = "sensors/kitchen/temperature";
+	const std::string payload(40, 'p');
+	const Publish_template<std::string> publish{ topic, QoS::at_least_once };
+
+	Sizing_output output;
+	BENCHMARK("header")
+	{
+		std::error_code ec;
+		write_packet(output, ec, Publish_header<const std::string&>{ topic, false, false, QoS::at_least_once, 1 },
+		             payload);
+		return output.bytes;
+	};
+	BENCHMARK("template")
+	{
+		std::error_code ec;
+		write_packet(output, ec, publish, payload, 1);
+		return output.bytes;
+	};
+}